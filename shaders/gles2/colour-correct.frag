@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#version 100
+
+precision mediump float;
+
+varying vec2 Texcoord;
+
+uniform sampler2D tex;
+/*
+ * GLES 2 has no 3D textures, so the 8x8x8 table is laid out as 8 slices
+ * side by side, one for each blue level, each with red across & green down.
+ * Red & green are interpolated by the texture unit, blue between slices.
+ */
+uniform sampler2D lut;
+
+const vec2 lut_size = vec2(64.0, 8.0);
+
+void main()
+{
+	vec4 icol = texture2D(tex, Texcoord);
+	vec3 pos = icol.rgb * 7.0;
+	float slice = min(floor(pos.b), 6.0);
+	vec2 uv = (pos.rg + 0.5) / lut_size;
+	vec3 lo = texture2D(lut, uv + vec2(slice / 8.0, 0.0)).rgb;
+	vec3 hi = texture2D(lut, uv + vec2((slice + 1.0) / 8.0, 0.0)).rgb;
+	// TODO: This factor is a hold-over from the old colour correction
+	// code, when I was manually interpolating colours. Is it correct /
+	// needed anymore?
+	const float brightening = 35.0 / 31.0;
+	gl_FragColor = vec4(mix(lo, hi, pos.b - slice), 1.0) * brightening;
+}
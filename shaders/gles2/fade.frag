@@ -0,0 +1,21 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#version 100
+
+precision mediump float;
+
+uniform float time;
+
+void main()
+{
+	float alpha = clamp(time / 1.8, 0.0, 1.0);
+	gl_FragColor = vec4(vec3(0.0), alpha);
+}
@@ -0,0 +1,18 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#version 100
+
+attribute vec2 aPos;
+
+void main()
+{
+	gl_Position = vec4(aPos, 0.0, 1.0);
+}
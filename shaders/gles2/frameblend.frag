@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#version 100
+
+precision mediump float;
+
+varying vec2 Texcoord;
+
+uniform sampler2D tex;
+/* The frame before, kept in a texture of its own */
+uniform sampler2D last_tex;
+uniform int odd_frame;
+uniform bool interlacing;
+uniform bool frameblending;
+
+void main()
+{
+	vec4 old = texture2D(last_tex, Texcoord);
+	vec4 new = texture2D(tex, Texcoord);
+
+	if (interlacing) {
+		float odd = float(odd_frame);
+		float darken = floor(mod(Texcoord.y * 144.0 + odd, 2.0));
+		new *= darken * 0.5 + 0.5;
+		darken = floor(mod(Texcoord.y * 144.0 + odd + 1.0, 2.0));
+		old *= darken * 0.5 + 0.5;
+	}
+	if (frameblending) {
+		gl_FragColor = mix(new, old, 0.5);
+	} else {
+		gl_FragColor = new;
+	}
+}
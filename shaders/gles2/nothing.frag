@@ -0,0 +1,22 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#version 100
+
+precision mediump float;
+
+varying vec2 Texcoord;
+
+uniform sampler2D tex;
+
+void main()
+{
+	gl_FragColor = texture2D(tex, Texcoord);
+}
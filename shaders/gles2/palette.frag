@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#version 100
+
+precision mediump float;
+
+varying vec2 Texcoord;
+
+/* Palette indices, see src/pixel.h */
+uniform sampler2D tex;
+/* One row of colours per line, sampled at the same height as tex */
+uniform sampler2D palette;
+
+const float palette_size = 65.0;
+
+void main()
+{
+	float index = floor(texture2D(tex, Texcoord).r * 255.0 + 0.5);
+	/* Indices past the end clamp to white, the last entry */
+	gl_FragColor = texture2D(palette, vec2((index + 0.5) / palette_size, Texcoord.y));
+}
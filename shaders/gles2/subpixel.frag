@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#version 100
+
+/* Subpixel positions need more than mediump's 10 bits at large sizes */
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+
+varying vec2 Texcoord;
+
+uniform sampler2D tex;
+
+const vec3 r = vec3(255.0, 113.0, 69.0) / 255.0;
+const vec3 g = vec3(193.0, 214.0, 80.0) / 255.0;
+const vec3 b = vec3(59.0, 206.0, 255.0) / 255.0;
+
+const float radius = 2.0;
+const float radius2 = radius * radius;
+
+vec3 circ(vec3 x)
+{
+	return sqrt(max(radius2 - x * x, 0.0)) / radius;
+}
+
+void main()
+{
+	vec3 src;
+	src.r = texture2D(tex, Texcoord + vec2(1.0 / 480.0, 0.0)).r;
+	src.g = texture2D(tex, Texcoord).g;
+	src.b = texture2D(tex, Texcoord - vec2(1.0 / 480.0, 0.0)).b;
+	vec3 x = mod(Texcoord.x * 160.0 * 7.0 + vec3(3.0, 1.0, 5.0), 7.0) - vec3(3.0, 3.0, 2.0);
+	vec3 weight = circ(x);
+	float y = mod(Texcoord.y * 144.0 * 7.0, 7.0);
+	vec3 dst = vec3(0.0);
+	dst += src.r * r * weight.r;
+	dst += src.g * g * weight.g;
+	dst += src.b * b * weight.b;
+	float gridline = max(ceil((y - 1.0) / 6.0), 0.7);
+	gl_FragColor = vec4(gridline * dst, 1.0);
+}
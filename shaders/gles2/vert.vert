@@ -0,0 +1,22 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#version 100
+
+attribute vec2 aPos;
+attribute vec2 aTex;
+
+varying vec2 Texcoord;
+
+void main()
+{
+	Texcoord = aTex;
+	gl_Position = vec4(aPos, 0.0, 1.0);
+}
@@ -10,20 +10,24 @@
 
 #include "core.h"
 #include "apu.h"
+#include "apu_log.h"
 #include "bit_utils.h"
+#include "blip.h"
 #include "debug.h"
 #include "gbcc.h"
 #include "memory.h"
 #include "nelem.h"
-#include "time_diff.h"
 #include <stdint.h>
-#include <time.h>
 
-#define SYNC_FREQ 1024
-#define SYNC_RESET_CLOCKS 512
-#define CLOCKS_PER_SYNC (GBC_CLOCK_FREQ / SYNC_FREQ)
-#define SLEEP_TIME (SECOND / SYNC_FREQ)
-#define SLEEP_DETECT (SECOND / 10)
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* Max amplitude / no. channels / max global volume multiplier */
+#define MAX_CHANNEL_AMPLITUDE (INT16_MAX / 4 / 0x10u)
+/* Max channel amplitude / max envelope volume multiplier */
+#define BASE_AMPLITUDE (MAX_CHANNEL_AMPLITUDE / 0x10u)
+
+/* Below this many clocks, stepping the lfsr is quicker than jumping */
+#define LFSR_JUMP_THRESHOLD 32
 
 static const bool duty_table[4][8] = {
 	{0, 0, 0, 0, 0, 0, 0, 1}, 	/* 00000001b */
@@ -36,9 +40,21 @@ static void length_counter_clock(struct channel *ch);
 static uint16_t frequency_calc(struct sweep *sweep);
 static bool timer_clock(struct timer *timer);
 static void timer_reset(struct timer *timer);
+static uint32_t timer_remaining(const struct timer *timer);
+static bool timer_advance(struct timer *timer, uint32_t cycles);
+static uint32_t timer_skip(struct timer *timer, uint32_t cycles);
+static void clock_channels(struct gbcc_core *gbc);
+static bool audible(const struct apu *apu, const struct channel *ch, uint8_t volume);
 static bool duty_clock(struct duty *duty);
+static bool duty_step(struct channel *ch);
+static bool noise_step(struct apu *apu, uint32_t steps);
+static uint16_t lfsr_clock(uint16_t lfsr, bool width_mode);
+static uint16_t lfsr_multiply(const uint16_t matrix[16], uint16_t lfsr);
+static uint16_t lfsr_jump(uint16_t lfsr, uint32_t steps, bool width_mode);
+static void wave_step(struct gbcc_core *gbc, uint32_t steps);
 static void envelope_clock(struct envelope *envelope);
-static void time_sync(struct gbcc_core *gbc);
+static void update_output(struct gbcc_core *gbc);
+static void channel_output(const struct channel *ch, int32_t amplitude, int32_t *left, int32_t *right);
 static void ch1_trigger(struct gbcc_core *gbc);
 static void ch2_trigger(struct gbcc_core *gbc);
 static void ch3_trigger(struct gbcc_core *gbc);
@@ -46,35 +62,176 @@ static void ch4_trigger(struct gbcc_core *gbc);
 
 void gbcc_apu_init(struct gbcc_core *gbc)
 {
+	struct apu_output output = gbc->apu.output;
 	gbc->apu = (struct apu){0};
+	gbc->apu.output = output;
 	gbc->apu.wave.addr = WAVE_START;
-	clock_gettime(CLOCK_REALTIME, &gbc->apu.start_time);
+}
+
+/*
+ * Start or stop recording output in a blip buffer. While stopped, no samples
+ * are synthesised, and the channels do only the work the CPU could notice.
+ */
+void gbcc_apu_set_output(struct gbcc_core *gbc, struct gbcc_blip *blip)
+{
+	struct apu_output *output = &gbc->apu.output;
+	if (blip == output->blip) {
+		return;
+	}
+	gbcc_apu_catch_up(gbc);
+	output->blip = blip;
+	output->clock = 0;
+	if (blip) {
+		/* Start from silence, the same as a freshly cleared buffer */
+		output->left = 0;
+		output->right = 0;
+		update_output(gbc);
+	}
 }
 
 ANDROID_INLINE
 void gbcc_apu_clock(struct gbcc_core *gbc)
+{
+	/* The channels are only run when something needs to see them */
+	gbc->apu.pending++;
+}
+
+void gbcc_apu_run(struct gbcc_core *gbc, uint32_t cycles)
+{
+	gbc->apu.pending += cycles;
+}
+
+/*
+ * Run the channels for every cycle that's passed since the last catch-up.
+ * This has to be called before anything reads or changes channel state.
+ *
+ * Between timer expiries nothing about a channel changes, so rather than
+ * clocking every cycle we jump straight from one expiry to the next,
+ * recording any change in output as we go. Channels that can't be heard
+ * don't need even that, and are skipped to the end in one go.
+ */
+void gbcc_apu_catch_up(struct gbcc_core *gbc)
 {
 	struct apu *apu = &gbc->apu;
-	if (!gbc->sync_to_video) {
-		apu->sync_clock++;
-		if (apu->sync_clock == CLOCKS_PER_SYNC) {
-			apu->sync_clock = 0;
-			apu->sample++;
-			time_sync(gbc);
-		}
+	uint32_t cycles = apu->pending;
+	if (cycles == 0) {
+		return;
+	}
+	apu->pending = 0;
+	if (apu->output.log) {
+		apu->output.log->cycle += cycles;
 	}
-
 	if (apu->disabled) {
+		apu->output.clock += cycles;
+		return;
+	}
+	if (!apu->output.blip) {
+		/*
+		 * Nobody's listening, so only keep what the CPU can see. The
+		 * length counters, sweep and envelopes are run by the sequencer
+		 * anyway, which leaves just the wave position, visible through
+		 * wave RAM while channel 3 plays. The duty and noise positions
+		 * are left where they are, which can't be heard on resuming.
+		 */
+		uint32_t steps = timer_skip(&apu->wave.timer, cycles);
+		if (steps > 0) {
+			wave_step(gbc, steps);
+		}
 		return;
 	}
 
+	/*
+	 * The first cycle is run in full, as register writes can leave state
+	 * that only settles on the next clock, e.g. a new duty cycle.
+	 */
+	apu->output.clock++;
+	clock_channels(gbc);
+	cycles--;
+
+	bool noise_clocked = apu->noise.shift < 14;
+	bool ch1_live = apu->ch1.duty.enabled && audible(apu, &apu->ch1, apu->ch1.envelope.volume);
+	bool ch2_live = apu->ch2.duty.enabled && audible(apu, &apu->ch2, apu->ch2.envelope.volume);
+	bool ch3_live = audible(apu, &apu->ch3, apu->wave.shift);
+	bool ch4_live = noise_clocked && audible(apu, &apu->ch4, apu->ch4.envelope.volume);
+
+	uint32_t remaining = cycles;
+	while (remaining > 0) {
+		uint32_t step = remaining;
+		if (ch1_live) {
+			step = MIN(step, timer_remaining(&apu->ch1.duty.timer));
+		}
+		if (ch2_live) {
+			step = MIN(step, timer_remaining(&apu->ch2.duty.timer));
+		}
+		if (ch3_live) {
+			step = MIN(step, timer_remaining(&apu->wave.timer));
+		}
+		if (ch4_live) {
+			step = MIN(step, timer_remaining(&apu->noise.timer));
+		}
+		remaining -= step;
+		apu->output.clock += step;
+
+		bool changed = false;
+		if (ch1_live && timer_advance(&apu->ch1.duty.timer, step)) {
+			changed |= duty_step(&apu->ch1);
+		}
+		if (ch2_live && timer_advance(&apu->ch2.duty.timer, step)) {
+			changed |= duty_step(&apu->ch2);
+		}
+		if (ch3_live && timer_advance(&apu->wave.timer, step)) {
+			wave_step(gbc, 1);
+			changed = true;
+		}
+		if (ch4_live && timer_advance(&apu->noise.timer, step)) {
+			changed |= noise_step(apu, 1);
+		}
+		if (changed) {
+			update_output(gbc);
+		}
+	}
+
+	if (!ch1_live && apu->ch1.duty.enabled) {
+		apu->ch1.duty.counter += timer_skip(&apu->ch1.duty.timer, cycles) % 8u;
+		apu->ch1.duty.counter %= 8u;
+		apu->ch1.state = duty_table[apu->ch1.duty.cycle][apu->ch1.duty.counter];
+	}
+	if (!ch2_live && apu->ch2.duty.enabled) {
+		apu->ch2.duty.counter += timer_skip(&apu->ch2.duty.timer, cycles) % 8u;
+		apu->ch2.duty.counter %= 8u;
+		apu->ch2.state = duty_table[apu->ch2.duty.cycle][apu->ch2.duty.counter];
+	}
+	if (!ch3_live) {
+		uint32_t steps = timer_skip(&apu->wave.timer, cycles);
+		if (steps > 0) {
+			wave_step(gbc, steps);
+		}
+	}
+	if (!ch4_live && noise_clocked) {
+		uint32_t steps = timer_skip(&apu->noise.timer, cycles);
+		if (steps > 0) {
+			noise_step(apu, steps);
+		}
+	}
+}
+
+/* A single cycle of the channels, exactly as the hardware clocks them */
+void clock_channels(struct gbcc_core *gbc)
+{
+	struct apu *apu = &gbc->apu;
+	bool changed = false;
+
 	/* Duty */
 	/* Duty cycle doesn't clock after powering on until first trigger */
 	if (apu->ch1.duty.enabled) {
-		apu->ch1.state = duty_clock(&apu->ch1.duty);
+		bool state = duty_clock(&apu->ch1.duty);
+		changed |= state != apu->ch1.state;
+		apu->ch1.state = state;
 	}
 	if (apu->ch2.duty.enabled) {
-		apu->ch2.state = duty_clock(&apu->ch2.duty);
+		bool state = duty_clock(&apu->ch2.duty);
+		changed |= state != apu->ch2.state;
+		apu->ch2.state = state;
 	}
 
 	/* Noise */
@@ -84,34 +241,26 @@ void gbcc_apu_clock(struct gbcc_core *gbc)
 	 * being called in this case.
 	 */
 	if (apu->noise.shift < 14 && timer_clock(&apu->noise.timer)) {
-		uint8_t lfsr_low = apu->noise.lfsr & 0xFFu;
-		uint8_t tmp = check_bit(lfsr_low, 0) ^ check_bit(lfsr_low, 1);
-		apu->noise.lfsr >>= 1u;
-		apu->noise.lfsr &= ~bit16(14);
-		apu->noise.lfsr |= tmp * bit16(14);
-		if (apu->noise.width_mode) {
-			apu->noise.lfsr &= ~bit(6);
-			apu->noise.lfsr |= tmp * bit(6);
-		}
-		apu->ch4.state = !check_bit16(apu->noise.lfsr, 0);
+		changed |= noise_step(apu, 1);
 	}
 
 	/* Wave */
 	if (timer_clock(&apu->wave.timer)) {
-		apu->wave.position++;
-		apu->wave.position &= 31u;
-		apu->wave.addr = WAVE_START + (apu->wave.position / 2);
-		//printf("Wave clocked to %04X\n", apu->wave.addr);
-		apu->wave.buffer = gbcc_memory_read_force(gbc, apu->wave.addr);
-		/* Alternates between high & low nibble, high first */
-		if (apu->wave.position % 2) {
-			apu->wave.buffer &= 0x0Fu;
-		} else {
-			apu->wave.buffer >>= 4u;
-		}
+		wave_step(gbc, 1);
+		changed = true;
+	}
+
+	if (changed) {
+		update_output(gbc);
 	}
 }
 
+/* Whether any change in the channel's state can change the output */
+bool audible(const struct apu *apu, const struct channel *ch, uint8_t volume)
+{
+	return ch->enabled && volume > 0 && (ch->left || ch->right);
+}
+
 void length_counter_clock(struct channel *ch)
 {
 	ch->counter--;
@@ -134,6 +283,39 @@ void timer_reset(struct timer *timer)
 	timer->counter = timer->period;
 }
 
+/*
+ * Cycles until the timer next expires. A counter of 0 wraps around on the
+ * next clock, as does a period of 0 once reloaded.
+ */
+uint32_t timer_remaining(const struct timer *timer)
+{
+	return timer->counter == 0 ? 0x10000u : timer->counter;
+}
+
+/* Advance by up to timer_remaining() cycles, returning whether it expired */
+bool timer_advance(struct timer *timer, uint32_t cycles)
+{
+	if (cycles == timer_remaining(timer)) {
+		timer_reset(timer);
+		return true;
+	}
+	timer->counter = (uint16_t)(timer->counter - cycles);
+	return false;
+}
+
+/* Advance by any number of cycles, returning how many times it expired */
+uint32_t timer_skip(struct timer *timer, uint32_t cycles)
+{
+	uint32_t remaining = timer_remaining(timer);
+	if (cycles < remaining) {
+		timer->counter = (uint16_t)(timer->counter - cycles);
+		return 0;
+	}
+	cycles -= remaining;
+	uint32_t period = timer->period == 0 ? 0x10000u : timer->period;
+	timer->counter = (uint16_t)(period - cycles % period);
+	return 1 + cycles / period;
+}
 
 bool duty_clock(struct duty *duty)
 {
@@ -153,6 +335,104 @@ bool duty_clock(struct duty *duty)
 	return duty_table[duty->cycle][duty->counter];
 }
 
+/* Move on to the next step of the duty cycle, returning whether state changed */
+bool duty_step(struct channel *ch)
+{
+	ch->duty.counter++;
+	ch->duty.counter %= 8u;
+	bool state = duty_table[ch->duty.cycle][ch->duty.counter];
+	bool changed = state != ch->state;
+	ch->state = state;
+	return changed;
+}
+
+/* Clock the lfsr a number of times, returning whether the output changed */
+bool noise_step(struct apu *apu, uint32_t steps)
+{
+	if (steps < LFSR_JUMP_THRESHOLD) {
+		for (uint32_t i = 0; i < steps; i++) {
+			apu->noise.lfsr = lfsr_clock(apu->noise.lfsr, apu->noise.width_mode);
+		}
+	} else {
+		apu->noise.lfsr = lfsr_jump(apu->noise.lfsr, steps, apu->noise.width_mode);
+	}
+	bool state = !check_bit16(apu->noise.lfsr, 0);
+	bool changed = state != apu->ch4.state;
+	apu->ch4.state = state;
+	return changed;
+}
+
+uint16_t lfsr_clock(uint16_t lfsr, bool width_mode)
+{
+	uint8_t lfsr_low = lfsr & 0xFFu;
+	uint8_t tmp = check_bit(lfsr_low, 0) ^ check_bit(lfsr_low, 1);
+	lfsr >>= 1u;
+	lfsr &= ~bit16(14);
+	lfsr |= tmp * bit16(14);
+	if (width_mode) {
+		lfsr &= ~bit(6);
+		lfsr |= tmp * bit(6);
+	}
+	return lfsr;
+}
+
+/*
+ * The lfsr is linear over GF(2), so each clock is a multiplication by a
+ * 16x16 bit matrix, stored here as its columns. Raising it to the power of
+ * 2^n lets us clock any number of times in at most 32 multiplications.
+ */
+uint16_t lfsr_multiply(const uint16_t matrix[16], uint16_t lfsr)
+{
+	uint16_t res = 0;
+	for (uint8_t i = 0; i < 16; i++) {
+		if (check_bit16(lfsr, i)) {
+			res ^= matrix[i];
+		}
+	}
+	return res;
+}
+
+uint16_t lfsr_jump(uint16_t lfsr, uint32_t steps, bool width_mode)
+{
+	static uint16_t jump_table[2][32][16];
+	static bool table_built;
+	if (!table_built) {
+		for (uint8_t w = 0; w < 2; w++) {
+			for (uint8_t i = 0; i < 16; i++) {
+				jump_table[w][0][i] = lfsr_clock(bit16(i), w);
+			}
+			for (size_t n = 1; n < N_ELEM(jump_table[w]); n++) {
+				for (uint8_t i = 0; i < 16; i++) {
+					uint16_t col = lfsr_multiply(jump_table[w][n - 1], bit16(i));
+					jump_table[w][n][i] = lfsr_multiply(jump_table[w][n - 1], col);
+				}
+			}
+		}
+		table_built = true;
+	}
+	for (size_t n = 0; steps > 0; n++, steps >>= 1u) {
+		if (steps & 1u) {
+			lfsr = lfsr_multiply(jump_table[width_mode][n], lfsr);
+		}
+	}
+	return lfsr;
+}
+
+/* Move on a number of wave samples, and load the new one */
+void wave_step(struct gbcc_core *gbc, uint32_t steps)
+{
+	struct wave *wave = &gbc->apu.wave;
+	wave->position = (uint8_t)((wave->position + steps) & 31u);
+	wave->addr = WAVE_START + (wave->position / 2);
+	wave->buffer = gbcc_memory_read_force(gbc, wave->addr);
+	/* Alternates between high & low nibble, high first */
+	if (wave->position % 2) {
+		wave->buffer &= 0x0Fu;
+	} else {
+		wave->buffer >>= 4u;
+	}
+}
+
 void envelope_clock(struct envelope *envelope)
 {
 	if (!envelope->enabled) {
@@ -181,6 +461,11 @@ uint16_t frequency_calc(struct sweep *sweep)
 
 void gbcc_apu_sequencer_clock(struct gbcc_core *gbc)
 {
+	gbcc_apu_catch_up(gbc);
+	if (gbc->apu.output.log) {
+		gbcc_apu_log_sequencer(gbc);
+	}
+
 	/* Length counters every other clock */
 	if (!(gbc->apu.sequencer_counter & 0x01u)) {
 		if (gbc->apu.ch1.length_enable && gbc->apu.ch1.enabled) {
@@ -226,31 +511,13 @@ void gbcc_apu_sequencer_clock(struct gbcc_core *gbc)
 
 	gbc->apu.sequencer_counter++;
 	gbc->apu.sequencer_counter &= 0x7u;
-}
-
-void time_sync(struct gbcc_core *gbc)
-{
-	clock_gettime(CLOCK_REALTIME, &gbc->apu.cur_time);
-	uint64_t diff = gbcc_time_diff(&gbc->apu.cur_time, &gbc->apu.start_time);
-	if (diff > SLEEP_DETECT + (SECOND * gbc->apu.sample) / SYNC_FREQ || gbc->keys.turbo) {
-		gbc->apu.start_time = gbc->apu.cur_time;
-		gbc->apu.sample = 0;
-		return;
-	}
-	while (diff < (SECOND * gbc->apu.sample) / SYNC_FREQ) {
-		const struct timespec time = {.tv_sec = 0, .tv_nsec = SLEEP_TIME};
-		nanosleep(&time, NULL);
-		clock_gettime(CLOCK_REALTIME, &gbc->apu.cur_time);
-		diff = gbcc_time_diff(&gbc->apu.cur_time, &gbc->apu.start_time);
-	}
-	if (gbc->apu.sample > SYNC_RESET_CLOCKS) {
-		gbc->apu.sample = 0;
-		gbc->apu.start_time = gbc->apu.cur_time;
-	}
+	update_output(gbc);
 }
 
 void gbcc_apu_memory_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 {
+	gbcc_apu_catch_up(gbc);
+
 	uint8_t tmp;
 	switch (addr) {
 		case NR10:
@@ -462,6 +729,53 @@ void gbcc_apu_memory_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 		default:
 			gbcc_log_error("Invalid APU address 0x%04X\n", addr);
 	}
+	update_output(gbc);
+}
+
+/*
+ * Work out the current output level of the mixer, and record any change in
+ * the blip buffer.
+ */
+void update_output(struct gbcc_core *gbc)
+{
+	struct apu *apu = &gbc->apu;
+	if (!apu->output.blip) {
+		return;
+	}
+	int32_t left = 0;
+	int32_t right = 0;
+	channel_output(&apu->ch1, apu->ch1.state * apu->ch1.envelope.volume, &left, &right);
+	channel_output(&apu->ch2, apu->ch2.state * apu->ch2.envelope.volume, &left, &right);
+	if (apu->wave.shift == 0) {
+		channel_output(&apu->ch3, 0, &left, &right);
+	} else {
+		channel_output(&apu->ch3, apu->wave.buffer >> (apu->wave.shift - 1u), &left, &right);
+	}
+	channel_output(&apu->ch4, apu->ch4.state * apu->ch4.envelope.volume, &left, &right);
+	left *= 1 + apu->left_vol;
+	right *= 1 + apu->right_vol;
+
+	struct apu_output *output = &apu->output;
+	if (left == output->left && right == output->right) {
+		return;
+	}
+	gbcc_blip_add_delta(output->blip, output->clock, left - output->left, right - output->right);
+	output->left = left;
+	output->right = right;
+}
+
+void channel_output(const struct channel *ch, int32_t amplitude, int32_t *left, int32_t *right)
+{
+	if (ch->dac) {
+		/* The DAC produces a signal in the range [-1, 1] */
+		*left -= (int32_t)(MAX_CHANNEL_AMPLITUDE / 2);
+		*right -= (int32_t)(MAX_CHANNEL_AMPLITUDE / 2);
+	}
+	if (!ch->enabled) {
+		return;
+	}
+	*left += ch->left * amplitude * (int32_t)BASE_AMPLITUDE;
+	*right += ch->right * amplitude * (int32_t)BASE_AMPLITUDE;
 }
 
 void ch1_trigger(struct gbcc_core *gbc)
@@ -13,9 +13,10 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-#include <time.h>
 
 struct gbcc_core;
+struct gbcc_blip;
+struct gbcc_apu_log;
 
 struct timer {
 	uint16_t period;
@@ -76,15 +77,22 @@ struct channel {
 	bool right;
 };
 
+/* Preserved when the APU is powered off */
+struct apu_output {
+	struct gbcc_blip *blip;	/* Where level changes are recorded, if anywhere */
+	struct gbcc_apu_log *log;	/* Where register writes are recorded, if anywhere */
+	uint32_t clock;		/* Clocks run since the blip buffer's frame started */
+	int32_t left;
+	int32_t right;
+};
+
 struct apu {
-	uint16_t sync_clock;
-	uint16_t sample;
+	struct apu_output output;
+	uint32_t pending;	/* Cycles the channels haven't been run for yet */
 	uint8_t left_vol;
 	uint8_t right_vol;
 	bool disabled;
 	bool div_bit;
-	struct timespec cur_time;
-	struct timespec start_time;
 	struct channel ch1; 	/* Tone & Sweep */
 	struct channel ch2; 	/* Tone */
 	struct channel ch3; 	/* Wave Output */
@@ -97,6 +105,10 @@ struct apu {
 
 void gbcc_apu_init(struct gbcc_core *gbc);
 void gbcc_apu_clock(struct gbcc_core *gbc);
+/* The same as that many calls to gbcc_apu_clock */
+void gbcc_apu_run(struct gbcc_core *gbc, uint32_t cycles);
+void gbcc_apu_catch_up(struct gbcc_core *gbc);
+void gbcc_apu_set_output(struct gbcc_core *gbc, struct gbcc_blip *blip);
 void gbcc_apu_sequencer_clock(struct gbcc_core *gbc);
 void gbcc_apu_memory_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val);
 
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#include "apu_log.h"
+#include "apu.h"
+#include "core.h"
+#include "debug.h"
+#include <string.h>
+
+/*
+ * The file starts with a magic number, a version and the mode the capture
+ * was made in. Each record then follows as the clocks since the previous one,
+ * in LEB128, and a tag byte. Register writes are tagged with the low byte of
+ * their address and followed by the value written; the other events use tags
+ * that no sound register has.
+ */
+#define MAGIC "GBCCAPU"
+#define VERSION 1u
+#define TAG_SEQUENCER 0xFFu
+#define TAG_END 0xFEu
+
+static void record(struct gbcc_core *gbc, uint8_t tag, const uint8_t *data, size_t len);
+static bool read_varint(FILE *file, uint64_t *value);
+
+bool gbcc_apu_log_start(struct gbcc_core *gbc, struct gbcc_apu_log *log, const char *filename)
+{
+	*log = (struct gbcc_apu_log){0};
+	log->file = fopen(filename, "wb");
+	if (!log->file) {
+		gbcc_log_error("Failed to open APU log %s.\n", filename);
+		return false;
+	}
+	log->mode = gbc->mode;
+	const uint8_t header[] = {VERSION, gbc->mode == GBC};
+	if (fwrite(MAGIC, 1, sizeof(MAGIC), log->file) != sizeof(MAGIC)
+			|| fwrite(header, 1, sizeof(header), log->file) != sizeof(header)) {
+		gbcc_log_error("Failed to write APU log %s.\n", filename);
+		fclose(log->file);
+		log->file = NULL;
+		return false;
+	}
+	/* Don't count anything the APU hasn't caught up on yet */
+	gbcc_apu_catch_up(gbc);
+	gbc->apu.output.log = log;
+	gbcc_log_info("Recording APU writes to %s.\n", filename);
+	return true;
+}
+
+void gbcc_apu_log_stop(struct gbcc_core *gbc)
+{
+	struct gbcc_apu_log *log = gbc->apu.output.log;
+	if (!log) {
+		return;
+	}
+	gbcc_apu_catch_up(gbc);
+	record(gbc, TAG_END, NULL, 0);
+	/* Recording may have failed and stopped already */
+	log = gbc->apu.output.log;
+	if (!log) {
+		return;
+	}
+	gbc->apu.output.log = NULL;
+	gbcc_log_info("Recorded %llu APU events over %.1f seconds.\n",
+			(unsigned long long)log->records,
+			(double)log->cycle / GBC_CLOCK_FREQ);
+	gbcc_apu_log_close(log);
+}
+
+void gbcc_apu_log_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
+{
+	gbcc_apu_catch_up(gbc);
+	record(gbc, (uint8_t)(addr & 0xFFu), &val, 1);
+}
+
+void gbcc_apu_log_sequencer(struct gbcc_core *gbc)
+{
+	record(gbc, TAG_SEQUENCER, NULL, 0);
+}
+
+bool gbcc_apu_log_open(struct gbcc_apu_log *log, const char *filename)
+{
+	*log = (struct gbcc_apu_log){0};
+	log->file = fopen(filename, "rb");
+	if (!log->file) {
+		gbcc_log_error("Failed to open APU log %s.\n", filename);
+		return false;
+	}
+	char magic[sizeof(MAGIC)];
+	uint8_t header[2];
+	if (fread(magic, 1, sizeof(magic), log->file) != sizeof(magic)
+			|| fread(header, 1, sizeof(header), log->file) != sizeof(header)
+			|| memcmp(magic, MAGIC, sizeof(magic)) != 0) {
+		gbcc_log_error("%s is not an APU log.\n", filename);
+		gbcc_apu_log_close(log);
+		return false;
+	}
+	if (header[0] != VERSION) {
+		gbcc_log_error("Unsupported APU log version %u.\n", header[0]);
+		gbcc_apu_log_close(log);
+		return false;
+	}
+	log->mode = header[1] ? GBC : DMG;
+	return true;
+}
+
+bool gbcc_apu_log_read(struct gbcc_apu_log *log, struct gbcc_apu_log_record *record)
+{
+	uint64_t delta;
+	int tag;
+	if (!read_varint(log->file, &delta) || (tag = fgetc(log->file)) == EOF) {
+		return false;
+	}
+	log->cycle += delta;
+	*record = (struct gbcc_apu_log_record){.cycle = log->cycle};
+	switch (tag) {
+		case TAG_SEQUENCER:
+			record->event = GBCC_APU_LOG_SEQUENCER;
+			break;
+		case TAG_END:
+			record->event = GBCC_APU_LOG_END;
+			break;
+		default: {
+			int val = fgetc(log->file);
+			if (val == EOF) {
+				return false;
+			}
+			record->event = GBCC_APU_LOG_WRITE;
+			record->addr = (uint16_t)(0xFF00u | (unsigned int)tag);
+			record->val = (uint8_t)val;
+			break;
+		}
+	}
+	log->records++;
+	return true;
+}
+
+void gbcc_apu_log_close(struct gbcc_apu_log *log)
+{
+	if (log->file) {
+		fclose(log->file);
+	}
+	log->file = NULL;
+}
+
+void record(struct gbcc_core *gbc, uint8_t tag, const uint8_t *data, size_t len)
+{
+	struct gbcc_apu_log *log = gbc->apu.output.log;
+	uint8_t buf[16];
+	size_t n = 0;
+	uint64_t delta = log->cycle - log->last;
+	do {
+		uint8_t byte = delta & 0x7Fu;
+		delta >>= 7u;
+		buf[n++] = byte | (delta ? 0x80u : 0u);
+	} while (delta);
+	buf[n++] = tag;
+	if (len) {
+		memcpy(&buf[n], data, len);
+		n += len;
+	}
+	if (fwrite(buf, 1, n, log->file) != n) {
+		gbcc_log_error("Failed to write APU log, stopping recording.\n");
+		gbc->apu.output.log = NULL;
+		gbcc_apu_log_close(log);
+		return;
+	}
+	log->last = log->cycle;
+	log->records++;
+}
+
+bool read_varint(FILE *file, uint64_t *value)
+{
+	*value = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		int byte = fgetc(file);
+		if (byte == EOF) {
+			return false;
+		}
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#ifndef GBCC_APU_LOG_H
+#define GBCC_APU_LOG_H
+
+#include "constants.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct gbcc_core;
+
+/*
+ * A capture of everything the APU was told to do, so that its output can be
+ * reproduced without the CPU or PPU. Each record is stamped with the number
+ * of APU clocks since capture started, and is one of:
+ *
+ *   - a write to a sound register (NR10-NR52), wave RAM or DIV
+ *   - a tick of the frame sequencer, which is driven by DIV, and so moves
+ *     with DIV resets and speed switches
+ *   - the end of the capture
+ *
+ * Captures start from whatever state the APU is in, so are only complete
+ * when started from power-on.
+ */
+struct gbcc_apu_log {
+	FILE *file;
+	enum CART_MODE mode;
+	uint64_t cycle;		/* APU clocks since capture started */
+	uint64_t last;		/* Cycle of the last record */
+	uint64_t records;
+};
+
+enum gbcc_apu_log_event {
+	GBCC_APU_LOG_WRITE,
+	GBCC_APU_LOG_SEQUENCER,
+	GBCC_APU_LOG_END
+};
+
+struct gbcc_apu_log_record {
+	enum gbcc_apu_log_event event;
+	uint64_t cycle;
+	uint16_t addr;		/* For writes only */
+	uint8_t val;
+};
+
+/* Capture, from the emulation thread */
+bool gbcc_apu_log_start(struct gbcc_core *gbc, struct gbcc_apu_log *log, const char *filename);
+void gbcc_apu_log_stop(struct gbcc_core *gbc);
+void gbcc_apu_log_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val);
+void gbcc_apu_log_sequencer(struct gbcc_core *gbc);
+
+/* Replay */
+bool gbcc_apu_log_open(struct gbcc_apu_log *log, const char *filename);
+/* Returns false on a truncated or corrupt log */
+bool gbcc_apu_log_read(struct gbcc_apu_log *log, struct gbcc_apu_log_record *record);
+void gbcc_apu_log_close(struct gbcc_apu_log *log);
+
+#endif /* GBCC_APU_LOG_H */
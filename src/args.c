@@ -9,6 +9,7 @@
  */
 
 #include "args.h"
+#include "audio_sink.h"
 #include "config.h"
 #include "debug.h"
 #include "gbcc.h"
@@ -22,7 +23,7 @@
 
 static void usage()
 {
-	printf("Usage: gbcc [-aAbfFhivV] [-c config_file] [-p palette] [-s shader] [-t speed] rom\n"
+	printf("Usage: gbcc [-aAbfFhimrvV] [-c config_file] [-L apu_log] [-o audio] [-p palette] [-s shader] [-t speed] rom\n"
 	       "  -a, --autoresume      Automatically resume gameplay if possible.\n"
 	       "  -A, --autosave        Automatically save SRAM after last write.\n"
 	       "  -b, --background      Enable playback while unfocused.\n"
@@ -32,7 +33,13 @@ static void usage()
 	       "  -F, --frame-blending  Enable simple frame blending.\n"
 	       "  -h, --help            Print this message and exit.\n"
 	       "  -i, --interlacing     Enable interlacing.\n"
+	       "  -L, --apu-log=PATH    Record sound register writes to PATH,\n"
+	       "                        for replaying with apu-replay.\n"
+	       "  -m, --mute            Start with audio muted.\n"
+	       "  -o, --audio=SINK      Send audio to openal (default), null,\n"
+	       "                        wav:PATH or raw:PATH (- for stdout).\n"
 	       "  -p, --palette=NAME    Select the colour palette (DMG mode only).\n"
+	       "  -r, --software        Draw without GL, letting the compositor scale.\n"
 	       "  -s, --shader=NAME     Select the initial shader to use.\n"
 	       "  -S, --save-dir=PATH   Path to use for save files.\n"
 	       "  -t, --turbo=NUM    	Set a fractional speed limit for turbo mode\n"
@@ -56,7 +63,11 @@ bool gbcc_parse_args(struct gbcc *gbc, bool file_required, int argc, char **argv
 		{"frame-blending", no_argument, NULL, 'F'},
 		{"help", no_argument, NULL, 'h'},
 		{"interlacing", no_argument, NULL, 'i'},
+		{"apu-log", required_argument, NULL, 'L'},
+		{"mute", no_argument, NULL, 'm'},
+		{"audio", required_argument, NULL, 'o'},
 		{"palette", required_argument, NULL, 'p'},
+		{"software", no_argument, NULL, 'r'},
 		{"shader", required_argument, NULL, 's'},
 		{"save-dir", required_argument, NULL, 'S'},
 		{"turbo", required_argument, NULL, 't'},
@@ -64,7 +75,7 @@ bool gbcc_parse_args(struct gbcc *gbc, bool file_required, int argc, char **argv
 		{"vram-window", no_argument, NULL, 'V'},
 		{0, 0, 0, 0}
 	};
-	const char *short_options = "aAbc:C:fFhip:s:S:t:vV";
+	const char *short_options = "aAbc:C:fFhiL:mo:p:rs:S:t:vV";
 
 	for (int opt; (opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1;) {
 		if (opt == 'h') {
@@ -124,10 +135,28 @@ bool gbcc_parse_args(struct gbcc *gbc, bool file_required, int argc, char **argv
 			case 'i':
 				gbc->interlacing = true;
 				break;
+			case 'L':
+				strncpy(gbc->apu_log_path, optarg, sizeof(gbc->apu_log_path));
+				gbc->apu_log_path[N_ELEM(gbc->apu_log_path) - 1] = '\0';
+				break;
+			case 'm':
+				gbcc_audio_set_muted(gbc, true);
+				break;
+			case 'o':
+				if (!gbcc_audio_sink_find(optarg)) {
+					gbcc_log_error("Unknown audio output '%s'.\n", optarg);
+					return false;
+				}
+				strncpy(gbc->audio_output, optarg, sizeof(gbc->audio_output));
+				gbc->audio_output[N_ELEM(gbc->audio_output) - 1] = '\0';
+				break;
 			case 'p':
 				gbc->core.ppu.palette = gbcc_get_palette(optarg);
 				gbcc_log_debug("%s palette selected\n", gbc->core.ppu.palette.name);
 				break;
+			case 'r':
+				gbc->software_rendering = true;
+				break;
 			case 's':
 				strncpy(gbc->default_shader, optarg, N_ELEM(gbc->default_shader));
 				gbc->default_shader[N_ELEM(gbc->default_shader) - 1] = '\0';
@@ -150,6 +179,8 @@ bool gbcc_parse_args(struct gbcc *gbc, bool file_required, int argc, char **argv
 				break;
 			case '?':
 				if (optopt == 'c'
+						|| optopt == 'L'
+						|| optopt == 'o'
 						|| optopt == 'p'
 						|| optopt == 's'
 						|| optopt == 'S'
@@ -170,6 +201,11 @@ bool gbcc_parse_args(struct gbcc *gbc, bool file_required, int argc, char **argv
 		}
 	}
 
+	/* The palette and colour correction may have changed */
+	if (gbc->core.initialised) {
+		gbcc_ppu_refresh_palettes(&gbc->core);
+	}
+
 	if (gbc->autoresume) {
 		gbcc_load_state(gbc);
 	}
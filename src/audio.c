@@ -9,149 +9,324 @@
  */
 
 #include "audio.h"
+#include "audio_sink.h"
+#include "blip.h"
+#include "debug.h"
 #include "gbcc.h"
+#include "ring.h"
+#include "time_diff.h"
+#include <stdlib.h>
 
-/* Max amplitude / no. channels / max global volume multiplier */
-#define MAX_CHANNEL_AMPLITUDE (INT16_MAX / 4 / 0x10u)
-/* Max channel amplitude / max envelope volume multiplier */
-#define BASE_AMPLITUDE (MAX_CHANNEL_AMPLITUDE / 0x10u)
+/* How much audio the blip buffer can hold between updates */
+#define BLIP_BUFFER_MS 100
+/* How many output buffers' worth of samples the ring is sized for */
+#define RING_BUFFERS 4
+/* Samples moved from the blip buffer to the ring at a time */
+#define STAGING_SAMPLES 256
 
-static void ch1_update(struct gbcc *gbc);
-static void ch2_update(struct gbcc *gbc);
-static void ch3_update(struct gbcc *gbc);
-static void ch4_update(struct gbcc *gbc);
+/* Used when the device doesn't decide for us */
+#define DEFAULT_SAMPLE_RATE 48000
+#define DEFAULT_LATENCY (20 * SECOND / 1000)
+/* Any fewer, and the device can run dry while a buffer is being refilled */
+#define MIN_QUEUED_BUFFERS 2
+#define MIN_BUFFER_SAMPLES 64
+/* Periods a device is assumed to buffer, if it won't tell us */
+#define DEVICE_PERIODS 3
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-void gbcc_audio_initialise(struct gbcc *gbc, size_t sample_rate, size_t buffer_samples)
+/*
+ * Rate control. The emulator and the audio device run off different clocks
+ * (and with vsync, the emulator runs at the display's rate), so the output
+ * rate is nudged to keep the ring half full. These gains give a loop that
+ * settles in a few seconds without audible pitch wobble.
+ */
+#define CONTROL_TARGET 0.5
+#define CONTROL_KP 0.05
+#define CONTROL_KI 0.01		/* Per second */
+#define CONTROL_LIMIT 0.01	/* Never change the pitch by more than 1% */
+#define FILL_SMOOTHING 0.25	/* Seconds, to hide the device taking whole buffers */
+
+static void size_buffers(struct gbcc_audio *audio);
+static void close_sink(struct gbcc *gbc, const struct gbcc_audio_sink *sink);
+static void log_latency(const struct gbcc_audio *audio);
+static void update_listening(struct gbcc *gbc);
+static double rate_control(struct gbcc_audio *audio, double dt);
+
+void gbcc_audio_initialise(struct gbcc *gbc)
 {
 	struct gbcc_audio *audio = &gbc->audio;
 
-	audio->sample_rate = sample_rate;
-	audio->buffer_samples = buffer_samples;
-	audio->buffer_bytes = buffer_samples * 2 * sizeof(*audio->mix_buffer);
-	audio->clocks_per_sample = (float)GBC_CLOCK_FREQ / (float)sample_rate;
-	audio->mix_buffer = calloc(buffer_samples * 2, sizeof(*audio->mix_buffer));
+	const struct gbcc_audio_sink *sink = gbcc_audio_sink_find(gbc->audio_output);
+	if (!sink) {
+		gbcc_log_error("Unknown audio output \"%s\".\n", gbc->audio_output);
+		return;
+	}
+	const char *path = gbcc_audio_sink_path(gbc->audio_output);
+	if (sink->needs_path && !path) {
+		gbcc_log_error("Audio output \"%s\" needs a path, as in %s:PATH.\n", sink->name, sink->name);
+		return;
+	}
+
+	audio->sample_rate = gbc->audio_rate ? gbc->audio_rate : DEFAULT_SAMPLE_RATE;
+	audio->latency = gbc->audio_latency ? gbc->audio_latency : DEFAULT_LATENCY;
+	audio->device_period = 0;
+	audio->device_latency = 0;
+	size_buffers(audio);
 	audio->volume = 1.0f;
-	gbcc_audio_platform_initialise(gbc);
+	atomic_init(&audio->underruns, 0);
+	atomic_init(&audio->overruns, 0);
+	atomic_init(&audio->drift, 0);
+	audio->fill = CONTROL_TARGET;
+	audio->integral = 0;
+	if (sink->silent) {
+		audio->sink = sink;
+		return;
+	}
+	if (sink->initialise && !sink->initialise(gbc, path)) {
+		if (sink->needs_path) {
+			return;
+		}
+		/* A machine without sound mustn't stop the locker from locking */
+		gbcc_log_warning("Couldn't open the audio device, continuing without sound.\n");
+		audio->sink = gbcc_audio_sink_find("null");
+		return;
+	}
+	/* Now we know what the device is really doing */
+	size_buffers(audio);
+	audio->buffer_bytes = audio->buffer_samples * 2 * sizeof(*audio->mix_buffer);
+	audio->mix_buffer = calloc(audio->buffer_samples * 2, sizeof(*audio->mix_buffer));
+	/* Sinks which take samples directly don't need the ring */
+	if (!audio->mix_buffer
+			|| (!sink->write && !gbcc_ring_initialise(&audio->ring, audio->buffer_samples * RING_BUFFERS))
+			|| !gbcc_blip_initialise(&audio->blip, audio->sample_rate * BLIP_BUFFER_MS / 1000)) {
+		gbcc_log_error("Couldn't allocate audio buffers.\n");
+		close_sink(gbc, sink);
+		return;
+	}
+	gbcc_blip_set_rates(&audio->blip, GBC_CLOCK_FREQ, (double)audio->sample_rate);
+	if (sink->start && !sink->start(gbc)) {
+		gbcc_log_warning("Couldn't start audio playback, continuing without sound.\n");
+		close_sink(gbc, sink);
+		audio->sink = gbcc_audio_sink_find("null");
+		return;
+	}
+	audio->sink = sink;
+	if (!sink->write) {
+		log_latency(audio);
+	}
+	update_listening(gbc);
 }
 
 void gbcc_audio_destroy(struct gbcc *gbc)
 {
-	gbcc_audio_platform_destroy(gbc);
-	free(gbc->audio.mix_buffer);
+	struct gbcc_audio *audio = &gbc->audio;
+	if (!audio->sink) {
+		free(audio->mix_buffer);
+		return;
+	}
+	if (audio->sink->destroy) {
+		audio->sink->destroy(gbc);
+	}
+	audio->sink = NULL;
+	gbcc_apu_set_output(&gbc->core, NULL);
+	gbcc_blip_destroy(&audio->blip);
+	gbcc_ring_destroy(&audio->ring);
+	free(audio->mix_buffer);
+	unsigned int underruns = atomic_load(&audio->underruns);
+	unsigned int overruns = atomic_load(&audio->overruns);
+	if (underruns || overruns) {
+		gbcc_log_info("Audio: %u underruns, %u overruns, final drift %d ppm.\n",
+				underruns, overruns, atomic_load(&audio->drift));
+	}
+}
+
+void gbcc_audio_set_muted(struct gbcc *gbc, bool muted)
+{
+	atomic_store_explicit(&gbc->audio.muted, muted, memory_order_relaxed);
+}
+
+void gbcc_audio_get_stats(struct gbcc *gbc, struct gbcc_audio_stats *stats)
+{
+	struct gbcc_audio *audio = &gbc->audio;
+	*stats = (struct gbcc_audio_stats){0};
+	if (!audio->ring.data) {
+		return;
+	}
+	stats->latency = (float)gbcc_ring_used(&audio->ring) / (float)audio->sample_rate;
+	stats->drift = atomic_load_explicit(&audio->drift, memory_order_relaxed);
+	stats->underruns = atomic_load_explicit(&audio->underruns, memory_order_relaxed);
+	stats->overruns = atomic_load_explicit(&audio->overruns, memory_order_relaxed);
 }
 
-ANDROID_INLINE
+/*
+ * Called once per batch of emulated cycles. Once the APU has caught up, it
+ * has recorded every change in its output level since the last call in the
+ * blip buffer, so all that's left is to turn those into samples and hand
+ * them to the output thread. This never waits on the audio device; if the
+ * ring is full, the samples are dropped.
+ */
 void gbcc_audio_update(struct gbcc *gbc)
 {
 	struct gbcc_audio *audio = &gbc->audio;
+	struct apu_output *output = &gbc->core.apu.output;
+	update_listening(gbc);
+	if (!output->blip) {
+		/* Nothing to synthesise, the APU catches up when the CPU looks */
+		return;
+	}
+	gbcc_apu_catch_up(&gbc->core);
 
-	float mult = 1;
+	double mult = 1;
 	if (gbc->core.keys.turbo) {
-		if (gbc->turbo_speed > 0) {
-			mult = gbc->turbo_speed;
-		} else {
-			return;
-		}
+		mult = gbc->turbo_speed;
 	}
-	audio->clock++;
-	if (gbc->core.sync_to_video) {
-		mult /= audio->scale;
-	}
-	/* When err > 0, it tells us how much we overshot the last sample by */
-	float err = audio->clock - audio->clocks_per_sample * mult * (float)audio->sample;
-	if (err >= 0) {
-		if (err < 1) {
-			/*
-			 * Some minor black magic to keep our audio buffers
-			 * being filled at the correct rate. If we overshot
-			 * this sample, we take the next sample slightly early.
-			 *
-			 * err < 1 is just a sanity check, so we don't mess
-			 * everything up if there's a stutter.
-			 */
-			audio->clock += err;
-		}
-		if (audio->sample >= audio->buffer_samples) {
-			gbcc_audio_platform_queue_buffer(gbc);
-			audio->index = 0;
-			audio->clock = 0;
-			audio->sample = 0;
+	double dt = output->clock / (GBC_CLOCK_FREQ * mult);
+	gbcc_blip_end_frame(output->blip, output->clock);
+	output->clock = 0;
+	/*
+	 * Takes effect from the next frame, as deltas are placed when added.
+	 * Sinks without a clock of their own get the exact nominal rate.
+	 */
+	double correction = 0;
+	if (!audio->sink->write) {
+		correction = rate_control(audio, dt);
+	}
+	gbcc_blip_set_rates(output->blip, GBC_CLOCK_FREQ * mult, audio->sample_rate * (1 + correction));
+	gbcc_blip_set_gain(output->blip, audio->volume);
+
+	while (gbcc_blip_samples_avail(output->blip) > 0) {
+		GBCC_AUDIO_FMT samples[STAGING_SAMPLES * 2];
+		size_t n = gbcc_blip_read_samples(output->blip, samples, STAGING_SAMPLES);
+		if (audio->sink->write) {
+			audio->sink->write(gbc, samples, n);
+		} else if (gbcc_ring_write(&audio->ring, samples, n) < n) {
+			atomic_fetch_add_explicit(&audio->overruns, 1, memory_order_relaxed);
 		}
-		audio->sample++;
-		audio->mix_buffer[audio->index] = 0;
-		audio->mix_buffer[audio->index + 1] = 0;
-		ch1_update(gbc);
-		ch2_update(gbc);
-		ch3_update(gbc);
-		ch4_update(gbc);
-		float left_vol = (1 + gbc->core.apu.left_vol) * audio->volume;
-		float right_vol = (1 + gbc->core.apu.right_vol) * audio->volume;
-		audio->mix_buffer[audio->index] = (int16_t)(audio->mix_buffer[audio->index] * left_vol);
-		audio->mix_buffer[audio->index + 1] = (int16_t)(audio->mix_buffer[audio->index + 1] * right_vol);
-		audio->index += 2;
 	}
 }
 
-void ch1_update(struct gbcc *gbc)
+/*
+ * Start or stop synthesis as needed. Nothing is synthesised while muted, or
+ * while turboing without a speed limit, when the audio would be useless.
+ */
+void update_listening(struct gbcc *gbc)
 {
-	struct channel *ch1 = &gbc->core.apu.ch1;
-	if (ch1->dac) {
-		/* The DAC produces a signal in the range [-1, 1] */
-		gbc->audio.mix_buffer[gbc->audio.index] -= MAX_CHANNEL_AMPLITUDE / 2;
-		gbc->audio.mix_buffer[gbc->audio.index + 1] -= MAX_CHANNEL_AMPLITUDE / 2;
+	struct gbcc_audio *audio = &gbc->audio;
+	bool listening = audio->sink
+		&& !audio->sink->silent
+		&& !atomic_load_explicit(&audio->muted, memory_order_relaxed)
+		&& !(gbc->core.keys.turbo && gbc->turbo_speed <= 0);
+	if (listening == (gbc->core.apu.output.blip != NULL)) {
+		return;
 	}
-	if (!ch1->enabled) {
+	if (!listening) {
+		gbcc_apu_set_output(&gbc->core, NULL);
 		return;
 	}
-	uint8_t volume = ch1->envelope.volume;
-	gbc->audio.mix_buffer[gbc->audio.index] += (GBCC_AUDIO_FMT)(ch1->left * ch1->state * volume * BASE_AMPLITUDE);
-	gbc->audio.mix_buffer[gbc->audio.index + 1] += (GBCC_AUDIO_FMT)(ch1->right * ch1->state * volume * BASE_AMPLITUDE);
+	gbcc_blip_clear(&audio->blip);
+	if (audio->ring.data) {
+		/*
+		 * The device has been playing silence from an empty ring, so
+		 * top it back up to where rate control wants it.
+		 */
+		static const GBCC_AUDIO_FMT silence[STAGING_SAMPLES * 2];
+		size_t target = (size_t)((double)(audio->buffer_samples * RING_BUFFERS) * CONTROL_TARGET);
+		while (gbcc_ring_used(&audio->ring) < target) {
+			size_t n = MIN(STAGING_SAMPLES, target - gbcc_ring_used(&audio->ring));
+			gbcc_ring_write(&audio->ring, silence, n);
+		}
+		audio->fill = CONTROL_TARGET;
+	}
+	gbcc_apu_set_output(&gbc->core, &audio->blip);
 }
 
-void ch2_update(struct gbcc *gbc)
+/*
+ * Split the latency target between the buffers queued on the device and the
+ * ring, which rate control keeps partly full. Buffers match the device's
+ * period where we know it, so that each one it mixes frees exactly one of
+ * ours; the rest of the budget decides how many are queued. Until the device
+ * says otherwise, assume it holds a few periods of its own.
+ */
+void size_buffers(struct gbcc_audio *audio)
 {
-	struct channel *ch2 = &gbc->core.apu.ch2;
-	if (ch2->dac) {
-		/* The DAC produces a signal in the range [-1, 1] */
-		gbc->audio.mix_buffer[gbc->audio.index] -= MAX_CHANNEL_AMPLITUDE / 2;
-		gbc->audio.mix_buffer[gbc->audio.index + 1] -= MAX_CHANNEL_AMPLITUDE / 2;
-	}
-	if (!ch2->enabled) {
-		return;
+	double ours = RING_BUFFERS * CONTROL_TARGET;
+	double theirs = audio->device_latency ? 0 : DEVICE_PERIODS;
+	size_t target = (size_t)(audio->sample_rate * audio->latency / SECOND);
+	size_t device = (size_t)(audio->sample_rate * audio->device_latency / SECOND);
+	size_t budget = target > device ? target - device : 0;
+
+	if (audio->device_period) {
+		audio->buffer_samples = audio->device_period;
+		double queued = (double)budget / (double)audio->buffer_samples - ours - theirs;
+		audio->queued_buffers = queued > 0 ? (size_t)queued : 0;
+		audio->queued_buffers = MIN(MAX(audio->queued_buffers, MIN_QUEUED_BUFFERS), GBCC_AUDIO_MAX_BUFFERS);
+	} else {
+		audio->queued_buffers = MIN_QUEUED_BUFFERS;
+		audio->buffer_samples = (size_t)((double)budget / (MIN_QUEUED_BUFFERS + ours + theirs));
+		audio->buffer_samples = MAX(audio->buffer_samples, MIN_BUFFER_SAMPLES);
 	}
-	uint8_t volume = ch2->envelope.volume;
-	gbc->audio.mix_buffer[gbc->audio.index] += (GBCC_AUDIO_FMT)(ch2->left * ch2->state * volume * BASE_AMPLITUDE);
-	gbc->audio.mix_buffer[gbc->audio.index + 1] += (GBCC_AUDIO_FMT)(ch2->right * ch2->state * volume * BASE_AMPLITUDE);
 }
 
-void ch3_update(struct gbcc *gbc)
+/* Undoes initialisation once the sink's open, leaving no sink */
+void close_sink(struct gbcc *gbc, const struct gbcc_audio_sink *sink)
 {
-	struct channel *ch3 = &gbc->core.apu.ch3;
-	if (ch3->dac) {
-		/* The DAC produces a signal in the range [-1, 1] */
-		gbc->audio.mix_buffer[gbc->audio.index] -= MAX_CHANNEL_AMPLITUDE / 2;
-		gbc->audio.mix_buffer[gbc->audio.index + 1] -= MAX_CHANNEL_AMPLITUDE / 2;
+	struct gbcc_audio *audio = &gbc->audio;
+	if (sink->destroy) {
+		sink->destroy(gbc);
 	}
-	if (!ch3->enabled || gbc->core.apu.wave.shift == 0) {
-		return;
+	gbcc_blip_destroy(&audio->blip);
+	gbcc_ring_destroy(&audio->ring);
+	free(audio->mix_buffer);
+	audio->mix_buffer = NULL;
+}
+
+/* Report how close we came to the latency target */
+void log_latency(const struct gbcc_audio *audio)
+{
+	double buffers = (double)audio->queued_buffers + RING_BUFFERS * CONTROL_TARGET;
+	if (!audio->device_latency) {
+		buffers += DEVICE_PERIODS;
 	}
-	gbc->audio.mix_buffer[gbc->audio.index] += (GBCC_AUDIO_FMT)(ch3->left * (gbc->core.apu.wave.buffer >> (gbc->core.apu.wave.shift - 1u)) * BASE_AMPLITUDE);
-	gbc->audio.mix_buffer[gbc->audio.index + 1] += (GBCC_AUDIO_FMT)(ch3->right * (gbc->core.apu.wave.buffer >> (gbc->core.apu.wave.shift - 1u)) * BASE_AMPLITUDE);
+	double ms = 1000.0 * buffers * (double)audio->buffer_samples / (double)audio->sample_rate;
+	ms += (double)audio->device_latency / 1e6;
+	gbcc_log_info("Audio: %zu Hz, %zu buffers of %zu samples, %s%.1f ms latency (target %.1f ms).\n",
+			audio->sample_rate,
+			audio->queued_buffers,
+			audio->buffer_samples,
+			audio->device_latency ? "" : "about ",
+			ms,
+			(double)audio->latency / 1e6);
 }
 
-void ch4_update(struct gbcc *gbc)
+/*
+ * PI controller on the ring's fill level, returning the fractional change to
+ * make to the output rate. A fuller ring means we're producing too fast.
+ */
+double rate_control(struct gbcc_audio *audio, double dt)
 {
-	struct channel *ch4 = &gbc->core.apu.ch4;
-	if (ch4->dac) {
-		/* The DAC produces a signal in the range [-1, 1] */
-		gbc->audio.mix_buffer[gbc->audio.index] -= MAX_CHANNEL_AMPLITUDE / 2;
-		gbc->audio.mix_buffer[gbc->audio.index + 1] -= MAX_CHANNEL_AMPLITUDE / 2;
+	/* The ring may be bigger than asked for, but we only want to use this much */
+	double fill = (double)gbcc_ring_used(&audio->ring) / (double)(audio->buffer_samples * RING_BUFFERS);
+	double alpha = dt / (FILL_SMOOTHING + dt);
+	audio->fill += alpha * (fill - audio->fill);
+
+	double error = audio->fill - CONTROL_TARGET;
+	audio->integral += error * dt;
+	/* Don't wind up beyond what we're allowed to correct */
+	double max_integral = CONTROL_LIMIT / CONTROL_KI;
+	if (audio->integral > max_integral) {
+		audio->integral = max_integral;
+	} else if (audio->integral < -max_integral) {
+		audio->integral = -max_integral;
 	}
-	if (!ch4->enabled) {
-		return;
+
+	double correction = -(CONTROL_KP * error + CONTROL_KI * audio->integral);
+	if (correction > CONTROL_LIMIT) {
+		correction = CONTROL_LIMIT;
+	} else if (correction < -CONTROL_LIMIT) {
+		correction = -CONTROL_LIMIT;
 	}
-	uint8_t volume = ch4->envelope.volume;
-	gbc->audio.mix_buffer[gbc->audio.index] += (GBCC_AUDIO_FMT)(ch4->left * ch4->state * volume * BASE_AMPLITUDE);
-	gbc->audio.mix_buffer[gbc->audio.index + 1] += (GBCC_AUDIO_FMT)(ch4->right * ch4->state * volume * BASE_AMPLITUDE);
+	atomic_store_explicit(&audio->drift, (int)(correction * 1e6), memory_order_relaxed);
+	return correction;
 }
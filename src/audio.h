@@ -16,34 +16,79 @@
 #else
 #include "audio_platform/openal.h"
 #endif
+#include "audio_sink.h"
+#include "blip.h"
+#include "ring.h"
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <time.h>
 
 #define GBCC_AUDIO_FMT int16_t
 
 struct gbcc;
 
+struct gbcc_audio_stats {
+	float latency;		/* Seconds of audio waiting in the ring */
+	int drift;		/* Correction applied to the output rate, in ppm */
+	unsigned int underruns;
+	unsigned int overruns;
+};
+
 struct gbcc_audio {
+	const struct gbcc_audio_sink *sink;
 	struct gbcc_audio_platform platform;
-	float clock;
-	unsigned int sample;
-	size_t index;
+	struct gbcc_blip blip;
+	struct gbcc_ring ring;	/* Samples waiting for the output thread */
 	size_t sample_rate;
 	size_t buffer_samples;
 	size_t buffer_bytes;
-	float clocks_per_sample;
-	float scale;
+	size_t queued_buffers;	/* Buffers kept queued on the device */
+	/* Filled in by the sink when it opens the device, if it can tell */
+	size_t device_period;	/* Samples the device mixes at a time */
+	uint64_t device_latency;	/* ns buffered by the device itself */
+	uint64_t latency;	/* Target ns from synthesis to the speaker */
 	float volume;
-	GBCC_AUDIO_FMT *mix_buffer;
+	atomic_bool muted;	/* Stops synthesis entirely, see gbcc_audio_set_muted */
+	/* Rate control, run by the emulation thread */
+	double fill;		/* Smoothed ring fill level, from 0 to 1 */
+	double integral;
+	atomic_int drift;	/* Correction applied to the output rate, in ppm */
+	GBCC_AUDIO_FMT *mix_buffer;	/* Owned by the output thread */
+	atomic_uint underruns;	/* Times the device wanted more than we had */
+	atomic_uint overruns;	/* Times samples were dropped for lack of space */
+	/* File sinks */
+	FILE *file;
+	uint64_t file_bytes;
 };
 
-void gbcc_audio_initialise(struct gbcc *gbc, size_t sample_rate, size_t buffer_samples);
+/*
+ * Sends audio wherever gbc->audio_output says, see audio_sink.h. The device
+ * picks the sample rate unless gbc->audio_rate is set, and buffers are sized
+ * to meet gbc->audio_latency.
+ */
+void gbcc_audio_initialise(struct gbcc *gbc);
 void gbcc_audio_destroy(struct gbcc *gbc);
 void gbcc_audio_update(struct gbcc *gbc);
+/*
+ * Safe to call from any thread. While muted, no samples are synthesised and
+ * the APU does only what the CPU could notice; synthesis picks back up on
+ * the emulation thread's next audio update.
+ */
+void gbcc_audio_set_muted(struct gbcc *gbc, bool muted);
+void gbcc_audio_get_stats(struct gbcc *gbc, struct gbcc_audio_stats *stats);
 void gbcc_audio_play_wav(const char *filename);
 
-void gbcc_audio_platform_initialise(struct gbcc *gbc);
+/*
+ * Opens the device, preferring a period of audio->buffer_samples, and fills
+ * in the sample rate and anything it learns about the device's buffering.
+ * Playback waits for gbcc_audio_platform_start, once buffers are sized.
+ * Returns false, having cleaned up, if there's no device to play on.
+ * If starting fails, gbcc_audio_platform_destroy still has to be called.
+ */
+bool gbcc_audio_platform_initialise(struct gbcc *gbc);
+bool gbcc_audio_platform_start(struct gbcc *gbc);
 void gbcc_audio_platform_destroy(struct gbcc *gbc);
-void gbcc_audio_platform_queue_buffer(struct gbcc *gbc);
 
 #endif /* GBCC_AUDIO_H */
@@ -1,6 +1,6 @@
 #include "../gbcc.h"
 
 void gbcc_audio_play_wav(const char *filename) {};
-void gbcc_audio_platform_initialise(struct gbcc *gbc) {};
+bool gbcc_audio_platform_initialise(struct gbcc *gbc) { return false; };
+bool gbcc_audio_platform_start(struct gbcc *gbc) { return false; };
 void gbcc_audio_platform_destroy(struct gbcc *gbc) {};
-void gbcc_audio_platform_queue_buffer(struct gbcc *gbc) {};
@@ -14,6 +14,7 @@
 #include "../debug.h"
 #include "../memory.h"
 #include "../nelem.h"
+#include "../ring.h"
 #include "../time_diff.h"
 #include "../wav.h"
 
@@ -23,114 +24,245 @@
 #else
 #include <AL/al.h>
 #include <AL/alc.h>
+#include <AL/alext.h>
 #endif
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
+/* Shortest sleep while waiting for a buffer to finish playing */
+#define MIN_WAIT (SECOND / 1000)
+
 static int check_openal_error(const char *msg);
+static void query_device(struct gbcc_audio *audio);
+static void close_device(struct gbcc_audio_platform *al);
+static void *output_thread(void *_gbc);
+static void wait_for_buffer(struct gbcc_audio *audio);
 static void *wav_thread(void *filename);
 
-void gbcc_audio_platform_initialise(struct gbcc *gbc)
+bool gbcc_audio_platform_initialise(struct gbcc *gbc)
 {
 	struct gbcc_audio *audio = &gbc->audio;
-	audio->scale = 0.9955f;
 	audio->platform.device = alcOpenDevice(NULL);
 	if (!audio->platform.device) {
 		gbcc_log_error("Failed to open audio device.\n");
+		return false;
+	}
+	/*
+	 * Ask the device to mix in periods the size of our buffers, and only
+	 * for a particular rate if we've been told to; otherwise it runs at
+	 * its own rate, and so do we, which saves resampling.
+	 */
+	ALCint attributes[5];
+	size_t n = 0;
+	if (gbc->audio_rate) {
+		attributes[n++] = ALC_FREQUENCY;
+		attributes[n++] = (ALCint)gbc->audio_rate;
 	}
-	audio->platform.context = alcCreateContext(audio->platform.device, NULL);
+	attributes[n++] = ALC_REFRESH;
+	attributes[n++] = (ALCint)(audio->sample_rate / audio->buffer_samples);
+	attributes[n] = 0;
+	audio->platform.context = alcCreateContext(audio->platform.device, attributes);
 	if (!audio->platform.context) {
 		gbcc_log_error("Failed to create OpenAL context.\n");
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 	if (!alcMakeContextCurrent(audio->platform.context)) {
 		gbcc_log_error("Failed to set OpenAL context.\n");
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
+	query_device(audio);
 
 	alGenSources(1, &audio->platform.source);
 	if (check_openal_error("Failed to create source.\n")) {
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 
 	alSourcef(audio->platform.source, AL_PITCH, 1);
 	if (check_openal_error("Failed to set pitch.\n")) {
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 	alSourcef(audio->platform.source, AL_GAIN, 1);
 	if (check_openal_error("Failed to set gain.\n")) {
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 	alSource3f(audio->platform.source, AL_POSITION, 0, 0, 0);
 	if (check_openal_error("Failed to set position.\n")) {
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 	alSource3f(audio->platform.source, AL_VELOCITY, 0, 0, 0);
 	if (check_openal_error("Failed to set velocity.\n")) {
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 	alSourcei(audio->platform.source, AL_LOOPING, AL_FALSE);
 	if (check_openal_error("Failed to set loop.\n")) {
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
+	return true;
 
-	alGenBuffers(N_ELEM(audio->platform.buffers), audio->platform.buffers);
+CLEANUP:
+	close_device(&audio->platform);
+	return false;
+}
+
+bool gbcc_audio_platform_start(struct gbcc *gbc)
+{
+	struct gbcc_audio *audio = &gbc->audio;
+	struct gbcc_audio_platform *al = &audio->platform;
+
+	al->n_buffers = audio->queued_buffers;
+	alGenBuffers((ALsizei)al->n_buffers, al->buffers);
 	if (check_openal_error("Failed to create buffers.\n")) {
-		exit(EXIT_FAILURE);
+		al->n_buffers = 0;
+		return false;
 	}
 
 	memset(audio->mix_buffer, 0, audio->buffer_bytes);
-	for (size_t i = 0; i < N_ELEM(audio->platform.buffers); i++) {
+	for (size_t i = 0; i < al->n_buffers; i++) {
 		alBufferData(
-				audio->platform.buffers[i],
+				al->buffers[i],
 				AL_FORMAT_STEREO16,
 				audio->mix_buffer,
 				(ALsizei)audio->buffer_bytes,
 				(ALsizei)audio->sample_rate
 			    );
 	}
-	alSourceQueueBuffers(audio->platform.source, N_ELEM(audio->platform.buffers), audio->platform.buffers);
+	alSourceQueueBuffers(al->source, (ALsizei)al->n_buffers, al->buffers);
 	check_openal_error("Failed to queue buffers.\n");
-	alSourcePlay(audio->platform.source);
+	alSourcePlay(al->source);
 	check_openal_error("Failed to play audio.\n");
+
+	atomic_store(&al->running, true);
+	if (pthread_create(&al->thread, NULL, output_thread, gbc)) {
+		gbcc_log_error("Failed to start audio thread.\n");
+		atomic_store(&al->running, false);
+		return false;
+	}
+	pthread_setname_np(al->thread, "AudioThread");
+	return true;
 }
 
 void gbcc_audio_platform_destroy(struct gbcc *gbc) {
-	alDeleteSources(1, &gbc->audio.platform.source);
-	alDeleteBuffers(N_ELEM(gbc->audio.platform.buffers), gbc->audio.platform.buffers);
-	alcDestroyContext(gbc->audio.platform.context);
-	alcCloseDevice(gbc->audio.platform.device);
+	struct gbcc_audio_platform *al = &gbc->audio.platform;
+	/* We may never have got as far as starting */
+	if (atomic_exchange(&al->running, false)) {
+		pthread_join(al->thread, NULL);
+	}
+	alDeleteBuffers((ALsizei)al->n_buffers, al->buffers);
+	al->n_buffers = 0;
+	close_device(al);
+}
+
+/* Undoes as much of initialisation as got done */
+void close_device(struct gbcc_audio_platform *al)
+{
+	if (al->source) {
+		alDeleteSources(1, &al->source);
+		al->source = 0;
+	}
+	if (al->context) {
+		alcMakeContextCurrent(NULL);
+		alcDestroyContext(al->context);
+		al->context = NULL;
+	}
+	if (al->device) {
+		alcCloseDevice(al->device);
+		al->device = NULL;
+	}
+}
+
+/*
+ * Find out what the device settled on. OpenAL Soft can also tell us how much
+ * audio its backend holds, through the ALC_SOFT_device_clock extension.
+ */
+void query_device(struct gbcc_audio *audio)
+{
+	ALCdevice *device = audio->platform.device;
+	ALCint frequency = 0;
+	ALCint refresh = 0;
+	alcGetIntegerv(device, ALC_FREQUENCY, 1, &frequency);
+	alcGetIntegerv(device, ALC_REFRESH, 1, &refresh);
+	if (frequency > 0) {
+		audio->sample_rate = (size_t)frequency;
+	}
+	if (refresh > 0) {
+		audio->device_period = audio->sample_rate / (size_t)refresh;
+	}
+#ifdef ALC_SOFT_device_clock
+	if (alcIsExtensionPresent(device, "ALC_SOFT_device_clock")) {
+		LPALCGETINTEGER64VSOFT get_integer64v = (LPALCGETINTEGER64VSOFT)alcGetProcAddress(device, "alcGetInteger64vSOFT");
+		ALCint64SOFT latency = 0;
+		if (get_integer64v) {
+			get_integer64v(device, ALC_DEVICE_LATENCY_SOFT, 1, &latency);
+		}
+		if (latency > 0) {
+			audio->device_latency = (uint64_t)latency;
+		}
+	}
+#endif
 }
 
-ANDROID_INLINE
-void gbcc_audio_platform_queue_buffer(struct gbcc *gbc)
+/*
+ * Keeps the source fed from the ring, so that the emulation thread never has
+ * to wait on the device. Whenever a buffer finishes playing, it's refilled
+ * with whatever's in the ring, padded with silence if that's not enough.
+ */
+void *output_thread(void *_gbc)
 {
+	struct gbcc *gbc = (struct gbcc *)_gbc;
 	struct gbcc_audio *audio = &gbc->audio;
-	ALint processed = 0;
-	alGetSourcei(audio->platform.source, AL_BUFFERS_PROCESSED, &processed);
-	while (!processed) {
-		const struct timespec time = {.tv_sec = 0, .tv_nsec = 100000};
-		nanosleep(&time, NULL);
-		alGetSourcei(audio->platform.source, AL_BUFFERS_PROCESSED, &processed);
+	struct gbcc_audio_platform *al = &audio->platform;
+
+	while (atomic_load(&al->running)) {
+		ALint processed = 0;
+		alGetSourcei(al->source, AL_BUFFERS_PROCESSED, &processed);
+		if (!processed) {
+			wait_for_buffer(audio);
+			continue;
+		}
+		ALuint buffer;
+		alSourceUnqueueBuffers(al->source, 1, &buffer);
+		check_openal_error("Failed to unqueue buffer.\n");
+
+		size_t n = gbcc_ring_read(&audio->ring, audio->mix_buffer, audio->buffer_samples);
+		if (n < audio->buffer_samples) {
+			if (!atomic_load_explicit(&audio->muted, memory_order_relaxed)) {
+				atomic_fetch_add_explicit(&audio->underruns, 1, memory_order_relaxed);
+			}
+			memset(&audio->mix_buffer[n * 2], 0, (audio->buffer_samples - n) * 2 * sizeof(*audio->mix_buffer));
+		}
+
+		alBufferData(buffer, AL_FORMAT_STEREO16, audio->mix_buffer, (ALsizei)audio->buffer_bytes, (ALsizei)audio->sample_rate);
+		check_openal_error("Failed to fill buffer.\n");
+		alSourceQueueBuffers(al->source, 1, &buffer);
+		check_openal_error("Failed to queue buffer.\n");
+		ALint state;
+		alGetSourcei(al->source, AL_SOURCE_STATE, &state);
+		check_openal_error("Failed to get source state.\n");
+		if (state == AL_STOPPED) {
+			alSourcePlay(al->source);
+			check_openal_error("Failed to resume audio playback.\n");
+		}
 	}
-	ALuint buffer;
-	alSourceUnqueueBuffers(audio->platform.source, 1, &buffer);
-	check_openal_error("Failed to unqueue buffer.\n");
-	alBufferData(buffer, AL_FORMAT_STEREO16, audio->mix_buffer, (ALsizei)audio->buffer_bytes, (ALsizei)audio->sample_rate);
-	check_openal_error("Failed to fill buffer.\n");
-	alSourceQueueBuffers(audio->platform.source, 1, &buffer);
-	check_openal_error("Failed to queue buffer.\n");
-	ALint state;
-	alGetSourcei(audio->platform.source, AL_SOURCE_STATE, &state);
-	check_openal_error("Failed to get source state.\n");
-	if (state == AL_STOPPED) {
-		clock_gettime(CLOCK_REALTIME, &gbc->core.apu.start_time);
-		gbc->core.apu.sample = 0;
-		alSourcePlay(audio->platform.source);
-		check_openal_error("Failed to resume audio playback.\n");
+	return NULL;
+}
+
+/* Sleep until the buffer currently playing should have finished */
+void wait_for_buffer(struct gbcc_audio *audio)
+{
+	ALint offset = 0;
+	alGetSourcei(audio->platform.source, AL_SAMPLE_OFFSET, &offset);
+	uint64_t left = 0;
+	if ((size_t)offset < audio->buffer_samples) {
+		left = audio->buffer_samples - (size_t)offset;
+	}
+	uint64_t ns = SECOND * left / audio->sample_rate;
+	if (ns < MIN_WAIT) {
+		ns = MIN_WAIT;
 	}
+	const struct timespec time = {.tv_sec = ns / SECOND, .tv_nsec = ns % SECOND};
+	nanosleep(&time, NULL);
 }
 
 
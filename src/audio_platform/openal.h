@@ -18,12 +18,20 @@
 #include <AL/al.h>
 #include <AL/alc.h>
 #endif
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define GBCC_AUDIO_MAX_BUFFERS 8
 
 struct gbcc_audio_platform {
 	ALCdevice *device;
 	ALCcontext *context;
 	ALuint source;
-	ALuint buffers[8];
+	ALuint buffers[GBCC_AUDIO_MAX_BUFFERS];
+	size_t n_buffers;
+	pthread_t thread;
+	atomic_bool running;
 };
 
 #endif /* GBCC_OPENAL_H */
@@ -21,61 +21,54 @@
 #include "../debug.h"
 #include "../memory.h"
 #include "../nelem.h"
+#include "../ring.h"
 #include "../time_diff.h"
 #include "../wav.h"
 
 static void buffer_callback(SLAndroidSimpleBufferQueueItf bq, void *_audio);
+static void destroy_objects(struct gbcc_audio_platform *sl);
 
-void gbcc_audio_platform_initialise(struct gbcc *gbc)
+bool gbcc_audio_platform_initialise(struct gbcc *gbc)
 {
 	struct gbcc_audio *audio = &gbc->audio;
 	struct gbcc_audio_platform *sl = &audio->platform;
-	audio->scale = 0.9955;
-
-	for (size_t i = 0; i < N_ELEM(sl->mix_buffers); i++) {
-		sl->mix_buffers[i] = calloc(audio->buffer_samples * 2, sizeof(*sl->mix_buffers[i]));
-		sl->playback_buffers[i] = calloc(audio->buffer_samples * 2, sizeof(*sl->playback_buffers[i]));
-	}
-	sl->write_buffer = 1;
-	sl->read_buffer = 0;
-
 	SLresult result;
 
 	/* Create & realize the engine and output mix */
 	result = slCreateEngine(&sl->engine_object, 0, NULL, 0, NULL, NULL);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to create audio engine.\n");
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 
 	result = (*sl->engine_object)->Realize(sl->engine_object, SL_BOOLEAN_FALSE);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to realise audio engine.\n");
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 
 	result = (*sl->engine_object)->GetInterface(sl->engine_object, SL_IID_ENGINE, &sl->engine);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to get audio engine interface.\n");
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 
 	result = (*sl->engine)->CreateOutputMix(sl->engine, &sl->output_mix, 0, NULL, NULL);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to create output mix object.\n");
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 
 	result = (*sl->output_mix)->Realize(sl->output_mix, SL_BOOLEAN_FALSE);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to realise output mix.\n");
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 
 	/* Create the buffer queue player */
 	SLDataLocator_AndroidSimpleBufferQueue bq_locator = {
 		.locatorType = SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE,
-		.numBuffers = 4
+		.numBuffers = GBCC_AUDIO_MAX_BUFFERS
 	};
 
 	SLDataFormat_PCM format = {
@@ -109,76 +102,93 @@ void gbcc_audio_platform_initialise(struct gbcc *gbc)
 	result = (*sl->engine)->CreateAudioPlayer(sl->engine, &sl->player_object, &source, &sink, 1, ids, req);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to create audio player.\n");
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 
 	result = (*sl->player_object)->Realize(sl->player_object, SL_BOOLEAN_FALSE);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to realise audio player.\n");
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 
 	result = (*sl->player_object)->GetInterface(sl->player_object, SL_IID_PLAY, &sl->player);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to get player interface.\n");
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 
 	result = (*sl->player_object)->GetInterface(sl->player_object, SL_IID_BUFFERQUEUE, &sl->buffer_queue);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to get buffer queue interface.\n");
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
 
 	result = (*sl->buffer_queue)->RegisterCallback(sl->buffer_queue, buffer_callback, audio);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to get buffer queue interface.\n");
-		exit(EXIT_FAILURE);
+		goto CLEANUP;
 	}
+	return true;
+
+CLEANUP:
+	destroy_objects(sl);
+	return false;
+}
+
+bool gbcc_audio_platform_start(struct gbcc *gbc)
+{
+	struct gbcc_audio *audio = &gbc->audio;
+	struct gbcc_audio_platform *sl = &audio->platform;
+	SLresult result = SL_RESULT_SUCCESS;
 
-	result = (*sl->buffer_queue)->Enqueue(sl->buffer_queue, sl->playback_buffers[0], audio->buffer_bytes);
-	result |= (*sl->buffer_queue)->Enqueue(sl->buffer_queue, sl->playback_buffers[1], audio->buffer_bytes);
-	result |= (*sl->buffer_queue)->Enqueue(sl->buffer_queue, sl->playback_buffers[2], audio->buffer_bytes);
-	result |= (*sl->buffer_queue)->Enqueue(sl->buffer_queue, sl->playback_buffers[3], audio->buffer_bytes);
+	sl->n_buffers = audio->queued_buffers;
+	sl->read_buffer = 0;
+	for (size_t i = 0; i < sl->n_buffers; i++) {
+		sl->playback_buffers[i] = calloc(audio->buffer_samples * 2, sizeof(*sl->playback_buffers[i]));
+		if (!sl->playback_buffers[i]) {
+			gbcc_log_error("Failed to allocate playback buffer.\n");
+			return false;
+		}
+		result |= (*sl->buffer_queue)->Enqueue(sl->buffer_queue, sl->playback_buffers[i], audio->buffer_bytes);
+	}
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to queue buffer.\n");
-		exit(EXIT_FAILURE);
+		return false;
 	}
 
 	// Start playback
 	result = (*sl->player)->SetPlayState(sl->player, SL_PLAYSTATE_PLAYING);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to get start playback.\n");
-		exit(EXIT_FAILURE);
+		return false;
 	}
+	return true;
 }
 
 void gbcc_audio_platform_destroy(struct gbcc *gbc) {
 	struct gbcc_audio *audio = &gbc->audio;
 	struct gbcc_audio_platform *sl = &audio->platform;
 
-	for (size_t i = 0; i < N_ELEM(sl->mix_buffers); i++) {
-		free(sl->mix_buffers[i]);
+	for (size_t i = 0; i < N_ELEM(sl->playback_buffers); i++) {
 		free(sl->playback_buffers[i]);
 	}
 
-	(*sl->player_object)->Destroy(sl->player_object);
-	(*sl->output_mix)->Destroy(sl->output_mix);
-	(*sl->engine_object)->Destroy(sl->engine_object);
-	*sl = (struct gbcc_audio_platform){0};
+	destroy_objects(sl);
 }
 
-void gbcc_audio_platform_queue_buffer(struct gbcc *gbc)
+/* Undoes as much of initialisation as got done */
+void destroy_objects(struct gbcc_audio_platform *sl)
 {
-	struct gbcc_audio *audio = &gbc->audio;
-	struct gbcc_audio_platform *sl = &audio->platform;
-
-	sl->write_buffer = (sl->write_buffer + 1) % 4;
-	while (sl->read_buffer == sl->write_buffer) {
-		const struct timespec time = {.tv_sec = 0, .tv_nsec = 100000};
-		nanosleep(&time, NULL);
+	if (sl->player_object) {
+		(*sl->player_object)->Destroy(sl->player_object);
 	}
-	memcpy(sl->mix_buffers[sl->write_buffer], audio->mix_buffer, audio->buffer_bytes);
+	if (sl->output_mix) {
+		(*sl->output_mix)->Destroy(sl->output_mix);
+	}
+	if (sl->engine_object) {
+		(*sl->engine_object)->Destroy(sl->engine_object);
+	}
+	*sl = (struct gbcc_audio_platform){0};
 }
 
 void gbcc_audio_play_wav(const char *filename)
@@ -186,14 +196,22 @@ void gbcc_audio_play_wav(const char *filename)
 	gbcc_log_error("Stubbed function \"gbcc_audio_play_wav()\" called.");
 }
 
+/*
+ * Runs on OpenSL's own thread whenever a buffer finishes playing, refilling
+ * it from the ring so the emulation thread never waits on the device.
+ */
 void buffer_callback(SLAndroidSimpleBufferQueueItf bq, void *_audio) {
 	struct gbcc_audio *audio = (struct gbcc_audio *)_audio;
 	struct gbcc_audio_platform *sl = &audio->platform;
-	memcpy(sl->playback_buffers[sl->read_buffer], sl->mix_buffers[sl->read_buffer], audio->buffer_bytes);
-	memset(sl->mix_buffers[sl->read_buffer], 0, audio->buffer_bytes);
-	sl->read_buffer = (sl->read_buffer + 1) % 4;
-	SLresult result = (*sl->buffer_queue)->Enqueue(sl->buffer_queue, sl->playback_buffers[sl->read_buffer], audio->buffer_bytes);
+	int16_t *buffer = (int16_t *)sl->playback_buffers[sl->read_buffer];
+	size_t n = gbcc_ring_read(&audio->ring, buffer, audio->buffer_samples);
+	if (n < audio->buffer_samples) {
+		atomic_fetch_add_explicit(&audio->underruns, 1, memory_order_relaxed);
+		memset(&buffer[n * 2], 0, (audio->buffer_samples - n) * 2 * sizeof(*buffer));
+	}
+	SLresult result = (*sl->buffer_queue)->Enqueue(sl->buffer_queue, buffer, audio->buffer_bytes);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("OpenSLES failed to enqueue buffer.\n");
 	}
+	sl->read_buffer = (sl->read_buffer + 1) % sl->n_buffers;
 }
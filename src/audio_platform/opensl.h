@@ -14,8 +14,11 @@
 #include <SLES/OpenSLES.h>
 #include <SLES/OpenSLES_Android.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#define GBCC_AUDIO_MAX_BUFFERS 4
+
 struct gbcc_audio_platform {
 	SLObjectItf engine_object;
 	SLEngineItf engine;
@@ -26,10 +29,9 @@ struct gbcc_audio_platform {
 	SLAndroidSimpleBufferQueueItf buffer_queue;
 	SLmilliHertz sample_rate;
 	uint16_t buffer_size;
-	uint16_t *mix_buffers[4];
-	uint16_t *playback_buffers[4];
+	uint16_t *playback_buffers[GBCC_AUDIO_MAX_BUFFERS];
+	size_t n_buffers;
 	uint16_t read_buffer;
-	uint16_t write_buffer;
 };
 
 #endif /* GBCC_OPENSL_H */
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#include "audio_sink.h"
+#include "audio.h"
+#include "debug.h"
+#include "gbcc.h"
+#include "nelem.h"
+#include "wav.h"
+#include <stdio.h>
+#include <string.h>
+
+static bool device_initialise(struct gbcc *gbc, const char *path);
+static bool device_start(struct gbcc *gbc);
+static void device_destroy(struct gbcc *gbc);
+static bool wav_initialise(struct gbcc *gbc, const char *path);
+static void wav_destroy(struct gbcc *gbc);
+static bool raw_initialise(struct gbcc *gbc, const char *path);
+static void raw_destroy(struct gbcc *gbc);
+static void file_write(struct gbcc *gbc, const int16_t *samples, size_t n);
+static void fill_wav_header(struct wav_header *header, const struct gbcc_audio *audio);
+
+static const struct gbcc_audio_sink sinks[] = {
+	{
+		.name = "openal",
+		.initialise = device_initialise,
+		.start = device_start,
+		.destroy = device_destroy
+	},
+	{
+		.name = "null",
+		.silent = true
+	},
+	{
+		.name = "wav",
+		.needs_path = true,
+		.initialise = wav_initialise,
+		.destroy = wav_destroy,
+		.write = file_write
+	},
+	{
+		.name = "raw",
+		.needs_path = true,
+		.initialise = raw_initialise,
+		.destroy = raw_destroy,
+		.write = file_write
+	}
+};
+
+const struct gbcc_audio_sink *gbcc_audio_sink_find(const char *spec)
+{
+	if (!spec || spec[0] == '\0') {
+		return &sinks[0];
+	}
+	size_t len = strcspn(spec, ":");
+	for (size_t i = 0; i < N_ELEM(sinks); i++) {
+		if (strlen(sinks[i].name) == len && strncmp(spec, sinks[i].name, len) == 0) {
+			return &sinks[i];
+		}
+	}
+	return NULL;
+}
+
+const char *gbcc_audio_sink_path(const char *spec)
+{
+	if (!spec) {
+		return NULL;
+	}
+	const char *colon = strchr(spec, ':');
+	if (!colon || colon[1] == '\0') {
+		return NULL;
+	}
+	return colon + 1;
+}
+
+bool device_initialise(struct gbcc *gbc, const char *path)
+{
+	return gbcc_audio_platform_initialise(gbc);
+}
+
+bool device_start(struct gbcc *gbc)
+{
+	return gbcc_audio_platform_start(gbc);
+}
+
+void device_destroy(struct gbcc *gbc)
+{
+	gbcc_audio_platform_destroy(gbc);
+}
+
+bool wav_initialise(struct gbcc *gbc, const char *path)
+{
+	struct gbcc_audio *audio = &gbc->audio;
+	audio->file = fopen(path, "wb");
+	if (!audio->file) {
+		gbcc_log_error("Failed to open audio file %s.\n", path);
+		return false;
+	}
+	/* The sizes are filled in once we know them */
+	struct wav_header header;
+	fill_wav_header(&header, audio);
+	wav_write_header(&header, audio->file);
+	audio->file_bytes = 0;
+	return true;
+}
+
+void wav_destroy(struct gbcc *gbc)
+{
+	struct gbcc_audio *audio = &gbc->audio;
+	if (!audio->file) {
+		return;
+	}
+	struct wav_header header;
+	fill_wav_header(&header, audio);
+	if (fseek(audio->file, 0, SEEK_SET) == 0) {
+		wav_write_header(&header, audio->file);
+	} else {
+		gbcc_log_warning("Couldn't rewind WAV file, its header will be incomplete.\n");
+	}
+	fclose(audio->file);
+	audio->file = NULL;
+}
+
+bool raw_initialise(struct gbcc *gbc, const char *path)
+{
+	struct gbcc_audio *audio = &gbc->audio;
+	if (strcmp(path, "-") == 0) {
+		audio->file = stdout;
+	} else {
+		audio->file = fopen(path, "wb");
+	}
+	if (!audio->file) {
+		gbcc_log_error("Failed to open audio file %s.\n", path);
+		return false;
+	}
+	audio->file_bytes = 0;
+	return true;
+}
+
+void raw_destroy(struct gbcc *gbc)
+{
+	struct gbcc_audio *audio = &gbc->audio;
+	if (!audio->file) {
+		return;
+	}
+	if (audio->file == stdout) {
+		fflush(audio->file);
+	} else {
+		fclose(audio->file);
+	}
+	audio->file = NULL;
+}
+
+void file_write(struct gbcc *gbc, const int16_t *samples, size_t n)
+{
+	struct gbcc_audio *audio = &gbc->audio;
+	if (!audio->file) {
+		return;
+	}
+	if (fwrite(samples, 2 * sizeof(*samples), n, audio->file) != n) {
+		gbcc_log_error("Failed to write audio, stopping output.\n");
+		audio->sink->destroy(gbc);
+		return;
+	}
+	audio->file_bytes += n * 2 * sizeof(*samples);
+}
+
+void fill_wav_header(struct wav_header *header, const struct gbcc_audio *audio)
+{
+	/* WAV sizes are 32-bit, so very long recordings just claim the maximum */
+	uint32_t data_size = audio->file_bytes > UINT32_MAX - 36 ? UINT32_MAX - 36 : (uint32_t)audio->file_bytes;
+	*header = (struct wav_header){
+		.ChunkID = {'R', 'I', 'F', 'F'},
+		.ChunkSize = 36 + data_size,
+		.Format = {'W', 'A', 'V', 'E'},
+		.Subchunk1ID = {'f', 'm', 't', ' '},
+		.Subchunk1Size = 16,
+		.AudioFormat = 1,
+		.NumChannels = 2,
+		.SampleRate = (uint32_t)audio->sample_rate,
+		.ByteRate = (uint32_t)audio->sample_rate * 2 * sizeof(GBCC_AUDIO_FMT),
+		.BlockAlign = 2 * sizeof(GBCC_AUDIO_FMT),
+		.BitsPerSample = 8 * sizeof(GBCC_AUDIO_FMT),
+		.Subchunk2ID = {'d', 'a', 't', 'a'},
+		.Subchunk2Size = data_size
+	};
+}
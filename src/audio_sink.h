@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#ifndef GBCC_AUDIO_SINK_H
+#define GBCC_AUDIO_SINK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct gbcc;
+
+/*
+ * Where the emulator's audio ends up, selected at runtime by a spec of the
+ * form "name" or "name:path":
+ *
+ *   openal      the audio device (the default)
+ *   null        nowhere; no samples are synthesised at all
+ *   wav:PATH    a 16-bit stereo WAV file
+ *   raw:PATH    headerless 16-bit stereo PCM, e.g. to a pipe ("-" is stdout)
+ */
+struct gbcc_audio_sink {
+	const char *name;
+	bool needs_path;
+	bool silent;		/* Never wants any samples */
+	bool (*initialise)(struct gbcc *gbc, const char *path);
+	/*
+	 * Called once the ring is ready, if the sink plays from it. Returns
+	 * false if playback couldn't start; destroy is still called.
+	 */
+	bool (*start)(struct gbcc *gbc);
+	void (*destroy)(struct gbcc *gbc);
+	/*
+	 * Takes samples straight from the emulation thread, at exactly the
+	 * nominal rate. If NULL, samples are queued in the audio ring instead,
+	 * for the sink's own output thread to play.
+	 */
+	void (*write)(struct gbcc *gbc, const int16_t *samples, size_t n);
+};
+
+/* Returns NULL if the spec doesn't name a known sink */
+const struct gbcc_audio_sink *gbcc_audio_sink_find(const char *spec);
+
+/* The path part of a spec, or NULL if there isn't one */
+const char *gbcc_audio_sink_path(const char *spec);
+
+#endif /* GBCC_AUDIO_SINK_H */
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+/*
+ * Plays an APU log made with --apu-log back through the APU and mixer, with
+ * no CPU or PPU, as fast as possible. The log is read in full beforehand, so
+ * the time reported is just that spent producing audio.
+ *
+ *   apu-replay LOG [SINK]
+ *
+ * SINK is as for --audio, and defaults to discarding the samples after they
+ * have been synthesised. Use e.g. wav:out.wav to compare output.
+ */
+
+#include "rom.h"
+#include "../apu.h"
+#include "../apu_log.h"
+#include "../audio.h"
+#include "../constants.h"
+#include "../debug.h"
+#include "../gbcc.h"
+#include "../memory.h"
+#include "../time_diff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLE_RATE 48000
+/* As in the emulation loop, so the mixer sees the same pattern of updates */
+#define BATCH_CYCLES 1000
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static struct gbcc_apu_log_record *load(const char *filename, enum CART_MODE *mode, size_t *n);
+static void run(struct gbcc *gbc, uint64_t *cycle, uint64_t until);
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s LOG [SINK]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	enum CART_MODE mode;
+	size_t n;
+	struct gbcc_apu_log_record *records = load(argv[1], &mode, &n);
+	if (!records) {
+		return EXIT_FAILURE;
+	}
+
+	static struct gbcc gbc;
+	if (!gbcc_bench_initialise(&gbc.core, mode)) {
+		free(records);
+		return EXIT_FAILURE;
+	}
+	const char *sink = argc > 2 ? argv[2] : "raw:/dev/null";
+	strncpy(gbc.audio_output, sink, sizeof(gbc.audio_output) - 1);
+	gbc.audio_rate = SAMPLE_RATE;
+	gbcc_audio_initialise(&gbc);
+	if (!gbc.audio.sink) {
+		free(records);
+		gbcc_free(&gbc.core);
+		return EXIT_FAILURE;
+	}
+
+	struct timespec start;
+	struct timespec end;
+	uint64_t cycle = 0;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	for (size_t i = 0; i < n; i++) {
+		const struct gbcc_apu_log_record *record = &records[i];
+		run(&gbc, &cycle, record->cycle);
+		switch (record->event) {
+			case GBCC_APU_LOG_WRITE:
+				/* DIV writes do nothing here, their effect is in the sequencer ticks */
+				gbcc_memory_write(&gbc.core, record->addr, record->val);
+				break;
+			case GBCC_APU_LOG_SEQUENCER:
+				gbcc_apu_sequencer_clock(&gbc.core);
+				break;
+			case GBCC_APU_LOG_END:
+				break;
+		}
+	}
+	gbcc_audio_update(&gbc);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+	double emulated = (double)cycle / GBC_CLOCK_FREQ;
+	double cpu = (double)gbcc_time_diff(&end, &start) / SECOND;
+	/* Not to stdout, which may be carrying the samples */
+	fprintf(stderr, "Replayed %zu events, %.2f s of audio in %.3f s (%.0fx realtime, %.0f samples/s).\n",
+			n, emulated, cpu, emulated / cpu, emulated * SAMPLE_RATE / cpu);
+
+	gbcc_audio_destroy(&gbc);
+	gbcc_free(&gbc.core);
+	free(records);
+	return EXIT_SUCCESS;
+}
+
+struct gbcc_apu_log_record *load(const char *filename, enum CART_MODE *mode, size_t *n)
+{
+	struct gbcc_apu_log log;
+	if (!gbcc_apu_log_open(&log, filename)) {
+		return NULL;
+	}
+	*mode = log.mode;
+	size_t size = 4096;
+	struct gbcc_apu_log_record *records = malloc(size * sizeof(*records));
+	*n = 0;
+	while (records) {
+		if (*n == size) {
+			size *= 2;
+			struct gbcc_apu_log_record *tmp = realloc(records, size * sizeof(*records));
+			if (!tmp) {
+				free(records);
+				records = NULL;
+				break;
+			}
+			records = tmp;
+		}
+		if (!gbcc_apu_log_read(&log, &records[*n])) {
+			gbcc_log_warning("APU log is truncated, replaying what's there.\n");
+			break;
+		}
+		if (records[(*n)++].event == GBCC_APU_LOG_END) {
+			break;
+		}
+	}
+	if (!records) {
+		gbcc_log_error("Couldn't allocate memory for APU log.\n");
+	}
+	gbcc_apu_log_close(&log);
+	return records;
+}
+
+/* Clock the APU up to the given cycle, updating audio as the emulator would */
+void run(struct gbcc *gbc, uint64_t *cycle, uint64_t until)
+{
+	while (*cycle < until) {
+		uint64_t n = MIN(until - *cycle, BATCH_CYCLES - *cycle % BATCH_CYCLES);
+		gbcc_apu_run(&gbc->core, (uint32_t)n);
+		*cycle += n;
+		if (*cycle % BATCH_CYCLES == 0) {
+			gbcc_audio_update(gbc);
+		}
+	}
+}
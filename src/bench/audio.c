@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+/*
+ * Measures how fast the audio pipeline turns APU activity into samples,
+ * without the CPU or PPU: all four channels play continuously while the APU
+ * is clocked directly, and the samples are thrown away.
+ */
+
+#include "rom.h"
+#include "../apu.h"
+#include "../audio.h"
+#include "../constants.h"
+#include "../gbcc.h"
+#include "../memory.h"
+#include "../time_diff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLE_RATE 48000
+#define BATCH_CYCLES 1000
+#define SEQUENCER_CYCLES 8192
+
+static void start_channels(struct gbcc_core *gbc);
+static uint64_t run(struct gbcc *gbc, uint32_t seconds);
+
+int main(int argc, char **argv)
+{
+	uint32_t seconds = 60;
+	if (argc > 1) {
+		seconds = (uint32_t)strtoul(argv[1], NULL, 10);
+	}
+
+	static struct gbcc gbc;
+	if (!gbcc_bench_initialise(&gbc.core, DMG)) {
+		return EXIT_FAILURE;
+	}
+	strcpy(gbc.audio_output, "raw:/dev/null");
+	gbc.audio_rate = SAMPLE_RATE;
+	gbcc_audio_initialise(&gbc);
+	start_channels(&gbc.core);
+
+	uint64_t ns = run(&gbc, seconds);
+	double cpu = (double)ns / SECOND;
+	printf("Synthesis: %.0f samples/s per core (%.0fx realtime at %d Hz)\n",
+			SAMPLE_RATE * seconds / cpu,
+			seconds / cpu,
+			SAMPLE_RATE);
+
+	gbcc_audio_set_muted(&gbc, true);
+	uint64_t muted_ns = run(&gbc, seconds);
+	printf("Muted APU: %.2f ms per emulated second, synthesis adds %.2f ms\n",
+			(double)muted_ns / seconds / 1e6,
+			((double)ns - (double)muted_ns) / seconds / 1e6);
+
+	gbcc_audio_destroy(&gbc);
+	gbcc_free(&gbc.core);
+	return EXIT_SUCCESS;
+}
+
+/* Square waves on 1 & 2, a sawtooth on 3 and noise on 4, all panned apart */
+void start_channels(struct gbcc_core *gbc)
+{
+	gbcc_memory_write(gbc, NR52, 0x80);
+	gbcc_memory_write(gbc, NR50, 0x77);
+	gbcc_memory_write(gbc, NR51, 0xB7);
+
+	gbcc_memory_write(gbc, NR11, 0x80);
+	gbcc_memory_write(gbc, NR12, 0xF0);
+	gbcc_memory_write(gbc, NR13, 0xD6);
+	gbcc_memory_write(gbc, NR14, 0x86);
+
+	gbcc_memory_write(gbc, NR21, 0x40);
+	gbcc_memory_write(gbc, NR22, 0xA0);
+	gbcc_memory_write(gbc, NR23, 0x9D);
+	gbcc_memory_write(gbc, NR24, 0x87);
+
+	for (uint8_t i = 0; i < WAVE_SIZE; i++) {
+		gbcc_memory_write(gbc, WAVE_START + i, (uint8_t)(i * 0x11u));
+	}
+	gbcc_memory_write(gbc, NR30, 0x80);
+	gbcc_memory_write(gbc, NR32, 0x20);
+	gbcc_memory_write(gbc, NR33, 0x00);
+	gbcc_memory_write(gbc, NR34, 0x86);
+
+	gbcc_memory_write(gbc, NR42, 0xF0);
+	gbcc_memory_write(gbc, NR43, 0x45);
+	gbcc_memory_write(gbc, NR44, 0x80);
+}
+
+/* Returns the CPU time taken to emulate that many seconds of audio */
+uint64_t run(struct gbcc *gbc, uint32_t seconds)
+{
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	uint64_t cycles = (uint64_t)seconds * GBC_CLOCK_FREQ;
+	for (uint64_t i = 0; i < cycles; i += BATCH_CYCLES) {
+		for (uint64_t j = i; j < i + BATCH_CYCLES; j++) {
+			gbcc_apu_clock(&gbc->core);
+			if (j % SEQUENCER_CYCLES == 0) {
+				gbcc_apu_sequencer_clock(&gbc->core);
+			}
+		}
+		gbcc_audio_update(gbc);
+	}
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	return gbcc_time_diff(&end, &start);
+}
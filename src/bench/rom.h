@@ -0,0 +1,24 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#ifndef GBCC_BENCH_ROM_H
+#define GBCC_BENCH_ROM_H
+
+#include "../core.h"
+#include <stdbool.h>
+
+/*
+ * Initialise a core with a blank cartridge for the given mode that just loops
+ * forever, for tools which drive the hardware directly rather than through a
+ * game.
+ */
+bool gbcc_bench_initialise(struct gbcc_core *gbc, enum CART_MODE mode);
+
+#endif /* GBCC_BENCH_ROM_H */
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+/*
+ * Measures the CPU upscalers on a synthetic DMG frame of tiles & runs of the
+ * four shades, scaling into a 32-bit buffer as a shared memory surface would.
+ */
+
+#include "../constants.h"
+#include "../nelem.h"
+#include "../pixel.h"
+#include "../scale.h"
+#include "../time_diff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const uint32_t shades[] = {0xC4CFA1FFu, 0x8B956DFFu, 0x4D533CFFu, 0x1F1F1FFFu};
+
+static const struct {
+	const char *name;
+	enum gbcc_scaler scaler;
+	unsigned int factor;
+} cases[] = {
+	{"nearest x2", GBCC_SCALER_NEAREST, 2},
+	{"nearest x3", GBCC_SCALER_NEAREST, 3},
+	{"nearest x4", GBCC_SCALER_NEAREST, 4},
+	{"nearest x8", GBCC_SCALER_NEAREST, 8},
+	{"scale2x", GBCC_SCALER_SCALE2X, 2},
+	{"scale3x", GBCC_SCALER_SCALE3X, 3},
+	{"dotmatrix x7", GBCC_SCALER_DOT_MATRIX, 7}
+};
+
+static void fill_frame(uint32_t *frame);
+
+int main(int argc, char **argv)
+{
+	uint32_t frames = 2000;
+	if (argc > 1) {
+		frames = (uint32_t)strtoul(argv[1], NULL, 10);
+	}
+
+	static uint32_t frame[GBC_SCREEN_WIDTH * GBC_SCREEN_HEIGHT];
+	fill_frame(frame);
+
+	size_t width = GBC_SCREEN_WIDTH * GBCC_SCALE_MAX_FACTOR;
+	size_t stride = width * sizeof(uint32_t);
+	uint32_t *out = malloc(stride * GBC_SCREEN_HEIGHT * GBCC_SCALE_MAX_FACTOR);
+	if (!out) {
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < N_ELEM(cases); i++) {
+		struct timespec start;
+		struct timespec end;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+		for (uint32_t f = 0; f < frames; f++) {
+			if (!gbcc_scale(cases[i].scaler, cases[i].factor,
+						frame, GBCC_PIXEL_RGBA8888,
+						out, stride, GBCC_PIXEL_XRGB8888)) {
+				free(out);
+				return EXIT_FAILURE;
+			}
+		}
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+		double cpu = (double)gbcc_time_diff(&end, &start) / SECOND;
+		double pixels = (double)GBC_SCREEN_WIDTH * GBC_SCREEN_HEIGHT
+			* cases[i].factor * cases[i].factor * frames;
+		printf("%-14s %8.1f Mpixel/s %8.0f frames/s\n",
+				cases[i].name,
+				pixels / cpu / 1e6,
+				frames / cpu);
+	}
+
+	free(out);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Tiles with diagonal edges for the edge-detecting scalers to find, over
+ * flat runs like a background layer.
+ */
+void fill_frame(uint32_t *frame)
+{
+	for (size_t y = 0; y < GBC_SCREEN_HEIGHT; y++) {
+		for (size_t x = 0; x < GBC_SCREEN_WIDTH; x++) {
+			size_t tx = x % 8;
+			size_t ty = y % 8;
+			size_t shade;
+			if ((x / 8 + y / 8) % 3 == 0) {
+				shade = (tx + ty) % 4;
+			} else if (tx > ty) {
+				shade = (x / 32) % 4;
+			} else {
+				shade = (y / 16) % 4;
+			}
+			frame[y * GBC_SCREEN_WIDTH + x] = gbcc_pixel_pack(GBCC_PIXEL_RGBA8888, shades[shade]);
+		}
+	}
+}
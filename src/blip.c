@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#include "blip.h"
+#include "debug.h"
+#include "nelem.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAC_BITS 32u
+#define PHASE_BITS 5u
+#define PHASES (1u << PHASE_BITS)
+#define WIDTH 16u
+#define DELTA_BITS 15u
+/* High-pass filter strength, which removes the DC offset of the DACs */
+#define BASS_SHIFT 9u
+/* Fraction of the Nyquist frequency passed by the kernel */
+#define CUTOFF 0.9
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * Eight 32-bit lanes, i.e. four stereo samples. GCC lowers this to whatever
+ * vector instructions the target has, or plain scalar code if none.
+ */
+typedef int32_t lanes __attribute__((vector_size(32)));
+#define LANES (sizeof(lanes) / sizeof(int32_t))
+
+/*
+ * Baseline x86-64 has no 32-bit vector multiply, which makes the vector code
+ * slower than scalar, so build versions for newer CPUs too and pick at load.
+ */
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define MULTIVERSION __attribute__((target_clones("avx2", "sse4.1", "default")))
+#endif
+#endif
+#ifndef MULTIVERSION
+#define MULTIVERSION
+#endif
+
+/* Each tap is stored twice, once for each stereo channel */
+static lanes kernel[PHASES][WIDTH * 2 / LANES];
+static bool kernel_built;
+
+static void build_kernel(void);
+
+bool gbcc_blip_initialise(struct gbcc_blip *blip, size_t size)
+{
+	*blip = (struct gbcc_blip){0};
+	blip->size = size;
+	blip->gain = 1 << GBCC_BLIP_GAIN_BITS;
+	blip->buffer = calloc((size + WIDTH) * 2, sizeof(*blip->buffer));
+	if (!blip->buffer) {
+		gbcc_log_error("Couldn't allocate audio buffer.\n");
+		return false;
+	}
+	if (!kernel_built) {
+		build_kernel();
+		kernel_built = true;
+	}
+	return true;
+}
+
+void gbcc_blip_destroy(struct gbcc_blip *blip)
+{
+	free(blip->buffer);
+	blip->buffer = NULL;
+}
+
+void gbcc_blip_clear(struct gbcc_blip *blip)
+{
+	blip->offset = 0;
+	blip->integrator[0] = 0;
+	blip->integrator[1] = 0;
+	memset(blip->buffer, 0, (blip->size + WIDTH) * 2 * sizeof(*blip->buffer));
+}
+
+void gbcc_blip_set_rates(struct gbcc_blip *blip, double clock_rate, double sample_rate)
+{
+	blip->factor = (uint64_t)(sample_rate / clock_rate * (double)(1ull << FRAC_BITS));
+}
+
+void gbcc_blip_set_gain(struct gbcc_blip *blip, float gain)
+{
+	if (gain < 0) {
+		gain = 0;
+	} else if (gain > 2) {
+		gain = 2;
+	}
+	blip->gain = (int32_t)lroundf(gain * (1 << GBCC_BLIP_GAIN_BITS));
+}
+
+MULTIVERSION
+void gbcc_blip_add_delta(struct gbcc_blip *blip, uint32_t clock, int32_t left, int32_t right)
+{
+	uint64_t fixed = blip->offset + clock * blip->factor;
+	size_t pos = (size_t)(fixed >> FRAC_BITS);
+	if (pos >= blip->size) {
+		/* Should have been read out by now, so drop it */
+		return;
+	}
+	const lanes *k = kernel[(fixed >> (FRAC_BITS - PHASE_BITS)) & (PHASES - 1)];
+	const lanes delta = {left, right, left, right, left, right, left, right};
+	int32_t *out = &blip->buffer[pos * 2];
+	for (size_t i = 0; i < N_ELEM(kernel[0]); i++) {
+		/* The buffer isn't aligned to the vector size */
+		lanes v;
+		memcpy(&v, &out[i * LANES], sizeof(v));
+		v += k[i] * delta;
+		memcpy(&out[i * LANES], &v, sizeof(v));
+	}
+}
+
+void gbcc_blip_end_frame(struct gbcc_blip *blip, uint32_t clocks)
+{
+	blip->offset += clocks * blip->factor;
+	if ((blip->offset >> FRAC_BITS) > blip->size) {
+		blip->offset = (uint64_t)blip->size << FRAC_BITS;
+	}
+}
+
+size_t gbcc_blip_samples_avail(const struct gbcc_blip *blip)
+{
+	return (size_t)(blip->offset >> FRAC_BITS);
+}
+
+size_t gbcc_blip_read_samples(struct gbcc_blip *blip, int16_t *out, size_t n)
+{
+	size_t avail = gbcc_blip_samples_avail(blip);
+	if (n > avail) {
+		n = avail;
+	}
+	/*
+	 * Integration, the high-pass filter, volume and clipping all happen in
+	 * this one pass. Each sample depends on the last, so it doesn't
+	 * vectorise, but the mixing and NR50 volume were already done as
+	 * deltas were added, so there's little else left per sample.
+	 */
+	const int32_t gain = blip->gain;
+	for (size_t c = 0; c < 2; c++) {
+		int32_t sum = blip->integrator[c];
+		const int32_t *in = &blip->buffer[c];
+		for (size_t i = 0; i < n; i++) {
+			int32_t s = sum >> DELTA_BITS;
+			sum += in[2 * i];
+			sum -= s * (1 << (DELTA_BITS - BASS_SHIFT));
+			s = (s * gain) >> GBCC_BLIP_GAIN_BITS;
+			if (s > INT16_MAX) {
+				s = INT16_MAX;
+			} else if (s < INT16_MIN) {
+				s = INT16_MIN;
+			}
+			out[2 * i + c] = (int16_t)s;
+		}
+		blip->integrator[c] = sum;
+	}
+
+	/* Shift the remaining deltas down to the start of the buffer */
+	size_t remaining = avail - n + WIDTH;
+	memmove(blip->buffer, &blip->buffer[n * 2], remaining * 2 * sizeof(*blip->buffer));
+	memset(&blip->buffer[remaining * 2], 0, n * 2 * sizeof(*blip->buffer));
+	blip->offset -= (uint64_t)n << FRAC_BITS;
+	return n;
+}
+
+/*
+ * Each phase holds a Blackman-windowed sinc impulse, offset by that fraction
+ * of a sample, and scaled so that its taps sum to exactly 1 << DELTA_BITS.
+ * Once integrated, this gives a band-limited step with a delay of WIDTH / 2
+ * samples.
+ */
+void build_kernel(void)
+{
+	for (size_t p = 0; p < PHASES; p++) {
+		double taps[WIDTH];
+		double total = 0;
+		for (size_t i = 0; i < WIDTH; i++) {
+			double t = (double)i - WIDTH / 2.0 + 1 - (double)p / PHASES;
+			double x = M_PI * CUTOFF * t;
+			double sinc = (x == 0) ? 1 : sin(x) / x;
+			double w = 2 * M_PI * (t + WIDTH / 2.0) / WIDTH;
+			double window = 0.42 - 0.5 * cos(w) + 0.08 * cos(2 * w);
+			taps[i] = sinc * window;
+			total += taps[i];
+		}
+		int32_t fixed[WIDTH];
+		int32_t sum = 0;
+		for (size_t i = 0; i < WIDTH; i++) {
+			fixed[i] = (int32_t)lround(taps[i] / total * (1 << DELTA_BITS));
+			sum += fixed[i];
+		}
+		/* Put any rounding error in the centre tap to avoid a DC drift */
+		fixed[WIDTH / 2 - 1] += (1 << DELTA_BITS) - sum;
+		int32_t *row = (int32_t *)kernel[p];
+		for (size_t i = 0; i < WIDTH; i++) {
+			row[2 * i] = fixed[i];
+			row[2 * i + 1] = fixed[i];
+		}
+	}
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#ifndef GBCC_BLIP_H
+#define GBCC_BLIP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Band-limited step synthesis buffer.
+ *
+ * Instead of sampling the APU's output at the output rate, which aliases
+ * badly, the APU records a (clock, delta) pair each time its output level
+ * changes. Each delta is added to the buffer as a band-limited step, and the
+ * steps are integrated into stereo samples when read.
+ */
+#define GBCC_BLIP_GAIN_BITS 12
+
+struct gbcc_blip {
+	uint64_t factor;	/* Output samples per input clock, 32.32 fixed point */
+	uint64_t offset;	/* Position of clock 0 of this frame, 32.32 fixed point */
+	size_t size;		/* Capacity in stereo samples */
+	int32_t integrator[2];
+	int32_t gain;		/* Output volume, 1 << GBCC_BLIP_GAIN_BITS is unity */
+	int32_t *buffer;	/* Interleaved stereo deltas */
+};
+
+bool gbcc_blip_initialise(struct gbcc_blip *blip, size_t size);
+void gbcc_blip_destroy(struct gbcc_blip *blip);
+void gbcc_blip_clear(struct gbcc_blip *blip);
+void gbcc_blip_set_rates(struct gbcc_blip *blip, double clock_rate, double sample_rate);
+
+/* Volume applied as samples are read, from 0 to 2 */
+void gbcc_blip_set_gain(struct gbcc_blip *blip, float gain);
+
+/* Add a change in output level at the given clock of the current frame */
+void gbcc_blip_add_delta(struct gbcc_blip *blip, uint32_t clock, int32_t left, int32_t right);
+
+/* Make the first n clocks of the current frame available for reading */
+void gbcc_blip_end_frame(struct gbcc_blip *blip, uint32_t clocks);
+
+size_t gbcc_blip_samples_avail(const struct gbcc_blip *blip);
+
+/* Read up to n interleaved stereo samples, returning the number read */
+size_t gbcc_blip_read_samples(struct gbcc_blip *blip, int16_t *out, size_t n);
+
+#endif /* GBCC_BLIP_H */
@@ -283,3 +283,52 @@ void gbcc_fill_lut(uint8_t out[8][8][8][4])
 		}
 	}
 }
+
+/*
+ * Colour correction on the CPU, for a single 5-bit per channel GBC colour.
+ * Returns a 0xRRGGBBAA colour. This approximates shaders/colour-correct.frag
+ * rather than matching it exactly: here the 5-bit value is put on the grid
+ * as c * 7 / 31, while the shader uses the 8-bit expanded value and leaves
+ * the interpolation to the texture unit, so results can differ by rounding.
+ */
+uint32_t gbcc_colour_correct(uint8_t r, uint8_t g, uint8_t b)
+{
+	/*
+	 * The table is sampled at 8 evenly spaced points per channel, so map
+	 * each channel onto that grid, and trilinearly interpolate between
+	 * the 8 surrounding entries in units of 1/31.
+	 */
+	const uint8_t in[3] = {r, g, b};
+	uint8_t idx[3];
+	uint32_t frac[3];
+	for (int i = 0; i < 3; i++) {
+		uint32_t pos = (in[i] & 0x1Fu) * 7u;
+		idx[i] = (uint8_t)(pos / 31u);
+		frac[i] = pos % 31u;
+		if (idx[i] == 7) {
+			idx[i] = 6;
+			frac[i] = 31;
+		}
+	}
+
+	uint32_t res = 0xFFu;
+	for (int c = 0; c < 3; c++) {
+		uint32_t acc = 0;
+		for (uint8_t corner = 0; corner < 8; corner++) {
+			bool dr = corner & 0x01u;
+			bool dg = corner & 0x02u;
+			bool db = corner & 0x04u;
+			uint32_t weight = (dr ? frac[0] : 31u - frac[0])
+				* (dg ? frac[1] : 31u - frac[1])
+				* (db ? frac[2] : 31u - frac[2]);
+			acc += weight * lut[c][idx[0] + dr][idx[1] + dg][idx[2] + db];
+		}
+		/* Same brightening factor as the shader */
+		acc = acc * 35u / (31u * 31u * 31u * 31u);
+		if (acc > 0xFFu) {
+			acc = 0xFFu;
+		}
+		res |= acc << (24u - 8u * (uint32_t)c);
+	}
+	return res;
+}
@@ -14,5 +14,6 @@
 #include <stdint.h>
 
 void gbcc_fill_lut(uint8_t out[8][8][8][4]);
+uint32_t gbcc_colour_correct(uint8_t r, uint8_t g, uint8_t b);
 
 #endif /* GBCC_COLOUR_H */
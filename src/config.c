@@ -8,6 +8,7 @@
  *
  */
 
+#include "audio_sink.h"
 #include "core.h"
 #include "config.h"
 #include "debug.h"
@@ -224,7 +225,44 @@ char *strip(const char *str)
 bool parse_option(struct gbcc *gbc, size_t lineno, const char *option, const char *value)
 {
 	bool err = false;
-	if (strcasecmp(option, "autoresume") == 0) {
+	if (strcasecmp(option, "apu-log") == 0) {
+		strncpy(gbc->apu_log_path, value, sizeof(gbc->apu_log_path));
+		gbc->apu_log_path[N_ELEM(gbc->apu_log_path) - 1] = '\0';
+	} else if (strcasecmp(option, "audio") == 0) {
+		if (!gbcc_audio_sink_find(value)) {
+			PARSE_ERROR(lineno, "Unknown audio output \"%s\".\n", value);
+			err = true;
+		} else {
+			strncpy(gbc->audio_output, value, sizeof(gbc->audio_output));
+			gbc->audio_output[N_ELEM(gbc->audio_output) - 1] = '\0';
+		}
+	} else if (strcasecmp(option, "audio-latency") == 0) {
+		errno = 0;
+		char *endptr;
+		float ms = strtof(value, &endptr);
+		if (endptr == value || ms <= 0) {
+			PARSE_ERROR(lineno, "Failed to parse \"%s\" as a positive float.\n", value);
+			err = true;
+		} else if (errno) {
+			PARSE_ERROR(lineno, "Float value \"%s\" out of range.\n", value);
+			err = true;
+		} else {
+			gbc->audio_latency = (uint64_t)(ms * 1000000);
+		}
+	} else if (strcasecmp(option, "audio-rate") == 0) {
+		errno = 0;
+		char *endptr;
+		unsigned long rate = strtoul(value, &endptr, 10);
+		if (endptr == value || *endptr != '\0') {
+			PARSE_ERROR(lineno, "Failed to parse \"%s\" as an integer.\n", value);
+			err = true;
+		} else if (errno || rate > 384000) {
+			PARSE_ERROR(lineno, "Sample rate \"%s\" out of range.\n", value);
+			err = true;
+		} else {
+			gbc->audio_rate = rate;
+		}
+	} else if (strcasecmp(option, "autoresume") == 0) {
 		gbc->autoresume = parse_bool(lineno, value, &err);
 	} else if (strcasecmp(option, "autosave") == 0) {
 		gbc->autosave = parse_bool(lineno, value, &err);
@@ -233,12 +271,38 @@ bool parse_option(struct gbcc *gbc, size_t lineno, const char *option, const cha
 	} else if (strcasecmp(option, "cheat") == 0) {
 		gbcc_cheats_add_fuzzy(&gbc->core, value);
 		gbc->core.cheats.enabled = true;
+	} else if (strcasecmp(option, "colour-correction") == 0) {
+		gbc->core.colour_correction = parse_bool(lineno, value, &err);
 	} else if (strcasecmp(option, "fractional") == 0) {
 		gbc->fractional_scaling = parse_bool(lineno, value, &err);
 	} else if (strcasecmp(option, "frame-blending") == 0) {
 		gbc->frame_blending = parse_bool(lineno, value, &err);
 	} else if (strcasecmp(option, "interlacing") == 0) {
 		gbc->interlacing = parse_bool(lineno, value, &err);
+	} else if (strcasecmp(option, "mute") == 0) {
+		gbcc_audio_set_muted(gbc, parse_bool(lineno, value, &err));
+	} else if (strcasecmp(option, "pacing-policy") == 0) {
+		if (strcasecmp(value, "catch-up") == 0) {
+			gbc->pacing_policy = GBCC_PACER_CATCH_UP;
+		} else if (strcasecmp(value, "skip") == 0) {
+			gbc->pacing_policy = GBCC_PACER_SKIP;
+		} else {
+			PARSE_ERROR(lineno, "Unknown pacing policy \"%s\".\n", value);
+			err = true;
+		}
+	} else if (strcasecmp(option, "pacing-slice") == 0) {
+		errno = 0;
+		char *endptr;
+		float ms = strtof(value, &endptr);
+		if (endptr == value || ms <= 0) {
+			PARSE_ERROR(lineno, "Failed to parse \"%s\" as a positive float.\n", value);
+			err = true;
+		} else if (errno) {
+			PARSE_ERROR(lineno, "Float value \"%s\" out of range.\n", value);
+			err = true;
+		} else {
+			gbc->pacing_slice = (uint64_t)(ms * 1000000);
+		}
 	} else if (strcasecmp(option, "palette") == 0) {
 		gbc->core.ppu.palette = gbcc_get_palette(value);
 	} else if (strcasecmp(option, "shader") == 0) {
@@ -247,6 +311,8 @@ bool parse_option(struct gbcc *gbc, size_t lineno, const char *option, const cha
 	} else if (strcasecmp(option, "save-dir") == 0) {
 		strncpy(gbc->save_directory, value, sizeof(gbc->save_directory));
 		gbc->save_directory[N_ELEM(gbc->save_directory) - 1] = '\0';
+	} else if (strcasecmp(option, "software") == 0) {
+		gbc->software_rendering = parse_bool(lineno, value, &err);
 	} else if (strcasecmp(option, "turbo") == 0) {
 		errno = 0;
 		char *endptr;
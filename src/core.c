@@ -13,12 +13,12 @@
 #include "bit_utils.h"
 #include "constants.h"
 #include "debug.h"
+#include "mailbox.h"
 #include "memory.h"
 #include "nelem.h"
 #include "palettes.h"
 #include "save.h"
 #include <errno.h>
-#include <semaphore.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,6 +46,7 @@ static void print_destination_code(struct gbcc_core *gbc);
 static void init_registers(struct gbcc_core *gbc);
 static void init_mmap(struct gbcc_core *gbc);
 static void init_ioreg(struct gbcc_core *gbc);
+static void free_mailbox(struct gbcc_core *gbc);
 
 void gbcc_initialise(struct gbcc_core *gbc, const char *filename)
 {
@@ -61,21 +62,31 @@ void gbcc_initialise(struct gbcc_core *gbc, const char *filename)
 	gbc->cart.mbc.accelerometer.real_y = 0x81D0u;
 	gbc->cpu.ime = false;
 	gbc->ppu.clock = 0;
+	gbc->ppu.oam_dirty = true;
 	gbc->ppu.palette = gbcc_get_palette("default");
-	gbc->ppu.screen.buffer_0 = calloc(GBC_SCREEN_SIZE, sizeof(uint32_t));
-	gbc->ppu.screen.buffer_1 = calloc(GBC_SCREEN_SIZE, sizeof(uint32_t));
-	gbc->ppu.screen.gbc = gbc->ppu.screen.buffer_0;
-	gbc->ppu.screen.sdl = gbc->ppu.screen.buffer_1;
+	gbc->ppu.mailbox = calloc(1, sizeof(*gbc->ppu.mailbox));
+	if (!gbc->ppu.mailbox || !gbcc_mailbox_initialise(gbc->ppu.mailbox, GBC_SCREEN_SIZE * sizeof(uint32_t))) {
+		/* The mailbox frees its own frames if it fails */
+		free(gbc->ppu.mailbox);
+		gbc->ppu.mailbox = NULL;
+		gbc->error = true;
+		gbc->error_msg = "Couldn't allocate frame buffers.\n";
+		return;
+	}
+	gbc->ppu.screen = gbcc_mailbox_back(gbc->ppu.mailbox)->pixels;
 	load_rom(gbc, filename);
 	if (gbc->error) {
+		free_mailbox(gbc);
 		return;
 	}
 	parse_header(gbc);
 	if (gbc->error) {
+		free_mailbox(gbc);
 		return;
 	}
 	init_mmap(gbc);
 	init_ioreg(gbc);
+	gbcc_ppu_refresh_palettes(gbc);
 	gbcc_apu_init(gbc);
 
 	for (size_t i = 0; i < N_ELEM(gbc->memory.wram_bank); i++) {
@@ -87,7 +98,6 @@ void gbcc_initialise(struct gbcc_core *gbc, const char *filename)
 		gbc->memory.hram[i] = (uint8_t)rand();
 	}
 
-	sem_init(&gbc->ppu.vsync_semaphore, 0, 0);
 	gbc->initialised = true;
 }
 
@@ -97,16 +107,23 @@ void gbcc_free(struct gbcc_core *gbc)
 		return;
 	}
 	gbc->initialised = false;
-	sem_destroy(&gbc->ppu.vsync_semaphore);
 	free(gbc->cart.rom);
 	if (gbc->cart.ram_size > 0) {
 		free(gbc->cart.ram);
 	}
-	free(gbc->ppu.screen.buffer_0);
-	free(gbc->ppu.screen.buffer_1);
+	free_mailbox(gbc);
 	*gbc = (const struct gbcc_core){0};
 }
 
+/* gbcc_free() only cleans up after a full initialisation, so errors use this */
+void free_mailbox(struct gbcc_core *gbc)
+{
+	gbcc_mailbox_destroy(gbc->ppu.mailbox);
+	free(gbc->ppu.mailbox);
+	gbc->ppu.mailbox = NULL;
+	gbc->ppu.screen = NULL;
+}
+
 void load_rom(struct gbcc_core *gbc, const char *filename)
 {
 	gbcc_log_info("Loading %s...\n", filename);
@@ -295,6 +312,8 @@ void init_mode(struct gbcc_core *gbc)
 	if (check_bit(mode_flag, 7) && (mode_flag & 0x0Cu)) {
 		gbcc_log_debug("Colorised DMG mode unsupported\n");
 	}
+	gbcc_memory_init_mode(gbc);
+	gbcc_ppu_init_mode(gbc);
 	switch (gbc->mode) {
 		case DMG:
 			gbcc_log_info("\tMode: DMG\n");
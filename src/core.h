@@ -11,7 +11,7 @@
 #ifndef GBCC_CORE_H
 #define GBCC_CORE_H
 
-#define GBCC_SAVE_STATE_VERSION 8
+#define GBCC_SAVE_STATE_VERSION 16
 
 #include "apu.h"
 #include "cheats.h"
@@ -68,6 +68,8 @@ struct gbcc_core {
 		/* Emulator areas */
 		uint8_t wram_bank[8][WRAM0_SIZE];	/* Actual location of WRAM */
 		uint8_t vram_bank[2][VRAM_SIZE]; 	/* Actual location of VRAM */
+		uint8_t ioreg_read_masks[IOREG_SIZE];	/* IO register masks for this mode */
+		uint8_t ioreg_write_masks[IOREG_SIZE];
 	} memory;
 
 	/* Cartridge data & flags */
@@ -123,6 +125,7 @@ struct gbcc_core {
 
 	/* Settings */
 	bool sync_to_video;
+	bool colour_correction;
 	bool hide_background;
 	bool hide_window;
 	bool hide_sprites;
@@ -65,6 +65,7 @@ void cpu_clock(struct gbcc_core *gbc)
 	if (cpu->dma.timer > 0) {
 		cpu->dma.running = true;
 		gbc->memory.oam[low_byte(cpu->dma.source)] = gbcc_memory_read(gbc, cpu->dma.source);
+		gbc->ppu.oam_dirty = true;
 		cpu->dma.timer--;
 		cpu->dma.source++;
 	} else {
@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# Copyright (C) 2025 Adonis Najimi
+#
+# Licensed under the GPLv3 License.
+# See either the LICENSE file, or:
+#
+# https://opensource.org/license/gpl-3-0
+#
+# Writes a C file holding the source of each shader given, so they're
+# built into the binary rather than read from disk at startup.
+#
+# Usage: embed_shaders.sh OUTPUT SHADER...
+
+set -e
+
+out="$1"
+shift
+tab=$(printf '\t')
+
+{
+	printf '/* Generated by embed_shaders.sh from shaders/gles2, do not edit */\n\n'
+	printf '#include "src/shader.h"\n\n'
+	printf 'const struct gbcc_shader_source gbcc_shader_sources[] = {\n'
+	for shader in "$@"; do
+		printf '\t{\n\t\t"%s",\n' "$(basename "$shader")"
+		sed -e 's/\\/\\\\/g' -e 's/"/\\"/g' -e "s/^/$tab$tab\"/" -e 's/$/\\n"/' "$shader"
+		printf '\t},\n'
+	done
+	printf '};\n\n'
+	printf 'const size_t gbcc_shader_source_count = %d;\n' "$#"
+} > "$out"
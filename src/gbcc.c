@@ -19,16 +19,31 @@
  */
 
 #include "gbcc.h"
+#include "apu_log.h"
 #include "debug.h"
 #include "camera.h"
+#include "pacer.h"
 #include "save.h"
+#include "time_diff.h"
 #include <stdio.h>
 
+#define BATCH_CYCLES 1000
+/* How much emulated time passes between sleeps, unless configured */
+#define DEFAULT_PACING_SLICE (SECOND / 240)
+
+static void pace(struct gbcc *gbc);
+
 void *gbcc_emulation_loop(void *_gbc)
 {
 	struct gbcc *gbc = (struct gbcc *)_gbc;
+	gbcc_pacer_initialise(&gbc->pacer,
+			gbc->pacing_slice ? gbc->pacing_slice : DEFAULT_PACING_SLICE,
+			gbc->pacing_policy);
+	if (gbc->apu_log_path[0] != '\0') {
+		gbcc_apu_log_start(&gbc->core, &gbc->apu_log, gbc->apu_log_path);
+	}
 	while (!gbc->quit) {
-		for (int i = 1000; i > 0; i--) {
+		for (int i = BATCH_CYCLES; i > 0; i--) {
 			/* Only check for savestates, pause etc.
 			 * every 1000 cycles */
 			gbcc_emulate_cycle(&gbc->core);
@@ -36,11 +51,32 @@ void *gbcc_emulation_loop(void *_gbc)
 				gbcc_log_error("Invalid opcode: 0x%02X\n", gbc->core.cpu.opcode);
 				gbcc_print_registers(&gbc->core, false);
 				gbc->quit = true;
-				return 0;
+				break;
 			}
-			gbcc_audio_update(gbc);
 		}
-
+		gbcc_audio_update(gbc);
+		pace(gbc);
 	}
+	gbcc_apu_log_stop(&gbc->core);
+	gbcc_pacer_log_stats(&gbc->pacer, "Emulation");
 	return 0;
 }
+
+/*
+ * Keep emulation running at the right speed, unless it's synced to video,
+ * where waiting for the renderer paces it, or turboing without a limit.
+ */
+void pace(struct gbcc *gbc)
+{
+	double speed = 1;
+	if (gbc->core.keys.turbo) {
+		speed = gbc->turbo_speed;
+	} else if (gbc->core.sync_to_video) {
+		speed = 0;
+	}
+	if (speed <= 0) {
+		gbcc_pacer_reset(&gbc->pacer);
+		return;
+	}
+	gbcc_pacer_advance(&gbc->pacer, BATCH_CYCLES * (double)SECOND / (GBC_CLOCK_FREQ * speed));
+}
@@ -28,10 +28,12 @@
 #define ANDROID_INLINE
 #endif
 
+#include "apu_log.h"
 #include "audio.h"
 #include "core.h"
 #include "camera.h"
 #include "menu.h"
+#include "pacer.h"
 #include "window.h"
 #include "vram_window.h"
 
@@ -42,10 +44,18 @@ struct gbcc {
 	struct gbcc_audio audio;
 	struct gbcc_menu menu;
 	struct gbcc_camera_platform camera;
+	struct gbcc_pacer pacer;
+	struct gbcc_apu_log apu_log;
 	
 	char save_directory[4096];
 	char default_shader[32];
+	char audio_output[4096];
+	size_t audio_rate;	/* In Hz, 0 for the device's own */
+	uint64_t audio_latency;	/* In ns, 0 for the default */
+	char apu_log_path[4096];	/* Where to record the APU, if anywhere */
 	float turbo_speed;
+	uint64_t pacing_slice;	/* In ns, 0 for the default */
+	enum gbcc_pacer_policy pacing_policy;
 	bool quit;
 	bool pause;
 	int8_t save_state;
@@ -57,6 +67,7 @@ struct gbcc {
 	bool fractional_scaling;
 	bool frame_blending;
 	bool interlacing;
+	bool software_rendering;	/* Present through wl_shm rather than GL */
 	bool vram_display;
 	bool show_fps;
 
@@ -56,7 +56,6 @@ void gbcc_input_process_key(struct gbcc *gbc, enum gbcc_key key, bool pressed)
 			break;
 		case GBCC_KEY_TURBO:
 			gbc->core.keys.turbo ^= pressed;
-			gbc->audio.index *= pressed;
 			break;
 		case GBCC_KEY_SCREENSHOT:
 			gbc->window.screenshot ^= pressed;
@@ -97,7 +96,6 @@ void gbcc_input_process_key(struct gbcc *gbc, enum gbcc_key key, bool pressed)
 			if (!pressed) {
 				break;
 			}
-			gbc->audio.index = 0;
 			if (gbc->core.sync_to_video) {
 				gbcc_window_show_message(gbc, "Vsync enabled", 1, true);
 			} else {
@@ -211,6 +209,18 @@ void gbcc_input_process_key(struct gbcc *gbc, enum gbcc_key key, bool pressed)
 				gbcc_window_show_message(gbc, "Cheats disabled", 1, true);
 			}
 			break;
+		case GBCC_KEY_MUTE:
+			if (!pressed) {
+				break;
+			}
+			if (atomic_load(&gbc->audio.muted)) {
+				gbcc_audio_set_muted(gbc, false);
+				gbcc_window_show_message(gbc, "Audio unmuted", 1, true);
+			} else {
+				gbcc_audio_set_muted(gbc, true);
+				gbcc_window_show_message(gbc, "Audio muted", 1, true);
+			}
+			break;
 		case GBCC_KEY_ACCELEROMETER_UP:
 			gbc->core.cart.mbc.accelerometer.tilt.up = pressed;
 			break;
@@ -44,6 +44,7 @@ enum gbcc_key {
 	GBCC_KEY_INTERLACE,
 	GBCC_KEY_SHADER,
 	GBCC_KEY_CHEATS,
+	GBCC_KEY_MUTE,
 	GBCC_KEY_ACCELEROMETER_UP,
 	GBCC_KEY_ACCELEROMETER_DOWN,
 	GBCC_KEY_ACCELEROMETER_LEFT,
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#include "mailbox.h"
+#include "debug.h"
+#include "nelem.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Set in middle when it holds a frame the consumer hasn't seen */
+#define MAILBOX_NEW 0x80u
+#define MAILBOX_INDEX 0x03u
+
+bool gbcc_mailbox_initialise(struct gbcc_mailbox *mb, size_t frame_size)
+{
+	*mb = (struct gbcc_mailbox){0};
+	sem_init(&mb->consumed, 0, 0);
+	for (size_t i = 0; i < N_ELEM(mb->frames); i++) {
+		mb->frames[i].pixels = calloc(1, frame_size);
+		if (!mb->frames[i].pixels) {
+			gbcc_log_error("Couldn't allocate frame buffer.\n");
+			gbcc_mailbox_destroy(mb);
+			return false;
+		}
+	}
+	mb->back = 0;
+	atomic_init(&mb->middle, 1);
+	mb->front = 2;
+	atomic_init(&mb->closed, false);
+	mb->notify_fd = -1;
+	return true;
+}
+
+void gbcc_mailbox_destroy(struct gbcc_mailbox *mb)
+{
+	for (size_t i = 0; i < N_ELEM(mb->frames); i++) {
+		free(mb->frames[i].pixels);
+		free(mb->frames[i].palette);
+		mb->frames[i].pixels = NULL;
+		mb->frames[i].palette = NULL;
+	}
+	sem_destroy(&mb->consumed);
+}
+
+struct gbcc_frame *gbcc_mailbox_back(struct gbcc_mailbox *mb)
+{
+	return &mb->frames[mb->back];
+}
+
+void gbcc_mailbox_publish(struct gbcc_mailbox *mb, uint64_t number)
+{
+	struct gbcc_frame *frame = &mb->frames[mb->back];
+	frame->number = number;
+	clock_gettime(CLOCK_MONOTONIC, &frame->timestamp);
+	uint8_t old = atomic_exchange_explicit(&mb->middle,
+			mb->back | MAILBOX_NEW,
+			memory_order_acq_rel);
+	mb->back = old & MAILBOX_INDEX;
+	if (mb->notify_fd >= 0 && !(old & MAILBOX_NEW)) {
+		/*
+		 * If the last frame was never taken, the consumer hasn't
+		 * been to the mailbox since we last signalled, so there's no
+		 * need to again.
+		 */
+		uint64_t one = 1;
+		if (write(mb->notify_fd, &one, sizeof(one)) < 0) {
+			gbcc_log_error("Failed to signal new frame.\n");
+		}
+	}
+}
+
+void gbcc_mailbox_set_notify(struct gbcc_mailbox *mb, int fd)
+{
+	mb->notify_fd = fd;
+}
+
+void gbcc_mailbox_wait(struct gbcc_mailbox *mb)
+{
+	/*
+	 * The consumer posts once per frame it takes, so spurious wakeups
+	 * from frames taken while we weren't waiting are possible, hence
+	 * checking the flag itself.
+	 */
+	while (atomic_load_explicit(&mb->middle, memory_order_acquire) & MAILBOX_NEW) {
+		if (atomic_load(&mb->closed)) {
+			return;
+		}
+		sem_wait(&mb->consumed);
+	}
+}
+
+const struct gbcc_frame *gbcc_mailbox_acquire(struct gbcc_mailbox *mb, bool *fresh)
+{
+	bool new_frame = atomic_load_explicit(&mb->middle, memory_order_relaxed) & MAILBOX_NEW;
+	if (new_frame) {
+		/* Only we clear the flag, so it's still set here */
+		uint8_t old = atomic_exchange_explicit(&mb->middle,
+				mb->front,
+				memory_order_acq_rel);
+		mb->front = old & MAILBOX_INDEX;
+		sem_post(&mb->consumed);
+	}
+	if (fresh) {
+		*fresh = new_frame;
+	}
+	return &mb->frames[mb->front];
+}
+
+bool gbcc_mailbox_pending(struct gbcc_mailbox *mb)
+{
+	return atomic_load_explicit(&mb->middle, memory_order_relaxed) & MAILBOX_NEW;
+}
+
+void gbcc_mailbox_close(struct gbcc_mailbox *mb)
+{
+	atomic_store(&mb->closed, true);
+	sem_post(&mb->consumed);
+}
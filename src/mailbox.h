@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#ifndef GBCC_MAILBOX_H
+#define GBCC_MAILBOX_H
+
+#include "pixel.h"
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+struct gbcc_frame {
+	void *pixels;
+	uint64_t number;
+	struct timespec timestamp;	/* CLOCK_MONOTONIC time of publishing */
+	/*
+	 * Indexed frames only, NULL otherwise: the palette of each line, and a
+	 * version which only matches another frame's if the palettes do too.
+	 */
+	uint32_t (*palette)[GBCC_PIXEL_PALETTE_SIZE];
+	uint64_t palette_version;
+};
+
+/*
+ * Lock-free triple buffer for passing frames from the emulation thread to the
+ * render thread. The producer always owns the back frame, and the consumer
+ * the front frame. The middle frame is swapped with either of them by a
+ * single atomic exchange, and is flagged when it holds an unread frame.
+ */
+struct gbcc_mailbox {
+	struct gbcc_frame frames[3];
+	uint8_t back;
+	uint8_t front;
+	_Atomic uint8_t middle;
+	atomic_bool closed;
+	sem_t consumed;
+	int notify_fd;	/* eventfd written when a frame arrives, or -1 */
+};
+
+bool gbcc_mailbox_initialise(struct gbcc_mailbox *mb, size_t frame_size);
+void gbcc_mailbox_destroy(struct gbcc_mailbox *mb);
+
+/* Producer side */
+struct gbcc_frame *gbcc_mailbox_back(struct gbcc_mailbox *mb);
+void gbcc_mailbox_publish(struct gbcc_mailbox *mb, uint64_t number);
+void gbcc_mailbox_wait(struct gbcc_mailbox *mb);
+
+/*
+ * Have the producer signal an eventfd whenever a frame is published into an
+ * empty mailbox, so the consumer can sleep in poll() until there's one.
+ * Must be set before the producer starts.
+ */
+void gbcc_mailbox_set_notify(struct gbcc_mailbox *mb, int fd);
+
+/*
+ * Consumer side. Returns the most recent complete frame, which stays valid
+ * until the next call. fresh is set if it hasn't been returned before.
+ */
+const struct gbcc_frame *gbcc_mailbox_acquire(struct gbcc_mailbox *mb, bool *fresh);
+
+/* Whether acquiring now would return a fresh frame */
+bool gbcc_mailbox_pending(struct gbcc_mailbox *mb);
+
+/* Stop the producer from waiting on the consumer, e.g. when quitting */
+void gbcc_mailbox_close(struct gbcc_mailbox *mb);
+
+#endif /* GBCC_MAILBOX_H */
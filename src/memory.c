@@ -10,6 +10,7 @@
 
 #include "core.h"
 #include "apu.h"
+#include "apu_log.h"
 #include "bit_utils.h"
 #include "debug.h"
 #include "gbcc.h"
@@ -98,6 +99,19 @@ static void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val);
 static uint8_t hram_read(struct gbcc_core *gbc, uint16_t addr);
 static void hram_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val);
 
+void gbcc_memory_init_mode(struct gbcc_core *gbc)
+{
+	for (size_t i = 0; i < IOREG_SIZE; i++) {
+		uint8_t mode_mask = 0xFFu;
+		/* Ignore GBC-specific registers when in DMG mode */
+		if (gbc->mode == DMG) {
+			mode_mask = (uint8_t)~ioreg_dmg_masks[i];
+		}
+		gbc->memory.ioreg_read_masks[i] = ioreg_read_masks[i] & mode_mask;
+		gbc->memory.ioreg_write_masks[i] = ioreg_write_masks[i] & mode_mask;
+	}
+}
+
 void gbcc_memory_increment(struct gbcc_core *gbc, uint16_t addr)
 {
 	gbcc_memory_write(gbc, addr, gbcc_memory_read(gbc, addr) + 1);
@@ -204,6 +218,7 @@ ANDROID_INLINE
 void gbcc_memory_write_force(struct gbcc_core *gbc, uint16_t addr, uint8_t val) {
 	if (addr >= OAM_START && addr < OAM_END) {
 		gbc->memory.oam[addr - OAM_START] = val;
+		gbc->ppu.oam_dirty = true;
 	} else if (addr >= IOREG_START && addr < IOREG_END) {
 		gbc->memory.ioreg[addr - IOREG_START] = val;
 	} else {
@@ -331,6 +346,7 @@ void oam_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 		return;
 	}
 	gbc->memory.oam[addr - OAM_START] = val;
+	gbc->ppu.oam_dirty = true;
 }
 
 uint8_t unused_read(struct gbcc_core *gbc, uint16_t addr)
@@ -355,21 +371,16 @@ void unused_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 
 uint8_t ioreg_read(struct gbcc_core *gbc, uint16_t addr)
 {
-	uint8_t mask = ioreg_read_masks[addr - IOREG_START];
+	uint8_t mask = gbc->memory.ioreg_read_masks[addr - IOREG_START];
 	uint8_t ret = gbc->memory.ioreg[addr - IOREG_START];
 
-	/* Ignore GBC-specific registers when in DMG mode */
-	if (gbc->mode == DMG) {
-		mask &= ~ioreg_dmg_masks[addr - IOREG_START];
-	}
-
-
 	if (addr >= WAVE_START && addr < WAVE_END) {
 		/*
 		 * When the wave channel is enabled, accessing any wave RAM
 		 * accesses the current byte.
 		 */
 		if (gbc->apu.ch3.enabled) {
+			gbcc_apu_catch_up(gbc);
 			return gbc->memory.ioreg[gbc->apu.wave.addr - IOREG_START];
 		}
 	}
@@ -441,14 +452,18 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 	*/
 
 	uint8_t *dest = &gbc->memory.ioreg[addr - IOREG_START];
-	uint8_t mask = ioreg_write_masks[addr - IOREG_START];
-	/* Ignore GBC-specific registers when in DMG mode */
-	if (gbc->mode == DMG) {
-		mask &= ~ioreg_dmg_masks[addr - IOREG_START];
-	}
+	uint8_t mask = gbc->memory.ioreg_write_masks[addr - IOREG_START];
 	uint8_t tmp = *dest & (uint8_t)~mask;
 	
+	if (gbc->apu.output.log && (addr == DIV
+				|| (addr >= NR10 && addr <= NR52)
+				|| (addr >= WAVE_START && addr < WAVE_END))) {
+		gbcc_apu_log_write(gbc, addr, val);
+	}
+
 	if (addr >= WAVE_START && addr < WAVE_END) {
+		/* The wave channel must have read the old samples first */
+		gbcc_apu_catch_up(gbc);
 		/*
 		 * When the wave channel is enabled, accessing any wave RAM
 		 * accesses the current byte.
@@ -611,10 +626,17 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 		case RP:
 			/* TODO: Handle */
 			break;
+		case BGP:
+		case OBP0:
+		case OBP1:
+			*dest = tmp | (uint8_t)(val & mask);
+			gbcc_ppu_refresh_palette(gbc, addr, 0);
+			break;
 		case BGPD:
 			{
 				uint8_t index = gbc->memory.ioreg[BGPI - IOREG_START];
 				gbc->ppu.bgp[index & 0x3Fu] = val;
+				gbcc_ppu_refresh_palette(gbc, BGPD, index);
 				if (check_bit(index, 7)) {
 					index++;
 					if ((index & 0x7Fu) == 0x40u) {
@@ -628,6 +650,7 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 			{
 				uint8_t index = gbc->memory.ioreg[OBPI - IOREG_START];
 				gbc->ppu.obp[index & 0x3Fu] = val;
+				gbcc_ppu_refresh_palette(gbc, OBPD, index);
 				if (check_bit(index, 7)) {
 					index++;
 					if ((index & 0x7Fu) == 0x40u) {
@@ -15,6 +15,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+void gbcc_memory_init_mode(struct gbcc_core *gbc);
 void gbcc_memory_increment(struct gbcc_core *gbc, uint16_t addr);
 void gbcc_memory_copy(struct gbcc_core *gbc, uint16_t src, uint16_t dest);
 void gbcc_memory_set_bit(struct gbcc_core *gbc, uint16_t addr, uint8_t b);
@@ -234,6 +234,7 @@ void toggle_option(struct gbcc *gbc, enum gbcc_key key)
 					p_idx++;
 				}
 				gbc->core.ppu.palette = gbcc_get_palette_by_index(p_idx % GBCC_NUM_PALETTES);
+				gbcc_ppu_refresh_palettes(&gbc->core);
 			}
 			break;
 		case GBCC_MENU_ENTRY_CHEATS:
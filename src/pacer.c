@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#include "pacer.h"
+#include "debug.h"
+#include "time_diff.h"
+#include <errno.h>
+
+/* Default for how far behind we can get before giving up on catching up */
+#define MAX_LAG (SECOND / 10)
+
+static void timespec_add(struct timespec *ts, uint64_t ns);
+static bool timespec_before(const struct timespec *a, const struct timespec *b);
+
+void gbcc_pacer_initialise(struct gbcc_pacer *pacer, uint64_t slice, enum gbcc_pacer_policy policy)
+{
+	*pacer = (struct gbcc_pacer){0};
+	pacer->slice = slice;
+	pacer->max_lag = MAX_LAG;
+	pacer->policy = policy;
+}
+
+void gbcc_pacer_reset(struct gbcc_pacer *pacer)
+{
+	pacer->started = false;
+	pacer->pending = 0;
+}
+
+void gbcc_pacer_advance(struct gbcc_pacer *pacer, double ns)
+{
+	pacer->pending += ns;
+	if (pacer->pending < (double)pacer->slice) {
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!pacer->started) {
+		/* Nothing to wait for yet, the schedule starts from here */
+		pacer->deadline = now;
+		pacer->pending = 0;
+		pacer->started = true;
+		return;
+	}
+	uint64_t whole = (uint64_t)pacer->pending;
+	pacer->pending -= (double)whole;
+	timespec_add(&pacer->deadline, whole);
+	pacer->stats.slices++;
+
+	if (!timespec_before(&now, &pacer->deadline)) {
+		pacer->stats.late++;
+		uint64_t lag = gbcc_time_diff(&now, &pacer->deadline);
+		if (pacer->policy == GBCC_PACER_SKIP || lag > pacer->max_lag) {
+			pacer->deadline = now;
+			pacer->stats.resyncs++;
+		}
+		return;
+	}
+
+	int err;
+	do {
+		err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &pacer->deadline, NULL);
+	} while (err == EINTR);
+	if (err) {
+		gbcc_log_error("Failed to sleep: %d\n", err);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (timespec_before(&now, &pacer->deadline)) {
+		pacer->stats.undersleep += gbcc_time_diff(&pacer->deadline, &now);
+	} else {
+		uint64_t over = gbcc_time_diff(&now, &pacer->deadline);
+		pacer->stats.oversleep += over;
+		if (over > pacer->stats.max_oversleep) {
+			pacer->stats.max_oversleep = over;
+		}
+	}
+}
+
+void gbcc_pacer_log_stats(const struct gbcc_pacer *pacer, const char *name)
+{
+	const struct gbcc_pacer_stats *stats = &pacer->stats;
+	if (stats->slices == 0) {
+		return;
+	}
+	uint64_t slept = stats->slices - stats->late;
+	gbcc_log_debug("%s pacing: %llu slices, %llu late, %llu resyncs, "
+			"oversleep %llu us mean / %llu us max, undersleep %llu us total.\n",
+			name,
+			(unsigned long long)stats->slices,
+			(unsigned long long)stats->late,
+			(unsigned long long)stats->resyncs,
+			(unsigned long long)(slept ? stats->oversleep / slept / 1000 : 0),
+			(unsigned long long)(stats->max_oversleep / 1000),
+			(unsigned long long)(stats->undersleep / 1000));
+}
+
+void timespec_add(struct timespec *ts, uint64_t ns)
+{
+	ns += (uint64_t)ts->tv_nsec;
+	ts->tv_sec += (time_t)(ns / SECOND);
+	ts->tv_nsec = (long)(ns % SECOND);
+}
+
+bool timespec_before(const struct timespec *a, const struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec) {
+		return a->tv_sec < b->tv_sec;
+	}
+	return a->tv_nsec < b->tv_nsec;
+}
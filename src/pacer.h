@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#ifndef GBCC_PACER_H
+#define GBCC_PACER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+enum gbcc_pacer_policy {
+	GBCC_PACER_CATCH_UP,	/* Run without sleeping until back on schedule */
+	GBCC_PACER_SKIP		/* Forget any lost time and carry on from now */
+};
+
+struct gbcc_pacer_stats {
+	uint64_t slices;
+	uint64_t late;		/* Slices which were already overdue */
+	uint64_t resyncs;	/* Times the schedule was restarted from now */
+	uint64_t oversleep;	/* Total ns woken after a deadline */
+	uint64_t max_oversleep;
+	uint64_t undersleep;	/* Total ns woken before a deadline */
+};
+
+/*
+ * Keeps work in step with CLOCK_MONOTONIC, which unlike the realtime clock
+ * doesn't jump with NTP or count time spent suspended. Work is accounted in
+ * nanoseconds of the time it represents, and once a slice's worth has been
+ * done, we sleep until an absolute deadline. Deadlines follow on from each
+ * other, so errors in waking up don't accumulate.
+ */
+struct gbcc_pacer {
+	uint64_t slice;		/* ns of work between sleeps */
+	uint64_t max_lag;	/* Lag after which time is dropped under any policy */
+	enum gbcc_pacer_policy policy;
+	struct timespec deadline;
+	double pending;		/* ns of work done since the last deadline */
+	bool started;
+	struct gbcc_pacer_stats stats;
+};
+
+void gbcc_pacer_initialise(struct gbcc_pacer *pacer, uint64_t slice, enum gbcc_pacer_policy policy);
+
+/* Account for ns worth of work, sleeping if that completes a slice */
+void gbcc_pacer_advance(struct gbcc_pacer *pacer, double ns);
+
+/* Start a new schedule from the next call, e.g. after running unpaced */
+void gbcc_pacer_reset(struct gbcc_pacer *pacer);
+
+void gbcc_pacer_log_stats(const struct gbcc_pacer *pacer, const char *name);
+
+#endif /* GBCC_PACER_H */
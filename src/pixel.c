@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#include "pixel.h"
+#include <string.h>
+
+size_t gbcc_pixel_size(enum gbcc_pixel_format format)
+{
+	switch (format) {
+		case GBCC_PIXEL_RGBA8888:
+		case GBCC_PIXEL_XRGB8888:
+			return sizeof(uint32_t);
+		case GBCC_PIXEL_RGB565:
+			return sizeof(uint16_t);
+		case GBCC_PIXEL_INDEXED8:
+			return sizeof(uint8_t);
+	}
+	return sizeof(uint32_t);
+}
+
+uint32_t gbcc_pixel_pack(enum gbcc_pixel_format format, uint32_t rgba)
+{
+	uint8_t r = (rgba >> 24u) & 0xFFu;
+	uint8_t g = (rgba >> 16u) & 0xFFu;
+	uint8_t b = (rgba >> 8u) & 0xFFu;
+	uint8_t a = rgba & 0xFFu;
+	switch (format) {
+		case GBCC_PIXEL_RGBA8888:
+			{
+				/* Byte order, regardless of host endianness */
+				const uint8_t bytes[4] = {r, g, b, a};
+				uint32_t res;
+				memcpy(&res, bytes, sizeof(res));
+				return res;
+			}
+		case GBCC_PIXEL_XRGB8888:
+			return (uint32_t)a << 24u
+				| (uint32_t)r << 16u
+				| (uint32_t)g << 8u
+				| (uint32_t)b;
+		case GBCC_PIXEL_RGB565:
+			return (uint32_t)(r >> 3u) << 11u
+				| (uint32_t)(g >> 2u) << 5u
+				| (uint32_t)(b >> 3u);
+		case GBCC_PIXEL_INDEXED8:
+			return GBCC_PIXEL_INDEX_WHITE;
+	}
+	return rgba;
+}
+
+uint32_t gbcc_pixel_unpack(enum gbcc_pixel_format format, const void *buffer, size_t index)
+{
+	switch (format) {
+		case GBCC_PIXEL_RGBA8888:
+			{
+				const uint8_t *bytes = (const uint8_t *)buffer + 4 * index;
+				return (uint32_t)bytes[0] << 24u
+					| (uint32_t)bytes[1] << 16u
+					| (uint32_t)bytes[2] << 8u
+					| (uint32_t)bytes[3];
+			}
+		case GBCC_PIXEL_XRGB8888:
+			{
+				uint32_t p = ((const uint32_t *)buffer)[index];
+				return (p << 8u) | (p >> 24u);
+			}
+		case GBCC_PIXEL_RGB565:
+			{
+				uint16_t p = ((const uint16_t *)buffer)[index];
+				/* Replicate the top bits to fill the low bits */
+				uint32_t r = (p >> 11u) & 0x1Fu;
+				uint32_t g = (p >> 5u) & 0x3Fu;
+				uint32_t b = p & 0x1Fu;
+				r = (r << 3u) | (r >> 2u);
+				g = (g << 2u) | (g >> 4u);
+				b = (b << 3u) | (b >> 2u);
+				return r << 24u | g << 16u | b << 8u | 0xFFu;
+			}
+		case GBCC_PIXEL_INDEXED8:
+			return ((const uint8_t *)buffer)[index];
+	}
+	return 0;
+}
+
+void gbcc_pixel_store(enum gbcc_pixel_format format, void *dest, const uint32_t *src, size_t n)
+{
+	if (format == GBCC_PIXEL_RGB565) {
+		uint16_t *out = dest;
+		for (size_t i = 0; i < n; i++) {
+			out[i] = (uint16_t)src[i];
+		}
+		return;
+	}
+	if (format == GBCC_PIXEL_INDEXED8) {
+		uint8_t *out = dest;
+		for (size_t i = 0; i < n; i++) {
+			out[i] = (uint8_t)src[i];
+		}
+		return;
+	}
+	memcpy(dest, src, n * sizeof(*src));
+}
+
+void gbcc_pixel_fill(enum gbcc_pixel_format format, void *dest, uint32_t pixel, size_t n)
+{
+	if (format == GBCC_PIXEL_RGB565) {
+		uint16_t *out = dest;
+		for (size_t i = 0; i < n; i++) {
+			out[i] = (uint16_t)pixel;
+		}
+		return;
+	}
+	if (format == GBCC_PIXEL_INDEXED8) {
+		memset(dest, (uint8_t)pixel, n);
+		return;
+	}
+	uint32_t *out = dest;
+	for (size_t i = 0; i < n; i++) {
+		out[i] = pixel;
+	}
+}
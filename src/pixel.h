@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#ifndef GBCC_PIXEL_H
+#define GBCC_PIXEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Formats the ppu can write its framebuffer in, so that frontends can upload
+ * or copy frames without any conversion.
+ */
+enum gbcc_pixel_format {
+	GBCC_PIXEL_RGBA8888,	/* R, G, B, A bytes in memory order (GL_RGBA) */
+	GBCC_PIXEL_XRGB8888,	/* Native-endian 0xAARRGGBB words (wl_shm) */
+	GBCC_PIXEL_RGB565,	/* Native-endian 16-bit words */
+	GBCC_PIXEL_INDEXED8	/* Bytes indexing the frame's palette, see below */
+};
+
+/*
+ * Indexed frames come with a palette for each line, as it was when the line
+ * was drawn. Entries are RGBA8888: the 8 background palettes then the 8
+ * sprite palettes, 4 colours each (in DMG mode, BGP is background palette 0,
+ * and OBP0 & OBP1 sprite palettes 0 & 1), then white. Indices past the end
+ * are white too, so that 0xFF bytes are a blank screen as in other formats.
+ */
+#define GBCC_PIXEL_PALETTE_SIZE 65
+#define GBCC_PIXEL_SPRITE_PALETTES 32
+#define GBCC_PIXEL_INDEX_WHITE 0xFFu
+
+size_t gbcc_pixel_size(enum gbcc_pixel_format format);
+
+/*
+ * Convert a 0xRRGGBBAA colour to the given format, and back again. Indexed
+ * pixels have no fixed colours besides white, so any colour packs to white,
+ * and unpacking gives the index, to look up in the frame's palette.
+ */
+uint32_t gbcc_pixel_pack(enum gbcc_pixel_format format, uint32_t rgba);
+uint32_t gbcc_pixel_unpack(enum gbcc_pixel_format format, const void *buffer, size_t index);
+
+/* Write n packed pixels to a buffer of the given format */
+void gbcc_pixel_store(enum gbcc_pixel_format format, void *dest, const uint32_t *src, size_t n);
+void gbcc_pixel_fill(enum gbcc_pixel_format format, void *dest, uint32_t pixel, size_t n);
+
+#endif /* GBCC_PIXEL_H */
@@ -13,13 +13,18 @@
 #include "colour.h"
 #include "debug.h"
 #include "gbcc.h"
+#include "mailbox.h"
 #include "memory.h"
+#include "nelem.h"
 #include "palettes.h"
+#include "pixel.h"
 #include "ppu.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 #define BACKGROUND_MAP_BANK_1 0x9800u
 #define BACKGROUND_MAP_BANK_2 0x9C00u
@@ -35,37 +40,52 @@
 #define ATTR_COLOUR0 (bit(1))
 #define ATTR_PRIORITY (bit(2))
 
-enum palette_flag { BACKGROUND, SPRITE_1, SPRITE_2 };
-
-static void draw_background_pixel(struct gbcc_core *gbc);
-static void draw_window_pixel(struct gbcc_core *gbc);
-static void draw_sprite_pixel(struct gbcc_core *gbc);
+/*
+ * The renderer is compiled once per cart mode, by passing the mode as a
+ * constant to these always-inlined functions. The mode never changes after
+ * the cartridge is loaded, so this removes all the per-pixel mode checks.
+ */
+#define MODE_SPECIALISED static inline __attribute__((always_inline))
+
+static void ppu_clock_dmg(struct gbcc_core *gbc);
+static void ppu_clock_gbc(struct gbcc_core *gbc);
+MODE_SPECIALISED void ppu_clock(struct gbcc_core *gbc, const enum CART_MODE mode);
+MODE_SPECIALISED void draw_background_pixel(struct gbcc_core *gbc, const enum CART_MODE mode);
+MODE_SPECIALISED void draw_window_pixel(struct gbcc_core *gbc, const enum CART_MODE mode);
+MODE_SPECIALISED void draw_sprite_pixel(struct gbcc_core *gbc);
+MODE_SPECIALISED void rasterise_sprites(struct gbcc_core *gbc, const enum CART_MODE mode);
+static void build_line_sprites(struct gbcc_core *gbc, bool double_size);
 static void composite_line(struct gbcc_core *gbc);
 static uint8_t get_video_mode(uint8_t stat);
 static uint8_t set_video_mode(uint8_t stat, uint8_t mode);
-static uint32_t get_palette_colour(struct gbcc_core *gbc, uint8_t palette, uint8_t n, enum palette_flag pf);
-static void load_bg_tile(struct gbcc_core *gbc);
-static void load_window_tile(struct gbcc_core *gbc);
-static void load_sprite_tile(struct gbcc_core *gbc, int n);
-static uint8_t get_tile_pixel(uint8_t hi, uint8_t lo, uint8_t x, bool flip);
+static void decode_dmg_palette(struct gbcc_core *gbc, uint32_t out[4], uint8_t index, const uint32_t colours[4], uint8_t palette);
+static void decode_gbc_palette(struct gbcc_core *gbc, uint32_t out[4], uint8_t index, const uint8_t data[8]);
+static void set_colour(struct gbcc_core *gbc, uint32_t *out, uint8_t index, uint32_t rgba);
+static void store_line_palette(struct gbcc_core *gbc, uint8_t ly);
+static void publish_frame(struct gbcc_core *gbc);
+MODE_SPECIALISED void load_bg_tile(struct gbcc_core *gbc, const enum CART_MODE mode);
+MODE_SPECIALISED void load_window_tile(struct gbcc_core *gbc, const enum CART_MODE mode);
+MODE_SPECIALISED void load_sprite_tile(struct gbcc_core *gbc, int n, const enum CART_MODE mode);
+MODE_SPECIALISED uint8_t get_tile_pixel(uint8_t hi, uint8_t lo, uint8_t x, bool flip);
 
 void gbcc_disable_lcd(struct gbcc_core *gbc)
 {
 	struct ppu *ppu = &gbc->ppu;
-	if (gbc->mode == GBC) {
-		memset(ppu->screen.sdl, 0xFFu, GBC_SCREEN_SIZE * sizeof(*ppu->screen.buffer_0));
-	} else {
-		uint32_t colour = get_palette_colour(gbc, 0, 0, BACKGROUND);
-		for (int y = 0; y < GBC_SCREEN_HEIGHT; y++) {
-			for (int x = 0; x < GBC_SCREEN_WIDTH; x++) {
-				ppu->screen.sdl[y * GBC_SCREEN_WIDTH + x] = colour;
-			}
+	/* Show a blank frame, and start the next one blank too */
+	for (int i = 0; i < 2; i++) {
+		if (gbc->mode == GBC) {
+			memset(ppu->screen, 0xFFu, GBC_SCREEN_SIZE * gbcc_pixel_size(ppu->format));
+		} else {
+			gbcc_pixel_fill(ppu->format, ppu->screen, ppu->bg_colours[0][0], GBC_SCREEN_SIZE);
 		}
-		for (int y = 0; y < GBC_SCREEN_HEIGHT; y++) {
-			for (int x = 0; x < GBC_SCREEN_WIDTH; x++) {
-				ppu->screen.gbc[y * GBC_SCREEN_WIDTH + x] = colour;
+		if (ppu->format == GBCC_PIXEL_INDEXED8) {
+			for (uint8_t ly = 0; ly < GBC_SCREEN_HEIGHT; ly++) {
+				store_line_palette(gbc, ly);
 			}
 		}
+		if (i == 0) {
+			publish_frame(gbc);
+		}
 	}
 	ppu->lcd_disable = true;
 	ppu->ly = 0;
@@ -95,8 +115,35 @@ void gbcc_enable_lcd(struct gbcc_core *gbc)
 	ppu->clock = 248;
 }
 
+void gbcc_ppu_init_mode(struct gbcc_core *gbc)
+{
+	switch (gbc->mode) {
+		case DMG:
+			gbc->ppu.clock_mode = ppu_clock_dmg;
+			break;
+		case GBC:
+			gbc->ppu.clock_mode = ppu_clock_gbc;
+			break;
+	}
+}
+
 ANDROID_INLINE
 void gbcc_ppu_clock(struct gbcc_core *gbc)
+{
+	gbc->ppu.clock_mode(gbc);
+}
+
+void ppu_clock_dmg(struct gbcc_core *gbc)
+{
+	ppu_clock(gbc, DMG);
+}
+
+void ppu_clock_gbc(struct gbcc_core *gbc)
+{
+	ppu_clock(gbc, GBC);
+}
+
+void ppu_clock(struct gbcc_core *gbc, const enum CART_MODE mode)
 {
 	struct ppu *ppu = &gbc->ppu;
 	if (ppu->lcd_disable) {
@@ -136,24 +183,19 @@ void gbcc_ppu_clock(struct gbcc_core *gbc)
 		 */
 		stat = set_video_mode(stat, GBC_LCD_MODE_OAM_READ);
 
-		ppu->n_sprites = 0;
 		bool double_size = check_bit(ppu->lcdc, 2); /* 8x8 or 8x16 tiles */
-		for (uint16_t addr = OAM_START; addr < OAM_END; addr += 4) {
-			uint8_t y = gbcc_memory_read_force(gbc, addr);
-			uint8_t x = gbcc_memory_read_force(gbc, addr + 1);
-			if (ppu->ly >= y || ppu->ly + 16 < y || (!double_size && ppu->ly + 8 >= y)) {
-				/* Sprite isn't on this line */
-				continue;
-			}
-			ppu->sprites[ppu->n_sprites].y = y;
-			ppu->sprites[ppu->n_sprites].x = x;
-			ppu->sprites[ppu->n_sprites].address = addr;
-			ppu->sprites[ppu->n_sprites].loaded = false;
-			ppu->n_sprites++;
-			/* GameBoy can only draw 10 sprites per line */
-			if (ppu->n_sprites == 10) {
-				break;
-			}
+		if (ppu->oam_dirty || ppu->line_sprites_double != double_size) {
+			build_line_sprites(gbc, double_size);
+		}
+		ppu->n_sprites = 0;
+		if (ppu->ly < GBC_SCREEN_HEIGHT) {
+			ppu->n_sprites = ppu->line_n_sprites[ppu->ly];
+		}
+		for (uint8_t i = 0; i < ppu->n_sprites; i++) {
+			uint8_t n = ppu->line_sprites[ppu->ly][i];
+			ppu->sprites[i].y = gbc->memory.oam[4 * n];
+			ppu->sprites[i].x = gbc->memory.oam[4 * n + 1];
+			ppu->sprites[i].address = OAM_START + 4 * n;
 		}
 	}
 	if (ppu->clock == 81 && get_video_mode(stat) != GBC_LCD_MODE_VBLANK) {
@@ -168,7 +210,7 @@ void gbcc_ppu_clock(struct gbcc_core *gbc)
 		/* Start the actual rendering of this line */
 		stat = set_video_mode(stat, GBC_LCD_MODE_OAM_VRAM_READ);
 		ppu->x = 0;
-		load_bg_tile(gbc);
+		load_bg_tile(gbc, mode);
 		/*
 		 * Rendering at the beginning of a scanline pauses if
 		 * SCX % 8 != 0, while the ppu discards offscreen pixels
@@ -183,6 +225,7 @@ void gbcc_ppu_clock(struct gbcc_core *gbc)
 		ppu->next_dot = 94 + ppu->scx % 8;
 		ppu->bg_tile.x = ppu->scx % 8;
 		ppu->window_tile.x = 0;
+		rasterise_sprites(gbc, mode);
 	}
 	if (get_video_mode(stat) == GBC_LCD_MODE_OAM_VRAM_READ) {
 		if (ppu->x == 160) {
@@ -192,8 +235,8 @@ void gbcc_ppu_clock(struct gbcc_core *gbc)
 				gbc->hdma.to_copy = 0x10u;
 			}
 		} else if (ppu->clock == ppu->next_dot) {
-			draw_background_pixel(gbc);
-			draw_window_pixel(gbc);
+			draw_background_pixel(gbc, mode);
+			draw_window_pixel(gbc, mode);
 			draw_sprite_pixel(gbc);
 			ppu->x++;
 			ppu->next_dot++;
@@ -229,14 +272,11 @@ void gbcc_ppu_clock(struct gbcc_core *gbc)
 		stat = set_video_mode(stat, GBC_LCD_MODE_VBLANK);
 
 		if (gbc->sync_to_video && !gbc->keys.turbo) {
-			sem_wait(&ppu->vsync_semaphore);
+			gbcc_mailbox_wait(ppu->mailbox);
 		}
 
-		uint32_t *tmp = ppu->screen.gbc;
-		ppu->screen.gbc = ppu->screen.sdl;
-		ppu->screen.sdl = tmp;
-
 		ppu->frame++;
+		publish_frame(gbc);
 
 		/*
 		 * Apparently, the window "remembers" how many lines it drew
@@ -295,22 +335,17 @@ void gbcc_ppu_clock(struct gbcc_core *gbc)
 }
 
 /* TODO: GBC BG-to-OAM Priority */
-void draw_background_pixel(struct gbcc_core *gbc)
+void draw_background_pixel(struct gbcc_core *gbc, const enum CART_MODE mode)
 {
 	struct ppu *ppu = &gbc->ppu;
 	struct tile *t = &ppu->bg_tile;
 	if (t->x == 0) {
-		load_bg_tile(gbc);
+		load_bg_tile(gbc, mode);
 	}
 
 	uint8_t colour = get_tile_pixel(t->hi, t->lo, t->x, check_bit(t->attr, 5));
-	uint8_t palette;
-	if (gbc->mode == DMG) {
-		palette = gbcc_memory_read_force(gbc, BGP);
-	} else {
-		palette = t->attr & 0x07u;
-	}
-	ppu->bg_line.colour[ppu->x] = get_palette_colour(gbc, palette, colour, BACKGROUND);
+	/* DMG tiles have no attributes, so always use palette 0 (BGP) */
+	ppu->bg_line.colour[ppu->x] = ppu->bg_colours[t->attr & 0x07u][colour];
 
 	uint8_t attr = ATTR_DRAWN;
 	if (colour == 0) {
@@ -324,12 +359,12 @@ void draw_background_pixel(struct gbcc_core *gbc)
 	t->x %= 8;
 }
 
-void draw_window_pixel(struct gbcc_core *gbc)
+void draw_window_pixel(struct gbcc_core *gbc, const enum CART_MODE mode)
 {
 	struct ppu *ppu = &gbc->ppu;
 	struct tile *t = &ppu->window_tile;
 
-	if (ppu->ly < ppu->wy || !check_bit(ppu->lcdc, 5) || (gbc->mode == DMG && !check_bit(ppu->lcdc, 0))) {
+	if (ppu->ly < ppu->wy || !check_bit(ppu->lcdc, 5) || (mode == DMG && !check_bit(ppu->lcdc, 0))) {
 		return;
 	}
 	if (ppu->x + 7 < ppu->wx) {
@@ -340,7 +375,7 @@ void draw_window_pixel(struct gbcc_core *gbc)
 		ppu->window_ly++;
 	}
 	if (t->x == 0) {
-		load_window_tile(gbc);
+		load_window_tile(gbc, mode);
 		if (ppu->x == 0) {
 			/* Skip pixels to make wx=7 be at x=0 */
 			t->x += (7 - ppu->wx);
@@ -348,13 +383,7 @@ void draw_window_pixel(struct gbcc_core *gbc)
 	}
 
 	uint8_t colour = get_tile_pixel(t->hi, t->lo, t->x, check_bit(t->attr, 5));
-	uint8_t palette;
-	if (gbc->mode == DMG) {
-		palette = gbcc_memory_read_force(gbc, BGP);
-	} else {
-		palette = t->attr & 0x07u;
-	}
-	ppu->window_line.colour[ppu->x] = get_palette_colour(gbc, palette, colour, BACKGROUND);
+	ppu->window_line.colour[ppu->x] = ppu->bg_colours[t->attr & 0x07u][colour];
 	uint8_t attr = ATTR_DRAWN;
 	if (colour == 0) {
 		attr |= ATTR_COLOUR0;
@@ -370,67 +399,119 @@ void draw_window_pixel(struct gbcc_core *gbc)
 void draw_sprite_pixel(struct gbcc_core *gbc)
 {
 	struct ppu *ppu = &gbc->ppu;
-	if (!check_bit(ppu->lcdc, 1)) {
-		/* Sprites are disabled */
-		return;
-	}
+	struct sprite_line_buffer *line = &ppu->sprite_line;
+	uint8_t x = ppu->x;
 	if (gbc->cpu.dma.running) {
 		/* Sprites are disabled while DMA is running*/
+		line->attr[x] = 0;
 		return;
 	}
-	for (int i = 0; i < ppu->n_sprites; i++) {
-		struct sprite *s = &ppu->sprites[i];
-		if (ppu->x + 8 < s->x || ppu->x >= s->x) {
-			continue;
-		}
-		if (ppu->sprite_line.attr[ppu->x] & ATTR_DRAWN) {
-			/* On the GBC, sprites earlier in OAM have priority */
-			/* 
-			 * TODO: On DMG, the sprite with the lowest x should
-			 * have priority
-			 */
-			continue;
-		}
-		if (!s->loaded) {
-			load_sprite_tile(gbc, i);
-			/*
-			 * Each new sprite causes a delay in rendering
-			 * depending on its position over the background.
-			 * TODO: This should take a different amount of time
-			 * when drawing over the window - ppu->scx should be
-			 * replaced with (255 - ppu->wx)
-			 */
-			ppu->next_dot += 11 - MIN(5, (ppu->x + ppu->scx) % 8);
+	/*
+	 * Each new sprite causes a delay in rendering depending on its
+	 * position over the background.
+	 */
+	ppu->next_dot += line->penalty[x];
+	if (line->attr[x] & ATTR_DRAWN) {
+		line->colour[x] = ppu->ob_colours[line->palette[x]][line->index[x]];
+	}
+}
+
+/*
+ * Draw all of this line's sprites into the sprite line buffer at the start of
+ * mode 3. Colours are looked up per-pixel in draw_sprite_pixel(), so that
+ * palette changes mid-line still take effect.
+ */
+void rasterise_sprites(struct gbcc_core *gbc, const enum CART_MODE mode)
+{
+	struct ppu *ppu = &gbc->ppu;
+	struct sprite_line_buffer *line = &ppu->sprite_line;
+	memset(line->penalty, 0, sizeof(line->penalty));
+	if (!check_bit(ppu->lcdc, 1)) {
+		/* Sprites are disabled */
+		return;
+	}
+
+	/*
+	 * On the GBC, sprites earlier in OAM have priority. On the DMG, the
+	 * sprite with the lowest x has priority, followed by OAM order.
+	 */
+	uint8_t order[N_ELEM(ppu->sprites)];
+	for (uint8_t i = 0; i < ppu->n_sprites; i++) {
+		uint8_t j = i;
+		if (mode == DMG) {
+			while (j > 0 && ppu->sprites[order[j - 1]].x > ppu->sprites[i].x) {
+				order[j] = order[j - 1];
+				j--;
+			}
 		}
-		uint8_t x = ppu->x + 8 - s->x;
-		uint8_t colour = get_tile_pixel(s->tile.hi, s->tile.lo, x, check_bit(s->tile.attr, 5));
-		/* Colour 0 is transparent */
-		if (!colour) {
+		order[j] = i;
+	}
+
+	for (uint8_t i = 0; i < ppu->n_sprites; i++) {
+		struct sprite *s = &ppu->sprites[order[i]];
+		if (s->x == 0 || s->x >= GBC_SCREEN_WIDTH + 8) {
+			/* Sprite is entirely offscreen */
 			continue;
 		}
+		load_sprite_tile(gbc, order[i], mode);
+		int start = s->x - 8;
+		uint8_t first = (uint8_t)MAX(start, 0);
+		/*
+		 * TODO: This should take a different amount of time when
+		 * drawing over the window - ppu->scx should be replaced with
+		 * (255 - ppu->wx)
+		 */
+		line->penalty[first] += 11 - MIN(5, (first + ppu->scx) % 8);
+
 		uint8_t palette;
-		enum palette_flag pf;
-		if (gbc->mode == DMG) {
-			if (check_bit(s->tile.attr, 4)) {
-				palette = gbcc_memory_read_force(gbc, OBP1);
-				pf = SPRITE_1;
-			} else {
-				palette = gbcc_memory_read_force(gbc, OBP0);
-				pf = SPRITE_2;
-			}
+		if (mode == DMG) {
+			palette = check_bit(s->tile.attr, 4);
 		} else {
 			palette = s->tile.attr & 0x07u;
-			pf = SPRITE_1;
 		}
-		ppu->sprite_line.colour[ppu->x] = get_palette_colour(gbc, palette, colour, pf);
 		uint8_t attr = ATTR_DRAWN;
 		if (check_bit(s->tile.attr, 7)) {
 			attr |= ATTR_PRIORITY;
 		}
-		ppu->sprite_line.attr[ppu->x] = attr;
+		bool flip = check_bit(s->tile.attr, 5);
+		for (uint8_t x = first; x < s->x && x < GBC_SCREEN_WIDTH; x++) {
+			if (line->attr[x] & ATTR_DRAWN) {
+				continue;
+			}
+			uint8_t colour = get_tile_pixel(s->tile.hi, s->tile.lo, (uint8_t)(x - start), flip);
+			/* Colour 0 is transparent */
+			if (!colour) {
+				continue;
+			}
+			line->index[x] = colour;
+			line->palette[x] = palette;
+			line->attr[x] = attr;
+		}
 	}
 }
 
+/*
+ * Work out which sprites are on each line, in OAM order. The GameBoy can
+ * only draw 10 sprites per line.
+ */
+void build_line_sprites(struct gbcc_core *gbc, bool double_size)
+{
+	struct ppu *ppu = &gbc->ppu;
+	memset(ppu->line_n_sprites, 0, sizeof(ppu->line_n_sprites));
+	for (uint8_t n = 0; n < OAM_SIZE / 4; n++) {
+		int y = gbc->memory.oam[4 * n];
+		int top = MAX(y - 16, 0);
+		int bottom = MIN(double_size ? y : y - 8, GBC_SCREEN_HEIGHT);
+		for (int ly = top; ly < bottom; ly++) {
+			if (ppu->line_n_sprites[ly] < N_ELEM(ppu->line_sprites[ly])) {
+				ppu->line_sprites[ly][ppu->line_n_sprites[ly]++] = n;
+			}
+		}
+	}
+	ppu->line_sprites_double = double_size;
+	ppu->oam_dirty = false;
+}
+
 void composite_line(struct gbcc_core *gbc)
 {
 	/* 
@@ -443,12 +524,12 @@ void composite_line(struct gbcc_core *gbc)
 	 */
 	struct ppu *ppu = &gbc->ppu;
 	uint8_t ly = ppu->ly;
-	uint32_t *line = &ppu->screen.gbc[ly * GBC_SCREEN_WIDTH];
+	uint32_t line[GBC_SCREEN_WIDTH];
 
 	if (!gbc->hide_background) {
-		memcpy(line, ppu->bg_line.colour, GBC_SCREEN_WIDTH * sizeof(line[0]));
+		memcpy(line, ppu->bg_line.colour, sizeof(line));
 	} else {
-		memset(line, 0xFFu, GBC_SCREEN_WIDTH * sizeof(line[0]));
+		memset(line, 0xFFu, sizeof(line));
 	}
 	for (uint8_t x = 0; x < GBC_SCREEN_WIDTH; x++) {
 		uint8_t bg_attr = ppu->bg_line.attr[x];
@@ -485,6 +566,50 @@ void composite_line(struct gbcc_core *gbc)
 			line[x] = ppu->sprite_line.colour[x];
 		}
 	}
+	size_t offset = (size_t)ly * GBC_SCREEN_WIDTH * gbcc_pixel_size(ppu->format);
+	gbcc_pixel_store(ppu->format, (uint8_t *)ppu->screen + offset, line, GBC_SCREEN_WIDTH);
+	if (ppu->format == GBCC_PIXEL_INDEXED8) {
+		store_line_palette(gbc, ly);
+	}
+}
+
+/*
+ * Indexed lines are only coloured in by the renderer, so keep the palette as
+ * it is now with the line. Unlike other formats, this means a palette change
+ * part way through a line affects all of it.
+ */
+void store_line_palette(struct gbcc_core *gbc, uint8_t ly)
+{
+	struct ppu *ppu = &gbc->ppu;
+	struct gbcc_frame *frame = gbcc_mailbox_back(ppu->mailbox);
+	memcpy(frame->palette[ly], ppu->palette_colours, sizeof(frame->palette[ly]));
+	if (!ppu->frame_palette_drawn) {
+		ppu->frame_palette_first = ppu->palette_version;
+		ppu->frame_palette_drawn = true;
+	}
+	ppu->frame_palette_last = ppu->palette_version;
+}
+
+/* Hand the back frame over to the renderer, and start drawing the next */
+void publish_frame(struct gbcc_core *gbc)
+{
+	struct ppu *ppu = &gbc->ppu;
+	if (ppu->format == GBCC_PIXEL_INDEXED8) {
+		struct gbcc_frame *frame = gbcc_mailbox_back(ppu->mailbox);
+		if (ppu->frame_palette_drawn && ppu->frame_palette_first == ppu->frame_palette_last) {
+			frame->palette_version = ppu->frame_palette_last;
+		} else {
+			/*
+			 * The lines' palettes differ, so give the frame a
+			 * version of its own, which no line will then have.
+			 */
+			frame->palette_version = ++ppu->palette_version;
+			ppu->palette_version++;
+		}
+		ppu->frame_palette_drawn = false;
+	}
+	gbcc_mailbox_publish(ppu->mailbox, ppu->frame);
+	ppu->screen = gbcc_mailbox_back(ppu->mailbox)->pixels;
 }
 
 uint8_t get_video_mode(uint8_t stat)
@@ -499,52 +624,140 @@ uint8_t set_video_mode(uint8_t stat, uint8_t mode)
 	return stat;
 }
 
-uint32_t get_palette_colour(struct gbcc_core *gbc, uint8_t palette, uint8_t n, enum palette_flag pf)
+bool gbcc_ppu_set_pixel_format(struct gbcc_core *gbc, enum gbcc_pixel_format format)
 {
 	struct ppu *ppu = &gbc->ppu;
+	if (format == GBCC_PIXEL_INDEXED8) {
+		for (size_t i = 0; i < N_ELEM(ppu->mailbox->frames); i++) {
+			struct gbcc_frame *frame = &ppu->mailbox->frames[i];
+			if (frame->palette) {
+				continue;
+			}
+			frame->palette = calloc(GBC_SCREEN_HEIGHT, sizeof(*frame->palette));
+			if (!frame->palette) {
+				gbcc_log_error("Couldn't allocate frame palettes.\n");
+				return false;
+			}
+		}
+	}
+	ppu->format = format;
+	gbcc_ppu_refresh_palettes(gbc);
+	for (size_t i = 0; i < N_ELEM(ppu->mailbox->frames); i++) {
+		struct gbcc_frame *frame = &ppu->mailbox->frames[i];
+		memset(frame->pixels, 0xFFu, GBC_SCREEN_SIZE * gbcc_pixel_size(format));
+		if (format == GBCC_PIXEL_INDEXED8) {
+			for (size_t ly = 0; ly < GBC_SCREEN_HEIGHT; ly++) {
+				memcpy(frame->palette[ly], ppu->palette_colours, sizeof(frame->palette[ly]));
+			}
+			frame->palette_version = ppu->palette_version;
+		}
+	}
+	return true;
+}
+
+void gbcc_ppu_refresh_palettes(struct gbcc_core *gbc)
+{
+	gbc->ppu.palette_colours[GBCC_PIXEL_PALETTE_SIZE - 1] = gbcc_pixel_pack(GBCC_PIXEL_RGBA8888, 0xFFFFFFFFu);
 	if (gbc->mode == DMG) {
-		uint8_t colours[4] = {
-			(palette & 0x03u) >> 0u,
-			(palette & 0x0Cu) >> 2u,
-			(palette & 0x30u) >> 4u,
-			(palette & 0xC0u) >> 6u
-		};
-		switch (pf) {
-			case BACKGROUND:
-				return ppu->palette.background[colours[n]];
-			case SPRITE_1:
-				return ppu->palette.sprite1[colours[n]];
-			case SPRITE_2:
-				return ppu->palette.sprite2[colours[n]];
+		gbcc_ppu_refresh_palette(gbc, BGP, 0);
+		gbcc_ppu_refresh_palette(gbc, OBP0, 0);
+		gbcc_ppu_refresh_palette(gbc, OBP1, 0);
+		return;
+	}
+	for (uint8_t i = 0; i < 8; i++) {
+		gbcc_ppu_refresh_palette(gbc, BGPD, i * 8);
+		gbcc_ppu_refresh_palette(gbc, OBPD, i * 8);
+	}
+}
+
+/*
+ * Recalculate the cached colours affected by a write to a palette register.
+ * For BGPD & OBPD, index is the byte index (BGPI / OBPI) that was written.
+ */
+void gbcc_ppu_refresh_palette(struct gbcc_core *gbc, uint16_t addr, uint8_t index)
+{
+	struct ppu *ppu = &gbc->ppu;
+	uint8_t palette = (index & 0x3Fu) / 8u;
+	ppu->palette_version++;
+	if (gbc->mode == DMG) {
+		switch (addr) {
+			case BGP:
+				decode_dmg_palette(gbc, ppu->bg_colours[0], 0,
+						ppu->palette.background, gbcc_memory_read_force(gbc, BGP));
+				break;
+			case OBP0:
+				decode_dmg_palette(gbc, ppu->ob_colours[0], GBCC_PIXEL_SPRITE_PALETTES,
+						ppu->palette.sprite2, gbcc_memory_read_force(gbc, OBP0));
+				break;
+			case OBP1:
+				decode_dmg_palette(gbc, ppu->ob_colours[1], GBCC_PIXEL_SPRITE_PALETTES + 4,
+						ppu->palette.sprite1, gbcc_memory_read_force(gbc, OBP1));
+				break;
+			default:
+				break;
 		}
+		return;
+	}
+	switch (addr) {
+		case BGPD:
+			decode_gbc_palette(gbc, ppu->bg_colours[palette], palette * 4u, &ppu->bgp[palette * 8]);
+			break;
+		case OBPD:
+			decode_gbc_palette(gbc, ppu->ob_colours[palette],
+					GBCC_PIXEL_SPRITE_PALETTES + palette * 4u, &ppu->obp[palette * 8]);
+			break;
+		default:
+			break;
 	}
-	uint8_t index = palette * 8;
-	uint8_t lo;
-	uint8_t hi;
-	if (pf == BACKGROUND) {
-		lo = ppu->bgp[index + 2 * n];
-		hi = ppu->bgp[index + 2 * n + 1];
+}
+
+/* index is that of the palette's first entry, for indexed frames */
+void decode_dmg_palette(struct gbcc_core *gbc, uint32_t out[4], uint8_t index, const uint32_t colours[4], uint8_t palette)
+{
+	for (uint8_t n = 0; n < 4; n++) {
+		set_colour(gbc, &out[n], index + n, colours[(palette >> (2u * n)) & 0x03u]);
+	}
+}
+
+void decode_gbc_palette(struct gbcc_core *gbc, uint32_t out[4], uint8_t index, const uint8_t data[8])
+{
+	for (uint8_t n = 0; n < 4; n++) {
+		uint8_t lo = data[2 * n];
+		uint8_t hi = data[2 * n + 1];
+		uint8_t r = lo & 0x1Fu;
+		uint8_t g = ((lo & 0xE0u) >> 5u) | (uint8_t)((hi & 0x03u) << 3u);
+		uint8_t b = (hi & 0x7Cu) >> 2u;
+		uint32_t res = 0;
+		if (gbc->colour_correction) {
+			res = gbcc_colour_correct(r, g, b);
+		} else {
+			res |= ((uint32_t)r << 27u);
+			res |= ((uint32_t)g << 19u);
+			res |= ((uint32_t)b << 11u);
+			res |= 0xFFu;
+		}
+		set_colour(gbc, &out[n], index + n, res);
+	}
+}
+
+/* Store a decoded colour as a pixel, or its index if the frame has palettes */
+void set_colour(struct gbcc_core *gbc, uint32_t *out, uint8_t index, uint32_t rgba)
+{
+	struct ppu *ppu = &gbc->ppu;
+	if (ppu->format == GBCC_PIXEL_INDEXED8) {
+		*out = index;
+		ppu->palette_colours[index] = gbcc_pixel_pack(GBCC_PIXEL_RGBA8888, rgba);
 	} else {
-		lo = ppu->obp[index + 2 * n];
-		hi = ppu->obp[index + 2 * n + 1];
-	} 
-	uint8_t r = lo & 0x1Fu;
-	uint8_t g = ((lo & 0xE0u) >> 5u) | (uint8_t)((hi & 0x03u) << 3u);
-	uint8_t b = (hi & 0x7Cu) >> 2u;
-	uint32_t res = 0;
-	res |= ((uint32_t)r << 27u);
-	res |= ((uint32_t)g << 19u);
-	res |= ((uint32_t)b << 11u);
-	res |= 0xFFu;
-
-	return res;
+		*out = gbcc_pixel_pack(ppu->format, rgba);
+	}
 }
 
-void load_bg_tile(struct gbcc_core *gbc)
+void load_bg_tile(struct gbcc_core *gbc, const enum CART_MODE mode)
 {
 	struct ppu *ppu = &gbc->ppu;
+	struct tile *t = &ppu->bg_tile;
 
-	ppu->bg_tile.x = 0;
+	t->x = 0;
 	uint8_t tx = ((ppu->scx + ppu->x) / 8u) % 32u;
 	uint8_t ty = ((ppu->scy + ppu->ly) / 8u) % 32u;
 	uint16_t line_offset = 2 * ((ppu->scy + ppu->ly) % 8u); /* 2 bytes per line */
@@ -554,49 +767,36 @@ void load_bg_tile(struct gbcc_core *gbc)
 	} else {
 		map = BACKGROUND_MAP_BANK_1;
 	}
+	map += 32 * ty + tx - VRAM_START;
 
-	if (gbc->mode == DMG) {
-		uint8_t tile = gbcc_memory_read_force(gbc, map + 32 * ty + tx);
-		uint16_t tile_addr;
-		if (check_bit(ppu->lcdc, 4)) {
-			tile_addr = VRAM_START + 16 * tile;
-		} else {
-			tile_addr = (uint16_t)(0x9000 + 16 * (int8_t)tile);
-		}
-		ppu->bg_tile.lo = gbcc_memory_read_force(gbc, tile_addr + line_offset);
-		ppu->bg_tile.hi = gbcc_memory_read_force(gbc, tile_addr + line_offset + 1);
-		ppu->bg_tile.attr = 0;
+	uint8_t tile = gbc->memory.vram_bank[0][map];
+	/* DMG tiles have no attributes */
+	if (mode == DMG) {
+		t->attr = 0;
 	} else {
-		uint8_t tile = gbc->memory.vram_bank[0][map + 32 * ty + tx - VRAM_START];
-		ppu->bg_tile.attr = gbc->memory.vram_bank[1][map + 32 * ty + tx - VRAM_START];
-		uint8_t *vbk;
-		uint16_t tile_addr;
-		if (check_bit(ppu->bg_tile.attr, 3)) {
-			vbk = gbc->memory.vram_bank[1];
-		} else {
-			vbk = gbc->memory.vram_bank[0];
-		}
-		if (check_bit(ppu->lcdc, 4)) {
-			tile_addr = 16 * tile;
-		} else {
-			tile_addr = (uint16_t)(0x1000 + 16 * (int8_t)tile);
-		}
-		/* Check for Y-flip */
-		if (check_bit(ppu->bg_tile.attr, 6)) {
-			ppu->bg_tile.lo = vbk[tile_addr + (14 - line_offset)];
-			ppu->bg_tile.hi = vbk[tile_addr + (14 - line_offset) + 1];
-		} else {
-			ppu->bg_tile.lo = vbk[tile_addr + line_offset];
-			ppu->bg_tile.hi = vbk[tile_addr + line_offset + 1];
-		}
+		t->attr = gbc->memory.vram_bank[1][map];
+	}
+	const uint8_t *vbk = gbc->memory.vram_bank[check_bit(t->attr, 3)];
+	uint16_t tile_addr;
+	if (check_bit(ppu->lcdc, 4)) {
+		tile_addr = 16 * tile;
+	} else {
+		tile_addr = (uint16_t)(0x1000 + 16 * (int8_t)tile);
+	}
+	/* Check for Y-flip */
+	if (check_bit(t->attr, 6)) {
+		line_offset = 14 - line_offset;
 	}
+	t->lo = vbk[tile_addr + line_offset];
+	t->hi = vbk[tile_addr + line_offset + 1];
 }
 
-void load_window_tile(struct gbcc_core *gbc)
+void load_window_tile(struct gbcc_core *gbc, const enum CART_MODE mode)
 {
 	struct ppu *ppu = &gbc->ppu;
+	struct tile *t = &ppu->window_tile;
 
-	ppu->window_tile.x = 0;
+	t->x = 0;
 	uint8_t tx = ((ppu->x - ppu->wx + 7) / 8u) % 32u;
 	uint8_t ty = (ppu->window_ly / 8u) % 32u;
 	uint16_t line_offset = 2 * (ppu->window_ly % 8u); /* 2 bytes per line */
@@ -606,45 +806,31 @@ void load_window_tile(struct gbcc_core *gbc)
 	} else {
 		map = BACKGROUND_MAP_BANK_1;
 	}
+	map += 32 * ty + tx - VRAM_START;
 
-	if (gbc->mode == DMG) {
-		uint8_t tile = gbcc_memory_read_force(gbc, map + 32 * ty + tx);
-		uint16_t tile_addr;
-		if (check_bit(ppu->lcdc, 4)) {
-			tile_addr = VRAM_START + 16 * tile;
-		} else {
-			tile_addr = (uint16_t)(0x9000 + 16 * (int8_t)tile);
-		}
-		ppu->window_tile.lo = gbcc_memory_read_force(gbc, tile_addr + line_offset);
-		ppu->window_tile.hi = gbcc_memory_read_force(gbc, tile_addr + line_offset + 1);
-		ppu->window_tile.attr = 0;
+	uint8_t tile = gbc->memory.vram_bank[0][map];
+	/* DMG tiles have no attributes */
+	if (mode == DMG) {
+		t->attr = 0;
 	} else {
-		uint8_t tile = gbc->memory.vram_bank[0][map + 32 * ty + tx - VRAM_START];
-		ppu->window_tile.attr = gbc->memory.vram_bank[1][map + 32 * ty + tx - VRAM_START];
-		uint8_t *vbk;
-		uint16_t tile_addr;
-		if (check_bit(ppu->window_tile.attr, 3)) {
-			vbk = gbc->memory.vram_bank[1];
-		} else {
-			vbk = gbc->memory.vram_bank[0];
-		}
-		if (check_bit(ppu->lcdc, 4)) {
-			tile_addr = 16 * tile;
-		} else {
-			tile_addr = (uint16_t)(0x1000 + 16 * (int8_t)tile);
-		}
-		/* Check for Y-flip */
-		if (check_bit(ppu->window_tile.attr, 6)) {
-			ppu->window_tile.lo = vbk[tile_addr + (14 - line_offset)];
-			ppu->window_tile.hi = vbk[tile_addr + (14 - line_offset) + 1];
-		} else {
-			ppu->window_tile.lo = vbk[tile_addr + line_offset];
-			ppu->window_tile.hi = vbk[tile_addr + line_offset + 1];
-		}
+		t->attr = gbc->memory.vram_bank[1][map];
+	}
+	const uint8_t *vbk = gbc->memory.vram_bank[check_bit(t->attr, 3)];
+	uint16_t tile_addr;
+	if (check_bit(ppu->lcdc, 4)) {
+		tile_addr = 16 * tile;
+	} else {
+		tile_addr = (uint16_t)(0x1000 + 16 * (int8_t)tile);
 	}
+	/* Check for Y-flip */
+	if (check_bit(t->attr, 6)) {
+		line_offset = 14 - line_offset;
+	}
+	t->lo = vbk[tile_addr + line_offset];
+	t->hi = vbk[tile_addr + line_offset + 1];
 }
 
-void load_sprite_tile(struct gbcc_core *gbc, int n)
+void load_sprite_tile(struct gbcc_core *gbc, int n, const enum CART_MODE mode)
 {
 	struct ppu *ppu = &gbc->ppu;
 	uint8_t ly = ppu->ly;
@@ -662,7 +848,7 @@ void load_sprite_tile(struct gbcc_core *gbc, int n)
 	bool yflip = check_bit(t->attr, 6);
 	uint8_t sprite_line = sy - ly;
 	uint8_t *vram_bank;
-	if (gbc->mode == DMG) {
+	if (mode == DMG) {
 		vram_bank = gbc->memory.vram_bank[0];
 	} else {
 		vram_bank = gbc->memory.vram_bank[check_bit(t->attr, 3)];
@@ -690,7 +876,6 @@ void load_sprite_tile(struct gbcc_core *gbc, int n)
 	t->lo = vram_bank[16 * tile + 2 * sprite_line];
 	t->hi = vram_bank[16 * tile + 2 * sprite_line + 1];
 	t->x = 0;
-	ppu->sprites[n].loaded = true;
 }
 
 uint8_t get_tile_pixel(uint8_t hi, uint8_t lo, uint8_t x, bool flip)
@@ -13,17 +13,26 @@
 
 #include "constants.h"
 #include "palettes.h"
-#include <semaphore.h>
+#include "pixel.h"
 #include <stdbool.h>
 #include <stdint.h>
 
 struct gbcc_core;
+struct gbcc_mailbox;
 
 struct line_buffer {
 	uint32_t colour[GBC_SCREEN_WIDTH];
 	uint8_t attr[GBC_SCREEN_WIDTH];
 };
 
+struct sprite_line_buffer {
+	uint32_t colour[GBC_SCREEN_WIDTH];
+	uint8_t attr[GBC_SCREEN_WIDTH];
+	uint8_t index[GBC_SCREEN_WIDTH];	/* Colour number in the palette */
+	uint8_t palette[GBC_SCREEN_WIDTH];
+	uint8_t penalty[GBC_SCREEN_WIDTH];	/* Dots spent fetching sprites */
+};
+
 struct tile {
 	uint8_t hi;
 	uint8_t lo;
@@ -36,26 +45,39 @@ struct sprite {
 	uint8_t y;
 	uint16_t address;
 	struct tile tile;
-	bool loaded;
 };
 
 struct ppu {
+	void (*clock_mode)(struct gbcc_core *gbc);	/* Renderer for this cart mode */
 	uint64_t frame;
 	uint32_t clock;
 	bool lcd_disable;
 	uint8_t bgp[64]; 	/* 8 x 8-byte palettes */
 	uint8_t obp[64]; 	/* 8 x 8-byte palettes */
 	struct palette palette;
+	/*
+	 * Decoded colours for each palette, indexed by [palette][colour].
+	 * In DMG mode, bg_colours[0] is BGP, and ob_colours[0] & [1] are
+	 * OBP0 & OBP1. Colours are stored in the framebuffer's pixel format.
+	 */
+	uint32_t bg_colours[8][4];
+	uint32_t ob_colours[8][4];
 	struct line_buffer bg_line;
 	struct line_buffer window_line;
-	struct line_buffer sprite_line;
-	struct {
-		uint32_t *buffer_0;
-		uint32_t *buffer_1;
-		uint32_t *gbc;
-		uint32_t *sdl;
-	} screen;
-	sem_t vsync_semaphore;
+	struct sprite_line_buffer sprite_line;
+	/* Frames are GBC_SCREEN_SIZE pixels in the given format */
+	enum gbcc_pixel_format format;
+	/*
+	 * Indexed frames only: the current colour of each palette entry, and
+	 * a count of changes to them. Each line drawn takes a copy.
+	 */
+	uint32_t palette_colours[GBCC_PIXEL_PALETTE_SIZE];
+	uint64_t palette_version;
+	uint64_t frame_palette_first;	/* Versions at the first & last lines drawn */
+	uint64_t frame_palette_last;
+	bool frame_palette_drawn;	/* Whether any line has been this frame */
+	struct gbcc_mailbox *mailbox;
+	void *screen;	/* Back frame currently being drawn */
 
 	/* Copies of IOREG data */
 	uint8_t scy;
@@ -73,12 +95,28 @@ struct ppu {
 	uint16_t next_dot;
 	uint8_t n_sprites;
 	struct sprite sprites[10];
+	/*
+	 * OAM indices of the sprites on each line, rebuilt whenever OAM or
+	 * the sprite size changes.
+	 */
+	uint8_t line_sprites[GBC_SCREEN_HEIGHT][10];
+	uint8_t line_n_sprites[GBC_SCREEN_HEIGHT];
+	bool line_sprites_double;
+	bool oam_dirty;
 	struct tile bg_tile;
 	struct tile window_tile;
 };
 
+void gbcc_ppu_init_mode(struct gbcc_core *gbc);
 void gbcc_ppu_clock(struct gbcc_core *gbc);
 void gbcc_disable_lcd(struct gbcc_core *gbc);
 void gbcc_enable_lcd(struct gbcc_core *gbc);
+/*
+ * Must be called before the renderer starts taking frames. Returns false if
+ * the frames' palettes couldn't be allocated, leaving the format unchanged.
+ */
+bool gbcc_ppu_set_pixel_format(struct gbcc_core *gbc, enum gbcc_pixel_format format);
+void gbcc_ppu_refresh_palettes(struct gbcc_core *gbc);
+void gbcc_ppu_refresh_palette(struct gbcc_core *gbc, uint16_t addr, uint8_t index);
 
 #endif /* GBCC_PPU_H */
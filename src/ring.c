@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#include "ring.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static void copy(int16_t *dest, const int16_t *src, size_t n);
+
+bool gbcc_ring_initialise(struct gbcc_ring *ring, size_t size)
+{
+	size_t capacity = 1;
+	while (capacity < size) {
+		capacity <<= 1u;
+	}
+	ring->data = calloc(capacity * 2, sizeof(*ring->data));
+	if (!ring->data) {
+		gbcc_log_error("Couldn't allocate audio ring buffer.\n");
+		return false;
+	}
+	ring->size = capacity;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	return true;
+}
+
+void gbcc_ring_destroy(struct gbcc_ring *ring)
+{
+	free(ring->data);
+	ring->data = NULL;
+}
+
+size_t gbcc_ring_write(struct gbcc_ring *ring, const int16_t *src, size_t n)
+{
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	n = MIN(n, ring->size - (head - tail));
+
+	/* Copy in up to two parts, in case we wrap around the end */
+	size_t start = head & (ring->size - 1);
+	size_t first = MIN(n, ring->size - start);
+	copy(&ring->data[start * 2], src, first);
+	copy(ring->data, &src[first * 2], n - first);
+
+	atomic_store_explicit(&ring->head, head + n, memory_order_release);
+	return n;
+}
+
+size_t gbcc_ring_read(struct gbcc_ring *ring, int16_t *dest, size_t n)
+{
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	n = MIN(n, head - tail);
+
+	size_t start = tail & (ring->size - 1);
+	size_t first = MIN(n, ring->size - start);
+	copy(dest, &ring->data[start * 2], first);
+	copy(&dest[first * 2], ring->data, n - first);
+
+	atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+	return n;
+}
+
+size_t gbcc_ring_used(const struct gbcc_ring *ring)
+{
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	return head - tail;
+}
+
+void copy(int16_t *dest, const int16_t *src, size_t n)
+{
+	if (n > 0) {
+		memcpy(dest, src, n * 2 * sizeof(*dest));
+	}
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#ifndef GBCC_RING_H
+#define GBCC_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Lock-free single-producer, single-consumer ring of interleaved stereo
+ * samples. The emulation thread writes and the audio output thread reads,
+ * and neither ever waits on the other.
+ */
+struct gbcc_ring {
+	int16_t *data;
+	size_t size;		/* Capacity in stereo samples, a power of two */
+	atomic_size_t head;	/* Total samples written, only set by the producer */
+	atomic_size_t tail;	/* Total samples read, only set by the consumer */
+};
+
+/* The size is rounded up to the next power of two */
+bool gbcc_ring_initialise(struct gbcc_ring *ring, size_t size);
+void gbcc_ring_destroy(struct gbcc_ring *ring);
+
+/* Both return the number of stereo samples actually copied */
+size_t gbcc_ring_write(struct gbcc_ring *ring, const int16_t *src, size_t n);
+size_t gbcc_ring_read(struct gbcc_ring *ring, int16_t *dest, size_t n);
+
+size_t gbcc_ring_used(const struct gbcc_ring *ring);
+
+#endif /* GBCC_RING_H */
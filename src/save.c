@@ -30,7 +30,6 @@
 static void get_save_basename(struct gbcc *gbc, char savename[MAX_NAME_LEN]);
 static void strip_ext(char *fname);
 static const char *gbcc_basename(const char *fname);
-static bool read_v7_struct(struct gbcc_core *gbc, FILE *f);
 
 void gbcc_save(struct gbcc *gbc)
 {
@@ -210,8 +209,7 @@ void gbcc_load_state(struct gbcc *gbc)
 		return;
 	}
 	rewind(sav);
-	/* Hardcoded check, should be updated when updating the core version */
-	if (old_version != 7 && old_version != core->version) {
+	if (old_version != core->version) {
 		gbcc_log_error("Save state %d version mismatch, tried "
 				"to load v%u (current version is v%u).\n",
 				gbc->load_state,
@@ -232,15 +230,7 @@ void gbcc_load_state(struct gbcc *gbc)
 	}
 
 	struct gbcc_core *tmp_core = calloc(1, sizeof(*tmp_core));
-	bool read_success = false;
-
-	/* Hardcoded check, should be updated when updating the core version */
-	if (old_version == 7 && gbc->core.version == 8) {
-		read_success = read_v7_struct(tmp_core, sav);
-	} else {
-		read_success = (fread(tmp_core, sizeof(struct gbcc_core), 1, sav) == 1);
-	}
-	if (!read_success) {
+	if (fread(tmp_core, sizeof(struct gbcc_core), 1, sav) != 1) {
 		gbcc_log_error("Error reading %s: %s\n", fname, strerror(errno));
 		free(tmp_core);
 		fclose(sav);
@@ -279,13 +269,13 @@ void gbcc_load_state(struct gbcc *gbc)
 	/* No pointers */
 
 	/* apu */
-	/* No pointers */
+	/* Carry on from the levels the blip buffer last heard */
+	tmp_core->apu.output = core->apu.output;
 
 	/* ppu */
-	tmp_core->ppu.screen.buffer_0 = core->ppu.screen.buffer_0;
-	tmp_core->ppu.screen.buffer_1 = core->ppu.screen.buffer_1;
-	tmp_core->ppu.screen.gbc = core->ppu.screen.gbc;
-	tmp_core->ppu.screen.sdl = core->ppu.screen.sdl;
+	gbcc_ppu_init_mode(tmp_core);
+	tmp_core->ppu.mailbox = core->ppu.mailbox;
+	tmp_core->ppu.screen = core->ppu.screen;
 
 	/* cart */
 	/* No pointers in the mbc */
@@ -331,11 +321,19 @@ void gbcc_load_state(struct gbcc *gbc)
 	/* Reset some things that shouldn't be saved */
 	memset(&tmp_core->keys, 0, sizeof(tmp_core->keys));
 	tmp_core->sync_to_video = core->sync_to_video;
+	tmp_core->colour_correction = core->colour_correction;
+	tmp_core->ppu.format = core->ppu.format;
+	/* Kept counting up, so no old frame's palette looks current */
+	tmp_core->ppu.palette_version = core->ppu.palette_version;
+	tmp_core->ppu.frame_palette_first = core->ppu.frame_palette_first;
+	tmp_core->ppu.frame_palette_last = core->ppu.frame_palette_last;
+	tmp_core->ppu.frame_palette_drawn = core->ppu.frame_palette_drawn;
 	tmp_core->error_msg = NULL;
 
 	/* Perform the actual switch */
 	*core = *tmp_core;
 	free(tmp_core);
+	gbcc_ppu_refresh_palettes(core);
 
 	snprintf(tmp, MAX_NAME_LEN, "Loaded state %d", gbc->load_state);
 	gbcc_window_show_message(gbc, tmp, 2, true);
@@ -418,24 +416,3 @@ const char *gbcc_basename(const char *fname)
 	const char *ret = strrchr(fname, PATH_SEP);
 	return ret ? ret + 1 : fname;
 }
-
-/*
- * In-place conversion from the previous core struct version to this one.
- * This is a dirty hack, but the alternative is trusting users to not rely on
- * savestates when upgrading.
- * Proper serialisation of the core struct would be nice....
- * WARNING: This needs to be updated when changing the core version.
- */
-bool read_v7_struct(struct gbcc_core *gbc, FILE *f)
-{
-	/*
-	 * v8 added cheats - luckily we can just ignore the lost values this
-	 * time, as they don't matter, and re-zero the cheats struct.
-	 */
-	size_t old_size = sizeof(*gbc) - sizeof(gbc->cheats);
-	bool success = fread(gbc, old_size, 1, f) == 1;
-	memset(&gbc->cheats, 0, sizeof(gbc->cheats));
-	gbc->version = GBCC_SAVE_STATE_VERSION;
-	gbc->initialised = true;
-	return success;
-}
@@ -0,0 +1,428 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#include "scale.h"
+#include "constants.h"
+#include "debug.h"
+#include "nelem.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* The source, with a border repeating its edges so kernels needn't check */
+#define PAD_WIDTH (GBC_SCREEN_WIDTH + 2)
+#define PAD_HEIGHT (GBC_SCREEN_HEIGHT + 2)
+#define MAX_WIDTH (GBC_SCREEN_WIDTH * GBCC_SCALE_MAX_FACTOR)
+
+/* Dot matrix colours, as 0xRRGGBBAA */
+#define DOT_BACKGROUND 0x639532FFu
+#define DOT_FOREGROUND 0x1C420DFFu
+
+/*
+ * The kernels are written as plain loops over 32-bit pixels, which GCC
+ * vectorises for whatever the target has. As in blip.c, baseline x86-64
+ * lacks the blends & shuffles they need, so build versions for newer CPUs
+ * too and pick at load.
+ */
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define MULTIVERSION __attribute__((target_clones("avx2", "sse4.1", "default")))
+#endif
+#endif
+#ifndef MULTIVERSION
+#define MULTIVERSION
+#endif
+
+/*
+ * Kernels write rows of 32-bit pixels in the destination format. Those go
+ * straight into the destination, unless it has narrower pixels, in which
+ * case they're built up in lines first. Kernels read from padded, a copy of
+ * the source in the destination format.
+ */
+struct target {
+	uint8_t *pixels;
+	size_t stride;
+	size_t width;
+	enum gbcc_pixel_format format;
+	bool narrow;
+	uint32_t lines[3][MAX_WIDTH];
+	uint32_t padded[PAD_WIDTH * PAD_HEIGHT];
+};
+
+static const struct {
+	const char *name;
+	enum gbcc_scaler scaler;
+} names[] = {
+	{"nearest", GBCC_SCALER_NEAREST},
+	{"scale2x", GBCC_SCALER_SCALE2X},
+	{"scale3x", GBCC_SCALER_SCALE3X},
+	{"dotmatrix", GBCC_SCALER_DOT_MATRIX}
+};
+
+static void pad_source(struct target *t, const void *src, enum gbcc_pixel_format src_format);
+static uint32_t *target_row(struct target *t, size_t y);
+static void target_commit(struct target *t, size_t y, const uint32_t *row);
+static void target_copy(struct target *t, size_t from, size_t to);
+static void nearest(struct target *t, unsigned int factor);
+static void scale2x(struct target *t);
+static void scale3x(struct target *t);
+static void dot_matrix(const void *src, enum gbcc_pixel_format src_format, struct target *t, unsigned int factor);
+static void expand_row(uint32_t *restrict out, const uint32_t *restrict in, unsigned int factor);
+static void scale2x_row(uint32_t *restrict out0, uint32_t *restrict out1,
+		const uint32_t *above, const uint32_t *row, const uint32_t *below);
+static void scale3x_row(uint32_t *restrict out0, uint32_t *restrict out1, uint32_t *restrict out2,
+		const uint32_t *above, const uint32_t *row, const uint32_t *below);
+static void dot_matrix_row(uint32_t *restrict out, const uint16_t *restrict shade,
+		const uint16_t *restrict alpha, const uint32_t *restrict lut, unsigned int factor);
+static float cell_alpha(unsigned int x, unsigned int y);
+static unsigned int cell_fold(unsigned int c, unsigned int factor);
+
+bool gbcc_scaler_find(const char *name, enum gbcc_scaler *scaler)
+{
+	for (size_t i = 0; i < N_ELEM(names); i++) {
+		if (strcasecmp(name, names[i].name) == 0) {
+			*scaler = names[i].scaler;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool gbcc_scale(enum gbcc_scaler scaler, unsigned int factor,
+		const void *src, enum gbcc_pixel_format src_format,
+		void *dst, size_t stride, enum gbcc_pixel_format dst_format)
+{
+	if (factor < 1 || factor > GBCC_SCALE_MAX_FACTOR
+			|| (scaler == GBCC_SCALER_SCALE2X && factor != 2)
+			|| (scaler == GBCC_SCALER_SCALE3X && factor != 3)) {
+		gbcc_log_error("Unsupported scale factor %u.\n", factor);
+		return false;
+	}
+	/* Indices mean nothing without the frame's palette, which isn't given */
+	if (src_format == GBCC_PIXEL_INDEXED8 || dst_format == GBCC_PIXEL_INDEXED8) {
+		gbcc_log_error("Can't scale indexed pixels, resolve them to colours first.\n");
+		return false;
+	}
+
+	/* Too big for the stack of every thread we might be called from */
+	struct target *t = malloc(sizeof(*t));
+	if (!t) {
+		gbcc_log_error("Couldn't allocate scaling buffers.\n");
+		return false;
+	}
+	t->pixels = dst;
+	t->stride = stride;
+	t->width = GBC_SCREEN_WIDTH * factor;
+	t->format = dst_format;
+	t->narrow = gbcc_pixel_size(dst_format) < sizeof(uint32_t);
+
+	switch (scaler) {
+		case GBCC_SCALER_NEAREST:
+			pad_source(t, src, src_format);
+			nearest(t, factor);
+			break;
+		case GBCC_SCALER_SCALE2X:
+			pad_source(t, src, src_format);
+			scale2x(t);
+			break;
+		case GBCC_SCALER_SCALE3X:
+			pad_source(t, src, src_format);
+			scale3x(t);
+			break;
+		case GBCC_SCALER_DOT_MATRIX:
+			dot_matrix(src, src_format, t, factor);
+			break;
+	}
+	free(t);
+	return true;
+}
+
+/* Converts to the destination format on the way, so kernels don't have to */
+void pad_source(struct target *t, const void *src, enum gbcc_pixel_format src_format)
+{
+	uint32_t *padded = t->padded;
+	enum gbcc_pixel_format dst_format = t->format;
+	for (size_t y = 0; y < GBC_SCREEN_HEIGHT; y++) {
+		uint32_t *row = &padded[(y + 1) * PAD_WIDTH + 1];
+		size_t base = y * GBC_SCREEN_WIDTH;
+		if (src_format == dst_format && gbcc_pixel_size(src_format) == sizeof(uint32_t)) {
+			memcpy(row, (const uint32_t *)src + base, GBC_SCREEN_WIDTH * sizeof(*row));
+		} else {
+			for (size_t x = 0; x < GBC_SCREEN_WIDTH; x++) {
+				row[x] = gbcc_pixel_pack(dst_format, gbcc_pixel_unpack(src_format, src, base + x));
+			}
+		}
+		row[-1] = row[0];
+		row[GBC_SCREEN_WIDTH] = row[GBC_SCREEN_WIDTH - 1];
+	}
+	memcpy(padded, &padded[PAD_WIDTH], PAD_WIDTH * sizeof(*padded));
+	memcpy(&padded[(PAD_HEIGHT - 1) * PAD_WIDTH], &padded[(PAD_HEIGHT - 2) * PAD_WIDTH], PAD_WIDTH * sizeof(*padded));
+}
+
+uint32_t *target_row(struct target *t, size_t y)
+{
+	if (t->narrow) {
+		return t->lines[y % N_ELEM(t->lines)];
+	}
+	return (uint32_t *)(t->pixels + y * t->stride);
+}
+
+void target_commit(struct target *t, size_t y, const uint32_t *row)
+{
+	if (t->narrow) {
+		gbcc_pixel_store(t->format, t->pixels + y * t->stride, row, t->width);
+	}
+}
+
+void target_copy(struct target *t, size_t from, size_t to)
+{
+	memcpy(t->pixels + to * t->stride, t->pixels + from * t->stride, t->width * gbcc_pixel_size(t->format));
+}
+
+/* Each row is only expanded once, then copied down */
+void nearest(struct target *t, unsigned int factor)
+{
+	const uint32_t *padded = t->padded;
+	for (size_t y = 0; y < GBC_SCREEN_HEIGHT; y++) {
+		size_t out_y = y * factor;
+		uint32_t *out = target_row(t, out_y);
+		expand_row(out, &padded[(y + 1) * PAD_WIDTH + 1], factor);
+		target_commit(t, out_y, out);
+		for (size_t k = 1; k < factor; k++) {
+			target_copy(t, out_y, out_y + k);
+		}
+	}
+}
+
+void scale2x(struct target *t)
+{
+	const uint32_t *padded = t->padded;
+	for (size_t y = 0; y < GBC_SCREEN_HEIGHT; y++) {
+		uint32_t *out0 = target_row(t, 2 * y);
+		uint32_t *out1 = target_row(t, 2 * y + 1);
+		scale2x_row(out0, out1,
+				&padded[y * PAD_WIDTH],
+				&padded[(y + 1) * PAD_WIDTH],
+				&padded[(y + 2) * PAD_WIDTH]);
+		target_commit(t, 2 * y, out0);
+		target_commit(t, 2 * y + 1, out1);
+	}
+}
+
+void scale3x(struct target *t)
+{
+	const uint32_t *padded = t->padded;
+	for (size_t y = 0; y < GBC_SCREEN_HEIGHT; y++) {
+		uint32_t *out0 = target_row(t, 3 * y);
+		uint32_t *out1 = target_row(t, 3 * y + 1);
+		uint32_t *out2 = target_row(t, 3 * y + 2);
+		scale3x_row(out0, out1, out2,
+				&padded[y * PAD_WIDTH],
+				&padded[(y + 1) * PAD_WIDTH],
+				&padded[(y + 2) * PAD_WIDTH]);
+		target_commit(t, 3 * y, out0);
+		target_commit(t, 3 * y + 1, out1);
+		target_commit(t, 3 * y + 2, out2);
+	}
+}
+
+/*
+ * Each pixel becomes a cell of the LCD grid, darker towards its corners, and
+ * is shaded from background to foreground by its luma. All the shades are
+ * worked out up front, so each output pixel is a multiply and a lookup.
+ */
+void dot_matrix(const void *src, enum gbcc_pixel_format src_format, struct target *t, unsigned int factor)
+{
+	uint32_t lut[257];
+	for (size_t i = 0; i < N_ELEM(lut); i++) {
+		uint32_t rgba = 0xFFu;
+		for (unsigned int shift = 8; shift < 32; shift += 8) {
+			float bg = (float)((DOT_BACKGROUND >> shift) & 0xFFu);
+			float fg = (float)((DOT_FOREGROUND >> shift) & 0xFFu);
+			float c = bg + (fg - bg) * (float)i / 256.0f;
+			rgba |= (uint32_t)lroundf(c) << shift;
+		}
+		lut[i] = gbcc_pixel_pack(t->format, rgba);
+	}
+
+	uint16_t alpha[GBCC_SCALE_MAX_FACTOR][GBCC_SCALE_MAX_FACTOR];
+	for (unsigned int cy = 0; cy < factor; cy++) {
+		for (unsigned int cx = 0; cx < factor; cx++) {
+			float a = cell_alpha(cell_fold(cx, factor), cell_fold(cy, factor));
+			alpha[cy][cx] = (uint16_t)lroundf(a * 256);
+		}
+	}
+
+	uint16_t shade[GBC_SCREEN_WIDTH];
+	for (size_t y = 0; y < GBC_SCREEN_HEIGHT; y++) {
+		for (size_t x = 0; x < GBC_SCREEN_WIDTH; x++) {
+			uint32_t p = gbcc_pixel_unpack(src_format, src, y * GBC_SCREEN_WIDTH + x);
+			float r = (float)((p >> 24u) & 0xFFu) / 255.0f;
+			float g = (float)((p >> 16u) & 0xFFu) / 255.0f;
+			float b = (float)((p >> 8u) & 0xFFu) / 255.0f;
+			/* The shader's weights, which don't quite sum to 1 */
+			float luma = 0.2162f * r + 0.7152f * g + 0.0722f * b;
+			shade[x] = (uint16_t)lroundf(fminf(fmaxf(1 - luma, 0), 1) * 256);
+		}
+		for (unsigned int cy = 0; cy < factor; cy++) {
+			size_t out_y = y * factor + cy;
+			uint32_t *out = target_row(t, out_y);
+			dot_matrix_row(out, shade, alpha[cy], lut, factor);
+			target_commit(t, out_y, out);
+		}
+	}
+}
+
+MULTIVERSION
+void expand_row(uint32_t *restrict out, const uint32_t *restrict in, unsigned int factor)
+{
+	/* Constant factors for the common cases, so they vectorise */
+	switch (factor) {
+		case 1:
+			memcpy(out, in, GBC_SCREEN_WIDTH * sizeof(*out));
+			return;
+		case 2:
+			for (size_t x = 0; x < GBC_SCREEN_WIDTH; x++) {
+				out[2 * x] = in[x];
+				out[2 * x + 1] = in[x];
+			}
+			return;
+		case 3:
+			for (size_t x = 0; x < GBC_SCREEN_WIDTH; x++) {
+				out[3 * x] = in[x];
+				out[3 * x + 1] = in[x];
+				out[3 * x + 2] = in[x];
+			}
+			return;
+		case 4:
+			for (size_t x = 0; x < GBC_SCREEN_WIDTH; x++) {
+				out[4 * x] = in[x];
+				out[4 * x + 1] = in[x];
+				out[4 * x + 2] = in[x];
+				out[4 * x + 3] = in[x];
+			}
+			return;
+		default:
+			for (size_t x = 0; x < GBC_SCREEN_WIDTH; x++) {
+				for (size_t k = 0; k < factor; k++) {
+					*out++ = in[x];
+				}
+			}
+			return;
+	}
+}
+
+/*
+ * Scale2x, from AdvanceMAME. Around each pixel E:
+ *
+ *     B
+ *   D E F
+ *     H
+ */
+MULTIVERSION
+void scale2x_row(uint32_t *restrict out0, uint32_t *restrict out1,
+		const uint32_t *above, const uint32_t *row, const uint32_t *below)
+{
+	for (size_t x = 0; x < GBC_SCREEN_WIDTH; x++) {
+		uint32_t B = above[x + 1];
+		uint32_t D = row[x];
+		uint32_t E = row[x + 1];
+		uint32_t F = row[x + 2];
+		uint32_t H = below[x + 1];
+		bool edge = B != H && D != F;
+		out0[2 * x] = (edge && D == B) ? D : E;
+		out0[2 * x + 1] = (edge && B == F) ? F : E;
+		out1[2 * x] = (edge && D == H) ? D : E;
+		out1[2 * x + 1] = (edge && H == F) ? F : E;
+	}
+}
+
+/*
+ * Scale3x, likewise:
+ *
+ *   A B C
+ *   D E F
+ *   G H I
+ */
+MULTIVERSION
+void scale3x_row(uint32_t *restrict out0, uint32_t *restrict out1, uint32_t *restrict out2,
+		const uint32_t *above, const uint32_t *row, const uint32_t *below)
+{
+	for (size_t x = 0; x < GBC_SCREEN_WIDTH; x++) {
+		uint32_t A = above[x];
+		uint32_t B = above[x + 1];
+		uint32_t C = above[x + 2];
+		uint32_t D = row[x];
+		uint32_t E = row[x + 1];
+		uint32_t F = row[x + 2];
+		uint32_t G = below[x];
+		uint32_t H = below[x + 1];
+		uint32_t I = below[x + 2];
+		bool edge = B != H && D != F;
+		bool db = edge && D == B;
+		bool bf = edge && B == F;
+		bool dh = edge && D == H;
+		bool hf = edge && H == F;
+		out0[3 * x] = db ? D : E;
+		out0[3 * x + 1] = ((db && E != C) || (bf && E != A)) ? B : E;
+		out0[3 * x + 2] = bf ? F : E;
+		out1[3 * x] = ((db && E != G) || (dh && E != A)) ? D : E;
+		out1[3 * x + 1] = E;
+		out1[3 * x + 2] = ((bf && E != I) || (hf && E != C)) ? F : E;
+		out2[3 * x] = dh ? D : E;
+		out2[3 * x + 1] = ((dh && E != I) || (hf && E != G)) ? H : E;
+		out2[3 * x + 2] = hf ? F : E;
+	}
+}
+
+MULTIVERSION
+void dot_matrix_row(uint32_t *restrict out, const uint16_t *restrict shade,
+		const uint16_t *restrict alpha, const uint32_t *restrict lut, unsigned int factor)
+{
+	for (size_t x = 0; x < GBC_SCREEN_WIDTH; x++) {
+		uint32_t s = shade[x];
+		for (size_t cx = 0; cx < factor; cx++) {
+			*out++ = lut[(s * alpha[cx] + 128) >> 8];
+		}
+	}
+}
+
+/*
+ * Position within a cell, as the shader works it out for a cell 7 pixels
+ * wide: the distance from the centre, counting the outermost pixels as 3.
+ */
+unsigned int cell_fold(unsigned int c, unsigned int factor)
+{
+	unsigned int x = (unsigned int)((c + 0.5) * 7 / factor);
+	return x >= 3 ? x - 3 : 3 - x;
+}
+
+float cell_alpha(unsigned int x, unsigned int y)
+{
+	if (x == 2 && y == 2) {
+		return 0.959f;
+	} else if (x == 3) {
+		if (y == 3) {
+			return 0.529f;
+		} else if (y == 2) {
+			return 0.793f;
+		} else if (y == 1) {
+			return 0.893f;
+		}
+	} else if (y == 3) {
+		if (x == 2) {
+			return 0.793f;
+		} else if (x == 1) {
+			return 0.893f;
+		}
+	}
+	return 1;
+}
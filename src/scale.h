@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#ifndef GBCC_SCALE_H
+#define GBCC_SCALE_H
+
+#include "pixel.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define GBCC_SCALE_MAX_FACTOR 16
+
+/*
+ * CPU upscalers, for output at display resolution without a GPU, e.g.
+ * screenshots, video capture or shared memory buffers.
+ */
+enum gbcc_scaler {
+	GBCC_SCALER_NEAREST,	/* Any integer factor */
+	GBCC_SCALER_SCALE2X,	/* Factor 2 only */
+	GBCC_SCALER_SCALE3X,	/* Factor 3 only */
+	GBCC_SCALER_DOT_MATRIX	/* Any factor, as shaders/dotmatrix.frag at 7 */
+};
+
+/* Returns false if name isn't a scaler */
+bool gbcc_scaler_find(const char *name, enum gbcc_scaler *scaler);
+
+/*
+ * Scale a GBC_SCREEN_WIDTH x GBC_SCREEN_HEIGHT frame up by factor, into a
+ * buffer of stride bytes per row. The source & destination formats needn't
+ * match, but neither can be GBCC_PIXEL_INDEXED8. Returns false if the scaler
+ * doesn't support the factor or formats.
+ */
+bool gbcc_scale(enum gbcc_scaler scaler, unsigned int factor,
+		const void *src, enum gbcc_pixel_format src_format,
+		void *dst, size_t stride, enum gbcc_pixel_format dst_format);
+
+#endif /* GBCC_SCALE_H */
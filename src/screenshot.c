@@ -10,6 +10,8 @@
 
 #include "gbcc.h"
 #include "debug.h"
+#include "mailbox.h"
+#include "pixel.h"
 #include "screenshot.h"
 #include "window.h"
 #include <errno.h>
@@ -110,10 +112,15 @@ void gbcc_screenshot(struct gbcc *gbc)
 		for (uint32_t x = 0; x < width; x++) {
 			if (win->raw_screenshot) {
 				uint32_t idx = y * width + x;
-				uint32_t pixel = win->buffer[idx];
-				*row++ = (pixel & 0x000000FFu) >> 0u;
-				*row++ = (pixel & 0x0000FF00u) >> 8u;
+				uint32_t pixel = gbcc_pixel_unpack(gbc->core.ppu.format, win->frame->pixels, idx);
+				if (gbc->core.ppu.format == GBCC_PIXEL_INDEXED8) {
+					/* Anything past the palette is white */
+					pixel = pixel < GBCC_PIXEL_PALETTE_SIZE ? pixel : GBCC_PIXEL_PALETTE_SIZE - 1;
+					pixel = gbcc_pixel_unpack(GBCC_PIXEL_RGBA8888, win->frame->palette[y], pixel);
+				}
+				*row++ = (pixel & 0xFF000000u) >> 24u;
 				*row++ = (pixel & 0x00FF0000u) >> 16u;
+				*row++ = (pixel & 0x0000FF00u) >> 8u;
 			} else {
 				uint32_t idx = 4 * ((height - y - 1) * width + x);
 				*row++ = buffer[idx++];
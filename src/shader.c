@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#include "shader.h"
+#include "debug.h"
+#include "time_diff.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define CACHE_DIR "/gbcc/shaders/"
+#define CACHE_MAGIC "GBCCPROG"
+/* Far bigger than any real program, to catch corrupt files */
+#define MAX_BINARY_SIZE (16u * 1024u * 1024u)
+
+#ifdef __ANDROID__
+/* GLES 3 is all there is there, so the core functions always do */
+#define glProgramBinaryOES glProgramBinary
+#define glGetProgramBinaryOES glGetProgramBinary
+#endif
+
+#define FNV_OFFSET 0xCBF29CE484222325ull
+#define FNV_PRIME 0x100000001B3ull
+
+enum binary_api {
+	BINARY_NONE,
+	BINARY_CORE,
+	BINARY_OES
+};
+
+/* At the start of each cache file, followed by the binary itself */
+struct cache_header {
+	char magic[8];
+	uint32_t format;
+	uint32_t length;
+};
+
+static enum binary_api get_binary_api(void);
+static GLuint compile(GLenum type, const char *name);
+static uint64_t hash_string(uint64_t hash, const char *str);
+static char *cache_path(const char *vert_src, const char *frag_src);
+static bool make_dirs(char *path);
+static bool load_binary(enum binary_api api, GLuint program, const char *path);
+static void save_binary(enum binary_api api, GLuint program, const char *path);
+
+const char *gbcc_shader_source(const char *name)
+{
+	for (size_t i = 0; i < gbcc_shader_source_count; i++) {
+		if (strcmp(gbcc_shader_sources[i].name, name) == 0) {
+			return gbcc_shader_sources[i].text;
+		}
+	}
+	return NULL;
+}
+
+GLuint gbcc_shader_program(const char *vert, const char *frag)
+{
+	const char *vert_src = gbcc_shader_source(vert);
+	const char *frag_src = gbcc_shader_source(frag);
+	if (!vert_src || !frag_src) {
+		gbcc_log_error("No built-in shader %s.\n", vert_src ? frag : vert);
+		exit(EXIT_FAILURE);
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	GLuint program = glCreateProgram();
+	enum binary_api api = get_binary_api();
+	char *path = NULL;
+	if (api != BINARY_NONE) {
+		path = cache_path(vert_src, frag_src);
+	}
+	if (path && load_binary(api, program, path)) {
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		gbcc_log_debug("Loaded %s + %s from the shader cache in %.2f ms.\n",
+				vert, frag, (double)gbcc_time_diff(&end, &start) / 1e6);
+		free(path);
+		return program;
+	}
+
+	GLuint vertex_shader = compile(GL_VERTEX_SHADER, vert);
+	GLuint fragment_shader = compile(GL_FRAGMENT_SHADER, frag);
+	glAttachShader(program, vertex_shader);
+	glAttachShader(program, fragment_shader);
+	if (path && api == BINARY_CORE) {
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+	glLinkProgram(program);
+	/* The linked program doesn't need them any more */
+	glDetachShader(program, vertex_shader);
+	glDetachShader(program, fragment_shader);
+	glDeleteShader(vertex_shader);
+	glDeleteShader(fragment_shader);
+
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE) {
+		gbcc_log_error("Failed to link shaders %s & %s!\n", vert, frag);
+		GLint info_length = 0;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &info_length);
+		if (info_length > 1) {
+			char *log = malloc((unsigned)info_length * sizeof(*log));
+			glGetProgramInfoLog(program, info_length, NULL, log);
+			gbcc_log_append_error("%s\n", log);
+			free(log);
+		}
+		exit(EXIT_FAILURE);
+	}
+
+	if (path) {
+		save_binary(api, program, path);
+		free(path);
+	}
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	gbcc_log_debug("Compiled %s + %s in %.2f ms.\n",
+			vert, frag, (double)gbcc_time_diff(&end, &start) / 1e6);
+	return program;
+}
+
+/*
+ * Program binaries are core in GLES 3, and a common extension to GLES 2,
+ * though drivers needn't support any binary formats even then.
+ */
+enum binary_api get_binary_api(void)
+{
+#ifdef __ANDROID__
+	enum binary_api api = BINARY_CORE;
+#else
+	enum binary_api api = BINARY_NONE;
+	if (epoxy_gl_version() >= 30) {
+		api = BINARY_CORE;
+	} else if (epoxy_has_gl_extension("GL_OES_get_program_binary")) {
+		api = BINARY_OES;
+	}
+	if (api == BINARY_NONE) {
+		return api;
+	}
+#endif
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0 ? api : BINARY_NONE;
+}
+
+GLuint compile(GLenum type, const char *name)
+{
+	const GLchar *source = gbcc_shader_source(name);
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE) {
+		gbcc_log_error("Failed to compile shader %s!\n", name);
+
+		GLint info_length = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &info_length);
+		if (info_length > 1) {
+			char *log = malloc((unsigned)info_length * sizeof(*log));
+			glGetShaderInfoLog(shader, info_length, NULL, log);
+			gbcc_log_append_error("%s\n", log);
+			free(log);
+		}
+		exit(EXIT_FAILURE);
+	}
+	return shader;
+}
+
+/* FNV-1a, including the terminator so that "ab" + "c" differs from "a" + "bc" */
+uint64_t hash_string(uint64_t hash, const char *str)
+{
+	if (!str) {
+		str = "";
+	}
+	do {
+		hash ^= (uint8_t)*str;
+		hash *= FNV_PRIME;
+	} while (*str++);
+	return hash;
+}
+
+/*
+ * Binaries only work with the driver that made them, so the key covers the
+ * driver as well as the sources. Returns NULL if there's nowhere to cache.
+ */
+char *cache_path(const char *vert_src, const char *frag_src)
+{
+	uint64_t key = FNV_OFFSET;
+	key = hash_string(key, (const char *)glGetString(GL_VENDOR));
+	key = hash_string(key, (const char *)glGetString(GL_RENDERER));
+	key = hash_string(key, (const char *)glGetString(GL_VERSION));
+	key = hash_string(key, vert_src);
+	key = hash_string(key, frag_src);
+
+	const char *base_dir = getenv("XDG_CACHE_HOME");
+	const char *ext = "";
+	if (!base_dir) {
+		base_dir = getenv("HOME");
+		ext = "/.cache";
+		if (!base_dir) {
+			return NULL;
+		}
+	}
+	size_t len = strlen(base_dir) + strlen(ext) + strlen(CACHE_DIR) + 16 + strlen(".bin") + 1;
+	char *path = calloc(len, sizeof(*path));
+	if (!path) {
+		return NULL;
+	}
+	snprintf(path, len, "%s%s%s%016llx.bin", base_dir, ext, CACHE_DIR, (unsigned long long)key);
+	if (!make_dirs(path)) {
+		free(path);
+		return NULL;
+	}
+	return path;
+}
+
+/* Create every directory leading up to the file path */
+bool make_dirs(char *path)
+{
+	for (char *c = path + 1; *c; c++) {
+		if (*c != '/') {
+			continue;
+		}
+		*c = '\0';
+		errno = 0;
+		int err = mkdir(path, 0755);
+		if (err && errno != EEXIST) {
+			gbcc_log_warning("Couldn't create shader cache directory %s: %s\n", path, strerror(errno));
+			*c = '/';
+			return false;
+		}
+		*c = '/';
+	}
+	return true;
+}
+
+bool load_binary(enum binary_api api, GLuint program, const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		return false;
+	}
+	struct cache_header header;
+	void *binary = NULL;
+	bool ok = fread(&header, sizeof(header), 1, fp) == 1
+		&& memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0
+		&& header.length > 0
+		&& header.length <= MAX_BINARY_SIZE
+		&& (binary = malloc(header.length))
+		&& fread(binary, header.length, 1, fp) == 1;
+	fclose(fp);
+	if (ok) {
+		if (api == BINARY_OES) {
+			glProgramBinaryOES(program, header.format, binary, (GLint)header.length);
+		} else {
+			glProgramBinary(program, header.format, binary, (GLsizei)header.length);
+		}
+		/* Drivers reject binaries from other versions of themselves */
+		GLint status;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		ok = status == GL_TRUE;
+		if (!ok) {
+			/* Clear any error about the format, it's expected */
+			glGetError();
+			gbcc_log_debug("Cached program %s is stale, recompiling.\n", path);
+		}
+	}
+	free(binary);
+	return ok;
+}
+
+void save_binary(enum binary_api api, GLuint program, const char *path)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return;
+	}
+	void *binary = malloc((size_t)length);
+	if (!binary) {
+		return;
+	}
+	GLsizei written = 0;
+	GLenum format = 0;
+	if (api == BINARY_OES) {
+		glGetProgramBinaryOES(program, length, &written, &format, binary);
+	} else {
+		glGetProgramBinary(program, length, &written, &format, binary);
+	}
+	if (written <= 0) {
+		free(binary);
+		return;
+	}
+
+	struct cache_header header = {
+		.format = format,
+		.length = (uint32_t)written
+	};
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+
+	/* Written aside and renamed into place, so no run ever sees half a file */
+	size_t len = strlen(path) + strlen(".tmp") + 1;
+	char *tmp = calloc(len, sizeof(*tmp));
+	if (!tmp) {
+		free(binary);
+		return;
+	}
+	snprintf(tmp, len, "%s.tmp", path);
+	errno = 0;
+	FILE *fp = fopen(tmp, "wb");
+	bool ok = fp
+		&& fwrite(&header, sizeof(header), 1, fp) == 1
+		&& fwrite(binary, (size_t)written, 1, fp) == 1;
+	if (fp && fclose(fp) != 0) {
+		ok = false;
+	}
+	if (ok && rename(tmp, path) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		gbcc_log_warning("Couldn't write shader cache %s: %s\n", path, strerror(errno));
+		remove(tmp);
+	}
+	free(tmp);
+	free(binary);
+}
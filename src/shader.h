@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#ifndef GBCC_SHADER_H
+#define GBCC_SHADER_H
+
+#ifdef __ANDROID__
+#include <GLES3/gl3.h>
+#else
+#include <epoxy/gl.h>
+#endif
+#include <stddef.h>
+
+/* The GLES 2 shaders, built in at compile time by embed_shaders.sh */
+struct gbcc_shader_source {
+	const char *name;	/* File name within shaders/gles2 */
+	const char *text;
+};
+
+extern const struct gbcc_shader_source gbcc_shader_sources[];
+extern const size_t gbcc_shader_source_count;
+
+/* Returns NULL if there's no shader of that name */
+const char *gbcc_shader_source(const char *name);
+
+/*
+ * Link a program from two of the built-in shaders. Where the driver
+ * supports program binaries, the linked program is kept in a cache on disk,
+ * keyed by the driver & sources, so later runs needn't compile anything.
+ * Exits if the shaders don't build.
+ */
+GLuint gbcc_shader_program(const char *vert, const char *frag);
+
+#endif /* GBCC_SHADER_H */
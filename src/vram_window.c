@@ -13,7 +13,7 @@
 #include "constants.h"
 #include "debug.h"
 #include "memory.h"
-#include "nelem.h"
+#include "pixel.h"
 #include "window.h"
 #include "vram_window.h"
 #ifdef __ANDROID__
@@ -162,6 +162,12 @@ void gbcc_vram_window_deinitialise(struct gbcc *gbc)
 void gbcc_vram_window_update(struct gbcc *gbc)
 {
 	struct gbcc_vram_window *win = &gbc->vram_window;
+	const uint32_t palette[4] = {
+		gbcc_pixel_pack(GBCC_PIXEL_RGBA8888, 0xc4cfa1ffu),
+		gbcc_pixel_pack(GBCC_PIXEL_RGBA8888, 0x8b956dffu),
+		gbcc_pixel_pack(GBCC_PIXEL_RGBA8888, 0x6b7353ffu),
+		gbcc_pixel_pack(GBCC_PIXEL_RGBA8888, 0x000000ffu)
+	};
 
 	for (int bank = 0; bank < 2; bank++) {
 		for (int j = 0; j < VRAM_WINDOW_HEIGHT_TILES / 2; j++) {
@@ -171,22 +177,7 @@ void gbcc_vram_window_update(struct gbcc *gbc)
 					uint8_t hi = gbc->core.memory.vram_bank[bank][16 * (j * VRAM_WINDOW_WIDTH_TILES + i) + 2*y + 1];
 					for (uint8_t x = 0; x < 8; x++) {
 						uint8_t colour = (uint8_t)(check_bit(hi, 7 - x) << 1u) | check_bit(lo, 7 - x);
-						uint32_t p = 0;
-						switch (colour) {
-							case 3:
-								p = 0x000000ffu;
-								break;
-							case 2:
-								p = 0x6b7353ffu;
-								break;
-							case 1:
-								p = 0x8b956dffu;
-								break;
-							case 0:
-								p = 0xc4cfa1ffu;
-								break;
-						}
-						win->buffer[8 * (VRAM_WINDOW_WIDTH * (j + bank * VRAM_WINDOW_HEIGHT_TILES / 2) + i) + VRAM_WINDOW_WIDTH * y + x] = p;
+						win->buffer[8 * (VRAM_WINDOW_WIDTH * (j + bank * VRAM_WINDOW_HEIGHT_TILES / 2) + i) + VRAM_WINDOW_WIDTH * y + x] = palette[colour];
 					}
 				}
 			}
@@ -199,14 +190,6 @@ void gbcc_vram_window_update(struct gbcc *gbc)
 	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
 	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
 
-	for (size_t i = 0; i < N_ELEM(win->buffer); i++) {
-		uint32_t tmp = win->buffer[i];
-		win->buffer[i] = (tmp & 0xFFu) << 24u
-				| (tmp & 0xFF00u) << 8u
-				| (tmp & 0xFF0000u) >> 8u
-				| (tmp & 0xFF000000u) >> 24u;
-	}
-
 
 	/* First pass - render the gbc screen to the framebuffer */
 	glBindFramebuffer(GL_FRAMEBUFFER, win->gl.fbo);
@@ -67,6 +67,25 @@ void wav_parse_header(struct wav_header *header, FILE *wav)
 	}
 }
 
+void wav_write_header(const struct wav_header *header, FILE *wav)
+{
+	if (fwrite(header->ChunkID, 1, 4, wav) != 4
+			|| fwrite(&header->ChunkSize, 4, 1, wav) != 1
+			|| fwrite(header->Format, 1, 4, wav) != 4
+			|| fwrite(header->Subchunk1ID, 1, 4, wav) != 4
+			|| fwrite(&header->Subchunk1Size, 4, 1, wav) != 1
+			|| fwrite(&header->AudioFormat, 2, 1, wav) != 1
+			|| fwrite(&header->NumChannels, 2, 1, wav) != 1
+			|| fwrite(&header->SampleRate, 4, 1, wav) != 1
+			|| fwrite(&header->ByteRate, 4, 1, wav) != 1
+			|| fwrite(&header->BlockAlign, 2, 1, wav) != 1
+			|| fwrite(&header->BitsPerSample, 2, 1, wav) != 1
+			|| fwrite(header->Subchunk2ID, 1, 4, wav) != 4
+			|| fwrite(&header->Subchunk2Size, 4, 1, wav) != 1) {
+		gbcc_log_error("Failed to write wav header.\n");
+	}
+}
+
 void wav_print_header(struct wav_header *header)
 {
 	//printf(header->ChunkID, 1, 4, wav);
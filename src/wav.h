@@ -33,6 +33,7 @@ struct wav_header {
 };
 
 void wav_parse_header(struct wav_header *header, FILE *wav);
+void wav_write_header(const struct wav_header *header, FILE *wav);
 void wav_print_header(struct wav_header *header);
 
 #endif /* WAVE_H */
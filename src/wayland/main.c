@@ -25,53 +25,140 @@
 #include "../config.h"
 #include "../cpu.h"
 #include "../debug.h"
+#include "../mailbox.h"
 #include "../memory.h"
 #include "../palettes.h"
 #include "../paths.h"
 #include "../save.h"
 #include "../time_diff.h"
+#include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <wayland-client.h>
 #include "../ext-session-lock-v1-client-protocol.h"
+#include "../viewporter-client-protocol.h"
+#include "shm.h"
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 #include <wayland-egl.h>
 
+/* Frames of damage kept, for buffers of up to this age */
+#define DAMAGE_HISTORY 4
+
 struct display {
     struct wl_display *wl_display;
     struct wl_registry *registry;
     struct wl_compositor *compositor;
     struct wl_seat *seat;
-    struct wl_output *output;
+    struct wl_shm *shm;
+    struct wl_subcompositor *subcompositor;
+    struct wp_viewporter *viewporter;
     struct ext_session_lock_manager_v1 *lock_mgr;
 };
 
-struct lock_surface {
+/*
+ * The one emulator, and everything shared by the surfaces showing it. All
+ * surfaces draw with the same EGL context, so GL objects are only created
+ * once, and each frame is only uploaded once however many outputs there are.
+ */
+struct locker {
     struct gbcc gbcc;
-    struct display *disp;
+    struct display disp;
     struct ext_session_lock_v1 *lock;
+    struct wl_list surfaces;	/* lock_surface.link, one per output */
+    EGLDisplay egl_dpy;
+    EGLConfig egl_cfg;
+    EGLContext egl_ctx;
+    PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_with_damage;	/* NULL if unsupported */
+    PFNEGLSETDAMAGEREGIONKHRPROC set_damage_region;
+    int timer_fd;	/* Ticks through the unlock animation */
+    struct timespec quit_time;
+    float fade;	/* How far the unlock fade out has got, from 0 to 1 */
+    bool locked;
+    bool running;
+    bool should_quit;
+    bool quitting;
+};
+
+struct lock_surface {
+    struct wl_list link;
+    struct locker *locker;
+    struct wl_output *output;
+    uint32_t output_name;	/* Registry name, to match the output's removal */
     struct ext_session_lock_surface_v1 *surf;
     struct wl_surface *wl_surf;
     uint32_t width, height;
-    EGLDisplay egl_dpy;
-    EGLContext egl_ctx;
     EGLSurface egl_surf;
     struct wl_egl_window *egl_win;
-    GLuint program, vbo;
-    GLint uni_offset;
-    float offset, dir;
+    struct gbcc_shm shm;	/* Used instead of EGL when software rendering */
+    bool shm_initialised;	/* Else drawn with GL, even when software rendering */
+    struct gbcc_window_surface view;
+    struct gbcc_window_rect damage[DAMAGE_HISTORY];	/* Most recent first */
+    struct wl_callback *frame_cb;	/* Set while the compositor has yet to show our last frame */
+    struct {
+        uint64_t draws;
+        uint64_t cpu;	/* Thread CPU time spent drawing, in ns */
+    } stats;
     bool configured;
-    bool locked;
-    bool running;
-    bool should_quit;
+    bool redraw;	/* Draw even without a new emulator frame */
 };
 
+/* What woke the main loop */
+enum loop_source {
+    SOURCE_DISPLAY,
+    SOURCE_FRAME,
+    SOURCE_TIMER
+};
 
-static void setup_gl(struct lock_surface *ls) {
+/* Outputs can come & go at any time, so these are needed from the registry */
+static void create_lock_surface(struct lock_surface *ls);
+static void destroy_lock_surface(struct lock_surface *ls);
+
+static bool has_extension(const char *extensions, const char *name) {
+    size_t len = strlen(name);
+    while (extensions && *extensions) {
+        size_t n = strcspn(extensions, " ");
+        if (n == len && strncmp(extensions, name, len) == 0)
+            return true;
+        extensions += n;
+        extensions += strspn(extensions, " ");
+    }
+    return false;
+}
+
+/*
+ * Telling the compositor which part of the surface changed lets it skip
+ * recompositing the rest, which matters for a small Game Boy screen on a
+ * large panel. Partial update additionally lets the GPU skip the rest when
+ * rendering.
+ */
+static void setup_damage(struct locker *locker) {
+    const char *extensions = eglQueryString(locker->egl_dpy, EGL_EXTENSIONS);
+    if (has_extension(extensions, "EGL_KHR_swap_buffers_with_damage")) {
+        locker->swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+            eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    } else if (has_extension(extensions, "EGL_EXT_swap_buffers_with_damage")) {
+        locker->swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+            eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+    }
+    if (has_extension(extensions, "EGL_KHR_partial_update")) {
+        locker->set_damage_region = (PFNEGLSETDAMAGEREGIONKHRPROC)
+            eglGetProcAddress("eglSetDamageRegionKHR");
+    }
+    gbcc_log_debug("Swap with damage %s, partial update %s.\n",
+            locker->swap_with_damage ? "supported" : "unsupported",
+            locker->set_damage_region ? "supported" : "unsupported");
+}
+
+/* The display, config & context shared by every output's surface */
+static void setup_egl(struct locker *locker) {
     EGLint cfg_attr[] = {
         EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
         EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
@@ -80,52 +167,91 @@ static void setup_gl(struct lock_surface *ls) {
     };
     EGLint ctx_attr[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
 
-    ls->egl_dpy = eglGetDisplay((EGLNativeDisplayType)ls->disp->wl_display);
-    if (ls->egl_dpy == EGL_NO_DISPLAY) {
+    locker->egl_dpy = eglGetDisplay((EGLNativeDisplayType)locker->disp.wl_display);
+    if (locker->egl_dpy == EGL_NO_DISPLAY) {
         fprintf(stderr, "eglGetDisplay failed\n");
         exit(1);
     }
 
-    if (!eglInitialize(ls->egl_dpy, NULL, NULL)) {
+    if (!eglInitialize(locker->egl_dpy, NULL, NULL)) {
         fprintf(stderr, "eglInitialize failed: 0x%x\n", eglGetError());
         exit(1);
     }
 
-    EGLConfig cfg;
     EGLint num;
-    if (!eglChooseConfig(ls->egl_dpy, cfg_attr, &cfg, 1, &num) || num < 1) {
+    if (!eglChooseConfig(locker->egl_dpy, cfg_attr, &locker->egl_cfg, 1, &num) || num < 1) {
         fprintf(stderr, "eglChooseConfig failed: 0x%x\n", eglGetError());
         exit(1);
     }
 
-    // create surface with egl_win
-
-    ls->egl_surf = eglCreateWindowSurface(ls->egl_dpy, cfg, (EGLNativeWindowType)ls->egl_win, NULL);
-    if (ls->egl_surf == EGL_NO_SURFACE) {
-        fprintf(stderr, "eglCreateWindowSurface failed: 0x%x\n", eglGetError());
+    locker->egl_ctx = eglCreateContext(locker->egl_dpy, locker->egl_cfg, EGL_NO_CONTEXT, ctx_attr);
+    if (locker->egl_ctx == EGL_NO_CONTEXT) {
+        fprintf(stderr, "eglCreateContext failed: 0x%x\n", eglGetError());
         exit(1);
     }
+    setup_damage(locker);
+}
 
-    ls->egl_ctx = eglCreateContext(ls->egl_dpy, cfg, EGL_NO_CONTEXT, ctx_attr);
-    if (ls->egl_ctx == EGL_NO_CONTEXT) {
-        fprintf(stderr, "eglCreateContext failed: 0x%x\n", eglGetError());
-        exit(1);
+static bool make_current(struct lock_surface *ls) {
+    struct locker *locker = ls->locker;
+    if (eglGetCurrentSurface(EGL_DRAW) == ls->egl_surf)
+        return true;
+    if (!eglMakeCurrent(locker->egl_dpy, ls->egl_surf, ls->egl_surf, locker->egl_ctx)) {
+        gbcc_log_error("eglMakeCurrent failed: 0x%x\n", eglGetError());
+        return false;
     }
+    return true;
+}
 
-    if (!eglMakeCurrent(ls->egl_dpy, ls->egl_surf, ls->egl_surf, ls->egl_ctx)) {
-        fprintf(stderr, "eglMakeCurrent failed: 0x%x\n", eglGetError());
+static void setup_gl(struct lock_surface *ls) {
+    struct locker *locker = ls->locker;
+    if (locker->egl_ctx == EGL_NO_CONTEXT)
+        setup_egl(locker);
+
+    ls->egl_surf = eglCreateWindowSurface(locker->egl_dpy, locker->egl_cfg, (EGLNativeWindowType)ls->egl_win, NULL);
+    if (ls->egl_surf == EGL_NO_SURFACE) {
+        fprintf(stderr, "eglCreateWindowSurface failed: 0x%x\n", eglGetError());
         exit(1);
     }
 
-    gbcc_window_initialise(&ls->gbcc);
-    return;
-}
+    if (!make_current(ls))
+        exit(1);
 
+    /*
+     * We wait for frame callbacks ourselves, and EGL blocking in
+     * eglSwapBuffers for its own would stall the whole loop, and every
+     * other output with it.
+     */
+    eglSwapInterval(locker->egl_dpy, 0);
+    /* Whatever the buffers hold, it isn't anything we drew */
+    memset(ls->damage, 0, sizeof(ls->damage));
+
+    /* Only the first surface needs the GL objects made, the rest share them */
+    if (!locker->gbcc.window.initialised)
+        gbcc_window_initialise(&locker->gbcc);
+}
 
+static void add_output(struct locker *locker, uint32_t name, struct wl_output *output) {
+    struct lock_surface *ls = calloc(1, sizeof(*ls));
+    if (!ls) {
+        gbcc_log_error("Couldn't allocate lock surface.\n");
+        wl_output_destroy(output);
+        return;
+    }
+    ls->locker = locker;
+    ls->output = output;
+    ls->output_name = name;
+    ls->egl_surf = EGL_NO_SURFACE;
+    wl_list_insert(&locker->surfaces, &ls->link);
+    /* Outputs plugged in once we're locked need covering straight away */
+    if (locker->lock)
+        create_lock_surface(ls);
+}
 
 static void registry_global(void *data, struct wl_registry *reg,
                             uint32_t id, const char *iface, uint32_t ver) {
-    struct display *d = data;
+    struct locker *locker = data;
+    struct display *d = &locker->disp;
     if (strcmp(iface, "ext_session_lock_manager_v1") == 0)
         d->lock_mgr = wl_registry_bind(reg, id,
             &ext_session_lock_manager_v1_interface, 1);
@@ -136,18 +262,38 @@ static void registry_global(void *data, struct wl_registry *reg,
         d->seat = wl_registry_bind(reg, id,
             &wl_seat_interface, 1);
     else if (strcmp(iface, "wl_output") == 0)
-        d->output = wl_registry_bind(reg, id,
-            &wl_output_interface, 2);
+        add_output(locker, id, wl_registry_bind(reg, id,
+            &wl_output_interface, 2));
+    else if (strcmp(iface, "wl_shm") == 0)
+        d->shm = wl_registry_bind(reg, id,
+            &wl_shm_interface, 1);
+    else if (strcmp(iface, "wl_subcompositor") == 0)
+        d->subcompositor = wl_registry_bind(reg, id,
+            &wl_subcompositor_interface, 1);
+    else if (strcmp(iface, "wp_viewporter") == 0)
+        d->viewporter = wl_registry_bind(reg, id,
+            &wp_viewporter_interface, 1);
+}
+
+static void registry_global_remove(void *data, struct wl_registry *reg, uint32_t id) {
+    struct locker *locker = data;
+    struct lock_surface *ls;
+    wl_list_for_each(ls, &locker->surfaces, link) {
+        if (ls->output_name == id) {
+            destroy_lock_surface(ls);
+            return;
+        }
+    }
 }
 
 static const struct wl_registry_listener registry_listener = {
     registry_global,
-    NULL
+    registry_global_remove
 };
 
 static void lock_locked(void *data, struct ext_session_lock_v1 *lock) {
-	struct lock_surface *ls = data;
-	ls->locked = true;
+	struct locker *locker = data;
+	locker->locked = true;
 }
 static void lock_finished(void *data, struct ext_session_lock_v1 *lock) {
     fprintf(stderr, "Lock failed\n");
@@ -162,13 +308,30 @@ static void surf_configure(void *data,
                            struct ext_session_lock_surface_v1 *surf,
                            uint32_t serial, uint32_t w, uint32_t h) {
     struct lock_surface *ls = data;
+    struct gbcc *gbc = &ls->locker->gbcc;
     ls->width = w; ls->height = h;
+    ls->view.width = (int32_t)w;
+    ls->view.height = (int32_t)h;
 
-    printf("surf_configure() called with size %ux%u, serial=%u\n", w, h, serial);
+    gbcc_log_debug("surf_configure() called with size %ux%u, serial=%u\n", w, h, serial);
     ext_session_lock_surface_v1_ack_configure(surf, serial);
 
+    if (ls->shm_initialised) {
+        gbcc_shm_configure(&ls->shm, (int32_t)w, (int32_t)h, gbc->fractional_scaling);
+        ls->configured = true;
+        ls->redraw = true;
+        return;
+    }
+
+    if (ls->egl_win) {
+        /* A new mode, so the surface we have just needs resizing */
+        wl_egl_window_resize(ls->egl_win, (int)w, (int)h, 0, 0);
+        memset(ls->damage, 0, sizeof(ls->damage));
+        ls->redraw = true;
+        return;
+    }
 
-    ls->egl_win = wl_egl_window_create(ls->wl_surf, w, h);
+    ls->egl_win = wl_egl_window_create(ls->wl_surf, (int)w, (int)h);
     if (!ls->egl_win) {
 	    fprintf(stderr, "wl_egl_window_create failed\n");
 	    exit(1);
@@ -178,20 +341,252 @@ static void surf_configure(void *data,
     setup_gl(ls);
 
     ls->configured = true;
+    ls->redraw = true;
 }
 
 static const struct ext_session_lock_surface_v1_listener surf_listener = {
     surf_configure
 };
 
+void create_lock_surface(struct lock_surface *ls) {
+    struct locker *locker = ls->locker;
+    struct display *d = &locker->disp;
+    ls->wl_surf = wl_compositor_create_surface(d->compositor);
+    ls->surf = ext_session_lock_v1_get_lock_surface(locker->lock, ls->wl_surf, ls->output);
+    if (locker->gbcc.software_rendering) {
+        /* We're locked by now, so fall back rather than leave the output blank */
+        ls->shm_initialised = gbcc_shm_initialise(&ls->shm, d->shm, d->compositor,
+                d->subcompositor, d->viewporter, ls->wl_surf);
+        if (!ls->shm_initialised)
+            gbcc_log_warning("Couldn't set up shared memory for output %u, drawing it with GL.\n",
+                    ls->output_name);
+    }
+    ext_session_lock_surface_v1_add_listener(ls->surf, &surf_listener, ls);
+}
+
+static void log_output_stats(const struct lock_surface *ls) {
+    if (ls->stats.draws == 0)
+        return;
+    gbcc_log_debug("Output %u: %llu frames drawn, %.1f us CPU each.\n",
+            ls->output_name,
+            (unsigned long long)ls->stats.draws,
+            (double)ls->stats.cpu / (double)ls->stats.draws / 1000);
+}
+
+void destroy_lock_surface(struct lock_surface *ls) {
+    struct locker *locker = ls->locker;
+    log_output_stats(ls);
+    if (ls->frame_cb)
+        wl_callback_destroy(ls->frame_cb);
+    if (ls->egl_surf != EGL_NO_SURFACE) {
+        /* The next draw makes another surface current */
+        if (eglGetCurrentSurface(EGL_DRAW) == ls->egl_surf)
+            eglMakeCurrent(locker->egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroySurface(locker->egl_dpy, ls->egl_surf);
+    }
+    if (ls->egl_win)
+        wl_egl_window_destroy(ls->egl_win);
+    if (ls->shm_initialised)
+        gbcc_shm_destroy(&ls->shm);
+    if (ls->surf)
+        ext_session_lock_surface_v1_destroy(ls->surf);
+    if (ls->wl_surf)
+        wl_surface_destroy(ls->wl_surf);
+    wl_output_destroy(ls->output);
+    wl_list_remove(&ls->link);
+    free(ls);
+}
+
+
+static void frame_done(void *data, struct wl_callback *cb, uint32_t time) {
+    struct lock_surface *ls = data;
+    wl_callback_destroy(cb);
+    ls->frame_cb = NULL;
+}
 
-static void draw_gbcc(struct lock_surface *ls) {
-    struct gbcc *gbc = &ls->gbcc;
-    gbc->window.width = ls->width;
-    gbc->window.height = ls->height;
+static const struct wl_callback_listener frame_listener = {
+    frame_done
+};
 
-    gbcc_window_update(&ls->gbcc);
-    eglSwapBuffers(ls->egl_dpy, ls->egl_surf);
+static void rect_union(struct gbcc_window_rect *a, const struct gbcc_window_rect *b) {
+    if (b->width == 0 || b->height == 0)
+        return;
+    if (a->width == 0 || a->height == 0) {
+        *a = *b;
+        return;
+    }
+    int32_t x0 = a->x < b->x ? a->x : b->x;
+    int32_t y0 = a->y < b->y ? a->y : b->y;
+    int32_t x1 = a->x + a->width > b->x + b->width ? a->x + a->width : b->x + b->width;
+    int32_t y1 = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+    *a = (struct gbcc_window_rect){ x0, y0, x1 - x0, y1 - y0 };
+}
+
+/*
+ * With partial update, only the damaged region of the back buffer is
+ * rendered, so it must also cover everything that changed since the buffer
+ * was last ours, as given by its age.
+ */
+static void set_damage_region(struct lock_surface *ls, const struct gbcc_window_rect *damage) {
+    struct locker *locker = ls->locker;
+    EGLint age = 0;
+    if (!eglQuerySurface(locker->egl_dpy, ls->egl_surf, EGL_BUFFER_AGE_KHR, &age))
+        age = 0;
+
+    struct gbcc_window_rect region = *damage;
+    if (age <= 0 || age > DAMAGE_HISTORY) {
+        region = (struct gbcc_window_rect){ 0, 0, (int32_t)ls->width, (int32_t)ls->height };
+    } else {
+        for (EGLint i = 0; i < age - 1; i++)
+            rect_union(&region, &ls->damage[i]);
+    }
+    EGLint rect[4] = { region.x, region.y, region.width, region.height };
+    locker->set_damage_region(locker->egl_dpy, ls->egl_surf, rect, 1);
+}
+
+static void draw_gbcc(struct lock_surface *ls, const struct gbcc_frame *frame) {
+    struct locker *locker = ls->locker;
+    struct gbcc *gbc = &locker->gbcc;
+
+    gbcc_window_prepare(gbc, &ls->view, frame);
+    struct gbcc_window_rect damage = ls->view.damage;
+    if (damage.width == 0 || damage.height == 0) {
+        /* Nothing changed, so don't bother the compositor */
+        ls->redraw = false;
+        return;
+    }
+
+    if (!make_current(ls))
+        return;
+    if (locker->set_damage_region)
+        set_damage_region(ls, &damage);
+    gbcc_window_draw(gbc, &ls->view);
+
+    /* Must be requested before the swap commits the surface */
+    ls->frame_cb = wl_surface_frame(ls->wl_surf);
+    wl_callback_add_listener(ls->frame_cb, &frame_listener, ls);
+    if (locker->swap_with_damage) {
+        EGLint rect[4] = { damage.x, damage.y, damage.width, damage.height };
+        locker->swap_with_damage(locker->egl_dpy, ls->egl_surf, rect, 1);
+    } else {
+        eglSwapBuffers(locker->egl_dpy, ls->egl_surf);
+    }
+    memmove(&ls->damage[1], &ls->damage[0], (DAMAGE_HISTORY - 1) * sizeof(ls->damage[0]));
+    ls->damage[0] = damage;
+    ls->redraw = false;
+}
+
+/*
+ * The compositor does all the scaling, so drawing is just a copy of the
+ * frame into whichever buffer it has finished with. Buffers aren't shared
+ * between outputs, as each is only released once its own output is done
+ * with it, but the copy is small.
+ */
+static void draw_shm(struct lock_surface *ls, const struct gbcc_frame *frame) {
+    struct gbcc_shm_buffer *buffer = gbcc_shm_next_buffer(&ls->shm);
+    if (!buffer) {
+        /* We'll be woken by a buffer being released */
+        return;
+    }
+    gbcc_shm_attach(&ls->shm, buffer, frame->pixels, ls->locker->fade);
+    ls->frame_cb = wl_surface_frame(ls->shm.screen);
+    wl_callback_add_listener(ls->frame_cb, &frame_listener, ls);
+    wl_surface_commit(ls->shm.screen);
+    ls->view.drawn_width = ls->view.width;
+    ls->view.drawn_height = ls->view.height;
+    ls->view.drawn_frame = frame->number;
+    ls->redraw = false;
+}
+
+/*
+ * Draw a new frame on every output that's ready for one. Frames are only
+ * taken from the emulator while some output can show them, so that syncing
+ * to video follows the fastest output rather than running free. The frame
+ * is taken once per pass, so the outputs drawn together show the same one.
+ */
+static void draw_outputs(struct locker *locker) {
+    struct gbcc *gbc = &locker->gbcc;
+    struct lock_surface *ls;
+    bool ready = false;
+    wl_list_for_each(ls, &locker->surfaces, link) {
+        ready |= ls->configured && !ls->frame_cb;
+    }
+    if (!ready)
+        return;
+
+    const struct gbcc_frame *frame = gbcc_mailbox_acquire(gbc->core.ppu.mailbox, NULL);
+    wl_list_for_each(ls, &locker->surfaces, link) {
+        if (!ls->configured || ls->frame_cb)
+            continue;
+        if (!ls->redraw && ls->view.drawn_width != 0 && frame->number == ls->view.drawn_frame)
+            continue;
+        struct timespec start;
+        struct timespec end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+        if (ls->shm_initialised)
+            draw_shm(ls, frame);
+        else
+            draw_gbcc(ls, frame);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+        if (ls->frame_cb) {
+            ls->stats.draws++;
+            ls->stats.cpu += gbcc_time_diff(&end, &start);
+        }
+    }
+}
+
+/*
+ * Runs the fade out and unlock once quitting has been asked for. The timer
+ * keeps redrawing at the Game Boy's frame rate meanwhile, so the animation
+ * plays even if emulation is paused.
+ */
+static void update_unlock(struct locker *locker) {
+    struct gbcc *gbc = &locker->gbcc;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (!locker->quitting) {
+        locker->quitting = true;
+        locker->quit_time = now;
+        struct itimerspec tick = {
+            .it_interval = { .tv_nsec = GBC_FRAME_PERIOD },
+            .it_value = { .tv_nsec = GBC_FRAME_PERIOD }
+        };
+        if (timerfd_settime(locker->timer_fd, 0, &tick, NULL) < 0) {
+            gbcc_log_error("Failed to start unlock timer: %s\n", strerror(errno));
+        }
+    }
+
+    double elapsed = gbcc_time_diff(&now, &locker->quit_time) / 1e9;
+    if (elapsed >= 0.6 && elapsed < 1.3) {
+        gbc->animating = true;
+        locker->fade = (float)(elapsed - 0.6) / 1.8f;
+    } else if (elapsed >= 1.4) {
+        locker->running = false;
+        gbc->quit = true;
+        ext_session_lock_v1_unlock_and_destroy(locker->lock);
+        locker->lock = NULL;
+    }
+    struct lock_surface *ls;
+    wl_list_for_each(ls, &locker->surfaces, link) {
+        ls->redraw = true;
+    }
+}
+
+static bool watch_fd(int epoll_fd, int fd, uint32_t events, enum loop_source source) {
+    struct epoll_event ev = { .events = events, .data.u32 = source };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        gbcc_log_error("Failed to watch fd %d: %s\n", fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static void drain_fd(int fd) {
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        gbcc_log_error("Failed to read fd %d: %s\n", fd, strerror(errno));
+    }
 }
 
 static void seat_handle_capabilities(void *d, struct wl_seat *s, uint32_t caps) {}
@@ -211,38 +606,41 @@ static void keyboard_key(void *d, struct wl_keyboard *k,
                          uint32_t serial, uint32_t time,
                          uint32_t key, uint32_t state) {
 
-    struct lock_surface *ls = d;
+    struct locker *locker = d;
     bool pressed = (state == WL_KEYBOARD_KEY_STATE_PRESSED);
 
     // process input
     switch (key) {
         case 44: 
-            gbcc_input_process_key(&ls->gbcc, GBCC_KEY_A, pressed);
+            gbcc_input_process_key(&locker->gbcc, GBCC_KEY_A, pressed);
             break;
         case 45: 
-            gbcc_input_process_key(&ls->gbcc, GBCC_KEY_B, pressed);
+            gbcc_input_process_key(&locker->gbcc, GBCC_KEY_B, pressed);
             break;
         case 28: 
-            gbcc_input_process_key(&ls->gbcc, GBCC_KEY_START, pressed);
+            gbcc_input_process_key(&locker->gbcc, GBCC_KEY_START, pressed);
             break;
         case 57: 
-            gbcc_input_process_key(&ls->gbcc, GBCC_KEY_SELECT, pressed);
+            gbcc_input_process_key(&locker->gbcc, GBCC_KEY_SELECT, pressed);
             break;
         case 103: 
-            gbcc_input_process_key(&ls->gbcc, GBCC_KEY_UP, pressed);
+            gbcc_input_process_key(&locker->gbcc, GBCC_KEY_UP, pressed);
             break;
         case 108: 
-            gbcc_input_process_key(&ls->gbcc, GBCC_KEY_DOWN, pressed);
+            gbcc_input_process_key(&locker->gbcc, GBCC_KEY_DOWN, pressed);
             break;
         case 105: 
-            gbcc_input_process_key(&ls->gbcc, GBCC_KEY_LEFT, pressed);
+            gbcc_input_process_key(&locker->gbcc, GBCC_KEY_LEFT, pressed);
             break;
         case 106: 
-            gbcc_input_process_key(&ls->gbcc, GBCC_KEY_RIGHT, pressed);
+            gbcc_input_process_key(&locker->gbcc, GBCC_KEY_RIGHT, pressed);
+            break;
+        case 50: // M
+            gbcc_input_process_key(&locker->gbcc, GBCC_KEY_MUTE, pressed);
             break;
         case 1: // ESC
             if (pressed) {
-		    ls->should_quit = true;
+		    locker->should_quit = true;
             }
             break;
     }
@@ -262,104 +660,202 @@ static const struct wl_keyboard_listener kbd_listener = {
 
 int main(int argc, char **argv) {
 
-    struct lock_surface ls = { .running = true};
+    static struct locker locker = { .running = true, .egl_ctx = EGL_NO_CONTEXT };
+    wl_list_init(&locker.surfaces);
 
     // init gbcc
-    struct gbcc *gbc = &ls.gbcc;
+    struct gbcc *gbc = &locker.gbcc;
     if (!gbcc_parse_args(gbc, true, argc, argv)) {
 	    exit(EXIT_FAILURE);
     }
     gbc->quit = false;
 
-    gbcc_audio_initialise(gbc, 96000, 2048);
+    gbcc_audio_initialise(gbc);
+
+    /* Signalled by the emulation thread each time a frame is ready */
+    int frame_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    locker.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (frame_fd < 0 || locker.timer_fd < 0 || epoll_fd < 0) {
+        gbcc_log_error("Failed to create event fds: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    gbcc_mailbox_set_notify(gbc->core.ppu.mailbox, frame_fd);
+
+    struct display *d = &locker.disp;
+    d->wl_display = wl_display_connect(NULL);
+    d->registry = wl_display_get_registry(d->wl_display);
+    wl_registry_add_listener(d->registry, &registry_listener, &locker);
+    wl_display_roundtrip(d->wl_display);
+
+    if(!d->lock_mgr || !d->compositor || !d->seat || wl_list_empty(&locker.surfaces)) {
+        fprintf(stderr,"Missing Wayland globals\n");
+        return 1;
+    }
+    if (gbc->software_rendering && (!d->shm || !d->subcompositor || !d->viewporter)) {
+        gbcc_log_warning("Compositor lacks wl_shm, wl_subcompositor or wp_viewporter, "
+                "falling back to GL.\n");
+        gbc->software_rendering = false;
+    }
+    enum gbcc_pixel_format format;
+    if (gbc->software_rendering) {
+        /* Frames can then be copied into shared memory as they are */
+        format = GBCC_PIXEL_XRGB8888;
+    } else {
+        /* A quarter of the size to upload, coloured in by the GPU */
+        format = GBCC_PIXEL_INDEXED8;
+    }
+    if (!gbcc_ppu_set_pixel_format(&gbc->core, format)) {
+        gbcc_log_warning("Couldn't change the frame format, frames stay RGBA.\n");
+    }
 
+    /* Started now that the frame format is settled */
     pthread_t emu_thread;
     pthread_create(&emu_thread, NULL, gbcc_emulation_loop, gbc);
     pthread_setname_np(emu_thread, "EmulationThread");
 
-    printf("success initialization of gbcc\n");
+    gbcc_log_debug("success initialization of gbcc\n");
 
-    struct display d = {0};
-    d.wl_display = wl_display_connect(NULL);
-    d.registry = wl_display_get_registry(d.wl_display);
-    wl_registry_add_listener(d.registry, &registry_listener, &d);
-    wl_display_roundtrip(d.wl_display);
+    locker.lock = ext_session_lock_manager_v1_lock(d->lock_mgr);
+    ext_session_lock_v1_add_listener(locker.lock, &lock_listener, &locker);
 
-    if(!d.lock_mgr || !d.compositor || !d.seat || !d.output) {
-        fprintf(stderr,"Missing Wayland globals\n");
-        return 1;
+    // printf("First roundtrip\n");
+    wl_display_roundtrip(d->wl_display);
+
+    /* Any outputs added from now on get theirs as they appear */
+    struct lock_surface *ls;
+    struct lock_surface *tmp;
+    wl_list_for_each(ls, &locker.surfaces, link) {
+        if (!ls->surf)
+            create_lock_surface(ls);
     }
-    ls.disp = &d; 
-    struct ext_session_lock_v1 *lock = ext_session_lock_manager_v1_lock(d.lock_mgr);
-    ls.lock = lock;
-//    struct lock_surface ls = { .disp = &d, .lock = lock, .running = true};
 
-    ext_session_lock_v1_add_listener(lock, &lock_listener, &ls);
+    // printf("Second roundtrip\n");
+    wl_display_roundtrip(d->wl_display);
 
-    // printf("First roundtrip\n");
-    wl_display_roundtrip(d.wl_display);
+    wl_seat_add_listener(d->seat, &seat_listener, d);
+    struct wl_keyboard *kbd = wl_seat_get_keyboard(d->seat);
+    wl_keyboard_add_listener(kbd, &kbd_listener, &locker);
 
-    ls.wl_surf = wl_compositor_create_surface(d.compositor);
-    ls.surf = ext_session_lock_v1_get_lock_surface(lock, ls.wl_surf, d.output);
-    ext_session_lock_surface_v1_add_listener(ls.surf, &surf_listener, &ls);
+    int display_fd = wl_display_get_fd(d->wl_display);
+    if (!watch_fd(epoll_fd, display_fd, EPOLLIN, SOURCE_DISPLAY)
+            || !watch_fd(epoll_fd, frame_fd, EPOLLIN, SOURCE_FRAME)
+            || !watch_fd(epoll_fd, locker.timer_fd, EPOLLIN, SOURCE_TIMER)) {
+        locker.running = false;
+    }
 
-    // printf("Second roundtrip\n");
-    wl_display_roundtrip(d.wl_display);
-
-    wl_seat_add_listener(d.seat, &seat_listener, &d);
-    struct wl_keyboard *kbd = wl_seat_get_keyboard(d.seat);
-    wl_keyboard_add_listener(kbd, &kbd_listener, &ls);
-
-    double time = 0;
-    double elapsed_time = 0;
-    clock_t start,end;
-    while(ls.running && wl_display_dispatch(d.wl_display) != -1) {
-	start = clock();
-	wl_display_dispatch_pending(ls.disp->wl_display);
-        draw_gbcc(&ls);
-
-	uint8_t m = gbcc_memory_read(&gbc->core, 0xDCC7);
-	if (m == 99) {
-		ls.should_quit = true;
-	}
-	if (ls.should_quit) {
-		time += elapsed_time;
-		if (time >= 0.6 && time < 1.3) {
-			gbc->animating = true;
-		} else if (time >= 1.4) {
-			ls.running = false;
-			gbc->quit = true;
-			ext_session_lock_v1_unlock_and_destroy(ls.lock);
-		}
-	}
-	usleep(16000); 
-	wl_display_flush(d.wl_display);
-	end = clock();
-	elapsed_time = ((double)(end - start)) / CLOCKS_PER_SEC; 
-    }
-
-    wl_display_flush(d.wl_display);
+    /*
+     * Sleep until there's something to do, then draw on each output only if
+     * there's a new emulator frame (or an animation to play) and the
+     * compositor has shown its last one, so each output is presented at its
+     * own refresh rate.
+     */
+    bool want_write = false;
+    while (locker.running) {
+        while (wl_display_prepare_read(d->wl_display) != 0) {
+            wl_display_dispatch_pending(d->wl_display);
+        }
+        bool blocked = false;
+        if (wl_display_flush(d->wl_display) < 0) {
+            if (errno != EAGAIN) {
+                wl_display_cancel_read(d->wl_display);
+                break;
+            }
+            /* Socket's full, so wait until we can send the rest */
+            blocked = true;
+        }
+        if (blocked != want_write) {
+            struct epoll_event ev = {
+                .events = EPOLLIN | (blocked ? EPOLLOUT : 0),
+                .data.u32 = SOURCE_DISPLAY
+            };
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, display_fd, &ev);
+            want_write = blocked;
+        }
+
+        struct epoll_event events[3];
+        int n = epoll_wait(epoll_fd, events, 3, -1);
+        if (n < 0) {
+            wl_display_cancel_read(d->wl_display);
+            if (errno == EINTR) {
+                continue;
+            }
+            gbcc_log_error("epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+
+        bool readable = false;
+        for (int i = 0; i < n; i++) {
+            switch (events[i].data.u32) {
+                case SOURCE_DISPLAY:
+                    readable = events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP);
+                    break;
+                case SOURCE_FRAME:
+                    drain_fd(frame_fd);
+                    break;
+                case SOURCE_TIMER:
+                    drain_fd(locker.timer_fd);
+                    break;
+            }
+        }
+        if (readable) {
+            if (wl_display_read_events(d->wl_display) < 0) {
+                gbcc_log_error("Lost connection to the compositor.\n");
+                break;
+            }
+        } else {
+            wl_display_cancel_read(d->wl_display);
+        }
+        if (wl_display_dispatch_pending(d->wl_display) < 0) {
+            break;
+        }
+
+        uint8_t m = gbcc_memory_read(&gbc->core, 0xDCC7);
+        if (m == 99) {
+            locker.should_quit = true;
+        }
+        if (locker.should_quit) {
+            update_unlock(&locker);
+        }
+
+        if (locker.running) {
+            draw_outputs(&locker);
+        }
+    }
+
+    /*
+     * Wait for the compositor to have read the unlock: it drops a client
+     * that hangs up without reading what's left, which would keep the
+     * session locked.
+     */
+    wl_display_roundtrip(d->wl_display);
 
     // end gbcc
-    sem_post(&gbc->core.ppu.vsync_semaphore);
+    gbcc_mailbox_close(gbc->core.ppu.mailbox);
     pthread_join(emu_thread, NULL);
     gbcc_audio_destroy(gbc);
 
-    if (ls.egl_surf != EGL_NO_SURFACE)
-	    eglDestroySurface(ls.egl_dpy, ls.egl_surf);
-    if (ls.egl_ctx != EGL_NO_CONTEXT)
-	    eglDestroyContext(ls.egl_dpy, ls.egl_ctx);
-    if (ls.egl_dpy != EGL_NO_DISPLAY)
-	    eglTerminate(ls.egl_dpy);
-    if (ls.egl_win)
-	    wl_egl_window_destroy(ls.egl_win);
+    if (!gbc->software_rendering) {
+        const struct gbcc_window *win = &gbc->window;
+        gbcc_log_debug("%llu frames uploaded for all outputs, %llu palettes, %.1f us each.\n",
+                (unsigned long long)win->uploads,
+                (unsigned long long)win->palette_uploads,
+                win->uploads ? (double)win->upload_time_total / (double)win->uploads / 1e3 : 0.0);
+    }
+    wl_list_for_each_safe(ls, tmp, &locker.surfaces, link) {
+        destroy_lock_surface(ls);
+    }
+    if (locker.egl_ctx != EGL_NO_CONTEXT)
+	    eglDestroyContext(locker.egl_dpy, locker.egl_ctx);
+    if (locker.egl_dpy != EGL_NO_DISPLAY)
+	    eglTerminate(locker.egl_dpy);
     if (kbd)
 	    wl_keyboard_destroy(kbd);
-    if (ls.wl_surf)
-	    wl_surface_destroy(ls.wl_surf);
 
-    wl_display_disconnect(d.wl_display);
+    wl_display_disconnect(d->wl_display);
+    close(epoll_fd);
+    close(locker.timer_fd);
+    close(frame_fd);
 
     return 0;
 }
-
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#include "shm.h"
+#include "../constants.h"
+#include "../debug.h"
+#include "../nelem.h"
+#include "../viewporter-client-protocol.h"
+#include "../window.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define STRIDE (GBC_SCREEN_WIDTH * sizeof(uint32_t))
+#define FRAME_BYTES (GBC_SCREEN_HEIGHT * STRIDE)
+#define BLACK 0xFF000000u
+
+static void buffer_release(void *data, struct wl_buffer *buffer);
+
+static const struct wl_buffer_listener buffer_listener = {
+	buffer_release
+};
+
+bool gbcc_shm_initialise(struct gbcc_shm *shm, struct wl_shm *wl_shm,
+		struct wl_compositor *compositor, struct wl_subcompositor *subcompositor,
+		struct wp_viewporter *viewporter, struct wl_surface *surface)
+{
+	*shm = (struct gbcc_shm){0};
+
+	/* The frames, followed by the single background pixel */
+	shm->size = GBCC_SHM_BUFFERS * FRAME_BYTES + sizeof(uint32_t);
+	int fd = memfd_create("gbcc-shm", MFD_CLOEXEC);
+	if (fd < 0) {
+		gbcc_log_error("Failed to create shared memory: %s\n", strerror(errno));
+		return false;
+	}
+	if (ftruncate(fd, (off_t)shm->size) < 0) {
+		gbcc_log_error("Failed to size shared memory: %s\n", strerror(errno));
+		close(fd);
+		return false;
+	}
+	shm->data = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (shm->data == MAP_FAILED) {
+		gbcc_log_error("Failed to map shared memory: %s\n", strerror(errno));
+		shm->data = NULL;
+		close(fd);
+		return false;
+	}
+
+	/* Buffers keep the pool's memory alive, so it isn't needed after this */
+	struct wl_shm_pool *pool = wl_shm_create_pool(wl_shm, fd, (int32_t)shm->size);
+	for (size_t i = 0; i < N_ELEM(shm->buffers); i++) {
+		struct gbcc_shm_buffer *buf = &shm->buffers[i];
+		buf->pixels = (uint32_t *)((uint8_t *)shm->data + i * FRAME_BYTES);
+		buf->buffer = wl_shm_pool_create_buffer(pool, (int32_t)(i * FRAME_BYTES),
+				GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT, (int32_t)STRIDE,
+				WL_SHM_FORMAT_XRGB8888);
+		wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
+	}
+	uint32_t *background = (uint32_t *)((uint8_t *)shm->data + GBCC_SHM_BUFFERS * FRAME_BYTES);
+	*background = BLACK;
+	shm->background = wl_shm_pool_create_buffer(pool, GBCC_SHM_BUFFERS * FRAME_BYTES,
+			1, 1, sizeof(uint32_t), WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	shm->surface = surface;
+	shm->surface_viewport = wp_viewporter_get_viewport(viewporter, surface);
+	shm->screen = wl_compositor_create_surface(compositor);
+	shm->screen_viewport = wp_viewporter_get_viewport(viewporter, shm->screen);
+	shm->subsurface = wl_subcompositor_get_subsurface(subcompositor, shm->screen, surface);
+	/* Let frames be shown without committing the lock surface too */
+	wl_subsurface_set_desync(shm->subsurface);
+	return true;
+}
+
+void gbcc_shm_destroy(struct gbcc_shm *shm)
+{
+	if (shm->subsurface) {
+		wl_subsurface_destroy(shm->subsurface);
+	}
+	if (shm->screen_viewport) {
+		wp_viewport_destroy(shm->screen_viewport);
+	}
+	if (shm->surface_viewport) {
+		wp_viewport_destroy(shm->surface_viewport);
+	}
+	if (shm->screen) {
+		wl_surface_destroy(shm->screen);
+	}
+	for (size_t i = 0; i < N_ELEM(shm->buffers); i++) {
+		if (shm->buffers[i].buffer) {
+			wl_buffer_destroy(shm->buffers[i].buffer);
+		}
+	}
+	if (shm->background) {
+		wl_buffer_destroy(shm->background);
+	}
+	if (shm->data) {
+		munmap(shm->data, shm->size);
+	}
+	*shm = (struct gbcc_shm){0};
+}
+
+void gbcc_shm_configure(struct gbcc_shm *shm, int32_t width, int32_t height, bool fractional)
+{
+	struct gbcc_window_rect viewport = gbcc_window_layout(width, height, fractional);
+
+	wp_viewport_set_destination(shm->screen_viewport, viewport.width, viewport.height);
+	wl_surface_commit(shm->screen);
+
+	/* The layout's y is from the bottom, as for GL */
+	wl_subsurface_set_position(shm->subsurface, viewport.x, height - viewport.y - viewport.height);
+	wp_viewport_set_destination(shm->surface_viewport, width, height);
+	wl_surface_attach(shm->surface, shm->background, 0, 0);
+	wl_surface_damage_buffer(shm->surface, 0, 0, 1, 1);
+	wl_surface_commit(shm->surface);
+}
+
+struct gbcc_shm_buffer *gbcc_shm_next_buffer(struct gbcc_shm *shm)
+{
+	for (size_t i = 0; i < N_ELEM(shm->buffers); i++) {
+		if (!shm->buffers[i].busy) {
+			return &shm->buffers[i];
+		}
+	}
+	return NULL;
+}
+
+void gbcc_shm_attach(struct gbcc_shm *shm, struct gbcc_shm_buffer *buffer, const uint32_t *pixels, float fade)
+{
+	if (fade <= 0) {
+		memcpy(buffer->pixels, pixels, FRAME_BYTES);
+	} else {
+		/* Scale red & blue together, then green, in 8.8 fixed point */
+		uint32_t keep = fade >= 1 ? 0 : (uint32_t)((1 - fade) * 256);
+		for (size_t i = 0; i < GBC_SCREEN_SIZE; i++) {
+			uint32_t p = pixels[i];
+			uint32_t rb = (((p & 0x00FF00FFu) * keep) >> 8) & 0x00FF00FFu;
+			uint32_t g = (((p & 0x0000FF00u) * keep) >> 8) & 0x0000FF00u;
+			buffer->pixels[i] = BLACK | rb | g;
+		}
+	}
+	wl_surface_attach(shm->screen, buffer->buffer, 0, 0);
+	wl_surface_damage_buffer(shm->screen, 0, 0, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT);
+	buffer->busy = true;
+}
+
+void buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct gbcc_shm_buffer *buf = data;
+	buf->busy = false;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2025 Adonis Najimi
+ *
+ * Licensed under the GPLv3 License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/license/gpl-3-0
+ *
+ */
+
+#ifndef GBCC_WAYLAND_SHM_H
+#define GBCC_WAYLAND_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#define GBCC_SHM_BUFFERS 3
+
+struct wp_viewport;
+struct wp_viewporter;
+
+struct gbcc_shm_buffer {
+	struct wl_buffer *buffer;
+	uint32_t *pixels;	/* GBC_SCREEN_SIZE XRGB8888 pixels */
+	bool busy;		/* Held by the compositor until released */
+};
+
+/*
+ * Presents frames without any GL at all. The lock surface just shows a
+ * single black pixel stretched over the whole output, and the Game Boy
+ * screen is a subsurface showing a native 160x144 buffer, which the
+ * compositor scales up with wp_viewporter. Frames are copied straight from
+ * the ppu, which must be writing XRGB8888.
+ */
+struct gbcc_shm {
+	struct wl_surface *surface;	/* The lock surface */
+	struct wl_surface *screen;
+	struct wl_subsurface *subsurface;
+	struct wp_viewport *surface_viewport;
+	struct wp_viewport *screen_viewport;
+	struct wl_buffer *background;
+	struct gbcc_shm_buffer buffers[GBCC_SHM_BUFFERS];
+	void *data;		/* Mapping of the whole pool */
+	size_t size;
+};
+
+bool gbcc_shm_initialise(struct gbcc_shm *shm, struct wl_shm *wl_shm,
+		struct wl_compositor *compositor, struct wl_subcompositor *subcompositor,
+		struct wp_viewporter *viewporter, struct wl_surface *surface);
+void gbcc_shm_destroy(struct gbcc_shm *shm);
+
+/* Lay the screen out for a new surface size, once the configure is acked */
+void gbcc_shm_configure(struct gbcc_shm *shm, int32_t width, int32_t height, bool fractional);
+
+/* A buffer the compositor isn't using, or NULL if they're all busy */
+struct gbcc_shm_buffer *gbcc_shm_next_buffer(struct gbcc_shm *shm);
+
+/*
+ * Copy a frame into buffer, faded towards black by fade (0 to 1), and attach
+ * it to the screen. Committing the screen surface is left to the caller.
+ */
+void gbcc_shm_attach(struct gbcc_shm *shm, struct gbcc_shm_buffer *buffer, const uint32_t *pixels, float fade);
+
+#endif /* GBCC_WAYLAND_SHM_H */
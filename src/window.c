@@ -27,9 +27,12 @@
 #include "constants.h"
 #include "debug.h"
 #include "fontmap.h"
+#include "mailbox.h"
 #include "memory.h"
 #include "nelem.h"
+#include "pixel.h"
 #include "screenshot.h"
+#include "shader.h"
 #include "time_diff.h"
 #include "window.h"
 #ifdef __ANDROID__
@@ -38,118 +41,61 @@
 #else
 #include <GLES2/gl2.h>
 #endif
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h>
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
-#ifndef SHADER_PATH
-#define SHADER_PATH "shaders/"
-#endif
+/* The ring's a few frames deep, so this should only be hit if the GPU hangs */
+#define PBO_FENCE_TIMEOUT (100 * 1000 * 1000)
+#define PALETTE_SIZE (GBC_SCREEN_HEIGHT * GBCC_PIXEL_PALETTE_SIZE * sizeof(uint32_t))
+
+/* Effects that mix each frame with the last, as a mask */
+#define EFFECT_FRAME_BLENDING (1u << 0)
+#define EFFECT_INTERLACING (1u << 1)
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 static void update_timers(struct gbcc *gbc);
-
-GLuint compileShader(GLenum type, const char* src) {
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &src, NULL);
-    glCompileShader(shader);
-    
-    GLint compiled;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
-    if (!compiled) {
-        char buffer[512];
-        glGetShaderInfoLog(shader, 512, NULL, buffer);
-        printf("Shader compile error: %s\n", buffer);
-        exit(1);
-    }
-    return shader;
-}
-
-GLuint createProgram(const char* vsSrc, const char* fsSrc) {
-    GLuint vs = compileShader(GL_VERTEX_SHADER, vsSrc);
-    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fsSrc);
-
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vs);
-    glAttachShader(program, fs);
-    glLinkProgram(program);
-
-    GLint linked;
-    glGetProgramiv(program, GL_LINK_STATUS, &linked);
-    if (!linked) {
-        char buffer[512];
-        glGetProgramInfoLog(program, 512, NULL, buffer);
-        printf("Program link error: %s\n", buffer);
-        exit(1);
-    }
-
-    glDeleteShader(vs);
-    glDeleteShader(fs);
-    return program;
-} 
-
-
-    float quad[] = {
-        -1, -1, 0, 1,
-         1, -1, 1, 1,
-        -1,  1, 0, 0,
-         1,  1, 1, 0
-    };
-
-// Vertex shader
-const char* vertex_shader_src =
-    "attribute vec2 aPos;\n"
-    "attribute vec2 aTex;\n"
-    "varying vec2 vTex;\n"
-    "void main() {\n"
-    "  gl_Position = vec4(aPos, 0.0, 1.0);\n"
-    "  vTex = aTex;\n"
-    "}\n";
-
-// Fragment shader
-const char* fragment_shader_src =
-    "precision mediump float;\n"
-    "varying vec2 vTex;\n"
-    "uniform sampler2D tex;\n"
-    "void main() {\n"
-    "  gl_FragColor = texture2D(tex, vTex);\n"
-    "}\n";
-
-
-const char* vert_fade_out = 
-"attribute vec2 aPos;\n"
-"varying vec2 uv;\n"
-"void main() {\n"
-"    uv = aPos * 0.5 + 0.5;\n"
-"    gl_Position = vec4(aPos, 0.0, 1.0);\n"
-"}\n";
-
-
-const char* frag_fade_out_rainbow =
-"precision mediump float;\n"
-"varying vec2 uv;\n"
-"uniform float time;\n"
-"void main() {\n"
-"    float fade = clamp(time / 5.0, 0.0, 1.0);\n"
-"    vec3 baseColor = vec3(uv.x, uv.y, 0.5);\n"
-"    vec3 finalColor = mix(baseColor, vec3(0.0), fade);\n"
-"    gl_FragColor = vec4(finalColor, 1.0);\n"
-"}\n";
-
-const char* frag_fade_out =
-    "precision mediump float;\n"
-    "uniform float time;\n"
-    "void main() {\n"
-    "    float alpha = clamp(time / 1.8, 0.0, 1.0);\n"
-    "    vec3 color = vec3(0.0);\n"
-    "    gl_FragColor = vec4(color, alpha);\n"
-    "}\n";
+static void get_texture_format(enum gbcc_pixel_format format, GLenum *gl_format, GLenum *gl_type);
+static bool vertex_arrays_supported(void);
+static void pass_initialise(struct gbcc_window *win, struct gbcc_gl_pass *pass, GLuint program,
+		const GLfloat *data, GLsizeiptr size, GLsizei components, GLuint ebo);
+static void pass_bind(const struct gbcc_gl_pass *pass);
+static void pass_set_attributes(const struct gbcc_gl_pass *pass);
+static void pass_destroy(struct gbcc_gl_pass *pass);
+static void init_shaders(struct gbcc_window *win);
+static void init_pre_pass(struct gbcc_window *win);
+static void init_lut(struct gbcc_window *win);
+static void init_palette(struct gbcc_window *win);
+static void init_blend(struct gbcc_window *win, bool indexed);
+static void create_frame_texture(struct gbcc_window *win, GLuint *texture);
+static bool create_render_target(GLuint *fbo, GLuint *texture);
+static void render_to_texture(GLuint fbo, const struct gbcc_gl_pass *pass);
+static void render_blend(struct gbcc_window *win, GLuint source, GLuint last, unsigned effects);
+static unsigned frame_effects(const struct gbcc *gbc);
+static void swap_frames(struct gbcc_window *win);
+static void init_pixel_buffers(struct gbcc *gbc);
+static void destroy_pixel_buffers(struct gbcc_window *win);
+static void upload_frame(struct gbcc_window *win, bool indexed);
+static bool stream_frame(struct gbcc_window *win, bool palette);
+static bool shader_name_matches(const char *name, const char *query);
+
+/* The built-in shaders, in the order they're cycled through */
+static const struct {
+	const char *name;
+	const char *pre;	/* Fragment shader for the pre pass, if any */
+	const char *frag;	/* Fragment shader for the main pass, if any */
+} shader_files[] = {
+	{"Nothing", NULL, "nothing.frag"},
+	{"Subpixel", NULL, "subpixel.frag"},
+	{"Colour Correct", "colour-correct.frag", NULL},
+	{"Dot Matrix", NULL, "dotmatrix.frag"}
+};
 
 float vertices[] = {
     // pos     // tex
@@ -186,6 +132,15 @@ GLuint loadTexture(const char *filename) {
     return textureId;
 }
 
+/* Fills the framebuffer object, the right way up as it's only sampled */
+GLfloat pre_pass_vertices[] = {
+	// pos     // tex
+	-1.0f, -1.0f,  0.0f, 0.0f,
+	 1.0f, -1.0f,  1.0f, 0.0f,
+	-1.0f,  1.0f,  0.0f, 1.0f,
+	 1.0f,  1.0f,  1.0f, 1.0f
+};
+
 GLfloat quadVertices[] = {
     -1.0f, -1.0f,
      1.0f, -1.0f,
@@ -193,55 +148,21 @@ GLfloat quadVertices[] = {
      1.0f,  1.0f
 };
 
-GLuint simple_program;
-GLuint fadeout_program;
-
-GLuint texBanner;
-GLuint vboBanner;
-GLuint vboFadeout;
-GLuint fadeOuttimeLoc;
-GLuint fadeOutAposLoc;
+float currentTime;
 
 void init_fadeout(struct gbcc *gbc) {
-	fadeout_program = createProgram(vert_fade_out, frag_fade_out);
-
-	glGenBuffers(1, &vboFadeout);
-	glBindBuffer(GL_ARRAY_BUFFER, vboFadeout);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
-
-	fadeOutAposLoc = glGetAttribLocation(fadeout_program, "aPos");
-	glEnableVertexAttribArray(fadeOutAposLoc);
-	glVertexAttribPointer(fadeOutAposLoc, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (void*)0);
-
-	fadeOuttimeLoc = glGetUniformLocation(fadeout_program, "time");
-
+	struct gbcc_window *win = &gbc->window;
+	GLuint program = gbcc_shader_program("fade.vert", "fade.frag");
+	pass_initialise(win, &win->gl.fadeout, program, quadVertices, sizeof(quadVertices), 2, 0);
 }
 
-float currentTime;
 void render_fadeout(struct gbcc *gbc) {
 	if (!gbc->animating)
 		return;
 
-	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	struct fps_counter *fps = &gbc->window.fps;
-
-	glBindBuffer(GL_ARRAY_BUFFER, vboFadeout);
-	fadeOutAposLoc = glGetAttribLocation(fadeout_program, "aPos");
-	glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
-	glEnableVertexAttribArray(fadeOutAposLoc);
-	glVertexAttribPointer(fadeOutAposLoc, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (void*)0);
-
-	currentTime += fps->dt;
-
-	if (currentTime > 5) {
-		gbc->animating = false;
-	}
-
-	glUseProgram(fadeout_program);
-	glUniform1f(fadeOuttimeLoc, currentTime);
+	struct gbcc_window *win = &gbc->window;
+	pass_bind(&win->gl.fadeout);
+	glUniform1f(win->gl.fadeout.time, currentTime);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
@@ -256,103 +177,531 @@ void init_banner(struct gbcc *gbc) {
 		-1.0f,  0.8f,  0.0f, 1.0f,  // Bas gauche
 		1.0f,  0.8f,  1.0f, 1.0f   // Bas droit
 	};
-	glGenBuffers(1, &vboBanner);
-	glBindBuffer(GL_ARRAY_BUFFER, vboBanner);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(banner_vertices), banner_vertices, GL_STATIC_DRAW);
+	/* Drawn as-is, like the screen without a shader */
+	pass_initialise(win, &win->gl.banner, win->gl.shaders[0].pass.program, banner_vertices, sizeof(banner_vertices), 4, 0);
 
-	texBanner = loadTexture("banner.png");
+	win->gl.banner_texture = loadTexture("banner.png");
 }
 
 void render_banner(struct gbcc *gbc) {
 	struct gbcc_window *win = &gbc->window;
+	pass_bind(&win->gl.banner);
+	glBindTexture(GL_TEXTURE_2D, win->gl.banner_texture);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+void init_simple_rendering(struct gbcc *gbc) {
+	struct gbcc_window *win = &gbc->window;
+
+	win->gl.vertex_arrays = vertex_arrays_supported();
+
+	/* Only the overlays blend, the screen itself is opaque */
 	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glClearColor(0, 0, 0, 1);
 
-	glBindBuffer(GL_ARRAY_BUFFER, vboBanner);
+	glGenBuffers(1, &win->gl.ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, win->gl.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-	GLuint posLoc = glGetAttribLocation(simple_program, "aPos");
-	GLuint texLoc = glGetAttribLocation(simple_program, "aTex");
-	glEnableVertexAttribArray(posLoc);
-	glEnableVertexAttribArray(texLoc);
-	glVertexAttribPointer(posLoc, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
-	glVertexAttribPointer(texLoc, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
+	init_shaders(win);
 
+	get_texture_format(gbc->core.ppu.format, &win->gl.texture_format, &win->gl.texture_type);
+	create_frame_texture(win, &win->gl.texture);
+	create_frame_texture(win, &win->gl.last_frame_texture);
+	/* Not any frame's number, so the first one is always uploaded */
+	win->gl.texture_frame = UINT64_MAX;
 
-	glBindTexture(GL_TEXTURE_2D, texBanner);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	bool indexed = gbc->core.ppu.format == GBCC_PIXEL_INDEXED8;
+	init_pre_pass(win);
+	init_lut(win);
+	if (indexed) {
+		init_palette(win);
+	}
+	init_blend(win, indexed);
+	init_pixel_buffers(gbc);
+	init_banner(gbc);
+	init_fadeout(gbc);
+
+	win->fps.dt = 0;
+	win->initialised = true;
 }
 
-void init_simple_rendering(struct gbcc *gbc) {
-    struct gbcc_window *win = &gbc->window;
+void update_simple_rendering(struct gbcc *gbc, int w, int h, bool upload) {
+	struct gbcc_window *win = &gbc->window;
+	const struct shader *shader = &win->gl.shaders[win->gl.cur_shader];
+	bool indexed = gbc->core.ppu.format == GBCC_PIXEL_INDEXED8;
+	unsigned effects = frame_effects(gbc);
 
-    glEnable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	if (upload) {
+		swap_frames(win);
+	}
+	glBindTexture(GL_TEXTURE_2D, win->gl.texture);
+	if (upload) {
+		/* The texture still holds the frame otherwise, from this or another surface */
+		upload_frame(win, indexed);
+	}
 
-    // simple_program = create_program();
-    
-    simple_program = createProgram(vertex_shader_src,fragment_shader_src);
+	GLuint source = win->gl.texture;
+	GLuint last = win->gl.last_frame_texture;
+	const struct gbcc_gl_pass *pass = shader->pass.program ? &shader->pass : &win->gl.shaders[0].pass;
+	if (indexed && !win->gl.resolve_fbo) {
+		/* Coloured in as it's drawn then, with no shader */
+		pass = &win->gl.resolve;
+	} else {
+		if (indexed) {
+			if (upload) {
+				render_to_texture(win->gl.resolve_fbo, &win->gl.resolve);
+			}
+			source = win->gl.resolve_texture;
+			last = win->gl.last_resolve_texture;
+		}
+		/* Likewise the frame effects & framebuffer object, if nothing's changed */
+		if (effects && win->gl.blend_fbo) {
+			if (win->gl.blend_frame != win->gl.texture_frame || win->gl.blend_effects != effects) {
+				render_blend(win, source, last, effects);
+			}
+			source = win->gl.blend_texture;
+		}
+		if (shader->pre.program && win->gl.fbo) {
+			if (win->gl.fbo_frame != win->gl.texture_frame || win->gl.fbo_shader != win->gl.cur_shader
+					|| win->gl.fbo_effects != effects) {
+				glBindTexture(GL_TEXTURE_2D, source);
+				render_to_texture(win->gl.fbo, &shader->pre);
+				win->gl.fbo_frame = win->gl.texture_frame;
+				win->gl.fbo_shader = win->gl.cur_shader;
+				win->gl.fbo_effects = effects;
+			}
+			source = win->gl.fbo_texture;
+		}
+	}
 
+	glViewport(win->x, win->y, w, h);
+	glClear(GL_COLOR_BUFFER_BIT);
 
-    glUseProgram(simple_program);
+	pass_bind(pass);
+	glBindTexture(GL_TEXTURE_2D, source);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
 
-    glGenBuffers(1, &win->gl.vbo);
-    glGenBuffers(1, &win->gl.ebo);
+	glEnable(GL_BLEND);
+	render_banner(gbc);
+	render_fadeout(gbc);
 
-    GLuint posLoc = glGetAttribLocation(simple_program, "aPos");
-    GLuint texLoc = glGetAttribLocation(simple_program, "aTex");
+	/* Not straight after uploading, as some drivers flush on creating a fence */
+	if (win->gl.pbo_unfenced) {
+		win->gl.pbo_fence[win->gl.pbo_unfenced - 1] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		win->gl.pbo_unfenced = 0;
+	}
+}
 
-    glEnableVertexAttribArray(posLoc);
-    glEnableVertexAttribArray(texLoc);
+/* Draw at screen size from the texture bound to unit 0 */
+void render_to_texture(GLuint fbo, const struct gbcc_gl_pass *pass)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT);
+	pass_bind(pass);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, win->gl.vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+/*
+ * Mix the frame in source with the last one, into the blend framebuffer
+ * object. The last frame is only bound to unit 3 while it's needed, as it
+ * may be rendered into next.
+ */
+void render_blend(struct gbcc_window *win, GLuint source, GLuint last, unsigned effects)
+{
+	glUseProgram(win->gl.blend.program);
+	glUniform1i(win->gl.blend_odd_frame, (GLint)(win->gl.texture_frame & 1u));
+	glUniform1i(win->gl.blend_interlacing, (effects & EFFECT_INTERLACING) != 0);
+	glUniform1i(win->gl.blend_frameblending, (effects & EFFECT_FRAME_BLENDING) != 0);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, last);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, source);
+	render_to_texture(win->gl.blend_fbo, &win->gl.blend);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	win->gl.blend_frame = win->gl.texture_frame;
+	win->gl.blend_effects = effects;
+}
 
-    glVertexAttribPointer(posLoc, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
-    glVertexAttribPointer(texLoc, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
+unsigned frame_effects(const struct gbcc *gbc)
+{
+	return (gbc->frame_blending ? EFFECT_FRAME_BLENDING : 0)
+		| (gbc->interlacing ? EFFECT_INTERLACING : 0);
+}
+
+/*
+ * Make the last frame's textures the current ones' & vice versa, ready to
+ * upload over the frame before last, so the last frame's always kept for
+ * the frame effects without a copy.
+ */
+void swap_frames(struct gbcc_window *win)
+{
+	GLuint tmp = win->gl.texture;
+	win->gl.texture = win->gl.last_frame_texture;
+	win->gl.last_frame_texture = tmp;
+	if (win->gl.last_resolve_fbo) {
+		tmp = win->gl.resolve_fbo;
+		win->gl.resolve_fbo = win->gl.last_resolve_fbo;
+		win->gl.last_resolve_fbo = tmp;
+		tmp = win->gl.resolve_texture;
+		win->gl.resolve_texture = win->gl.last_resolve_texture;
+		win->gl.last_resolve_texture = tmp;
+	}
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, win->gl.ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+/*
+ * Into the texture bound to unit 0, along with the palette of an indexed
+ * frame if it differs from the last, which for most games is rarely.
+ */
+void upload_frame(struct gbcc_window *win, bool indexed)
+{
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	bool palette = indexed && win->frame->palette_version != win->gl.palette_version;
+	if (!win->gl.pbo[0] || !stream_frame(win, palette)) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT,
+				win->gl.texture_format, win->gl.texture_type, win->frame->pixels);
+		if (palette) {
+			glActiveTexture(GL_TEXTURE2);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GBCC_PIXEL_PALETTE_SIZE, GBC_SCREEN_HEIGHT,
+					GL_RGBA, GL_UNSIGNED_BYTE, win->frame->palette);
+			glActiveTexture(GL_TEXTURE0);
+		}
+	}
+	if (palette) {
+		win->gl.palette_version = win->frame->palette_version;
+		win->palette_uploads++;
+	}
+	win->gl.texture_frame = win->frame->number;
+	win->uploads++;
 
-    glGenTextures(1, &win->gl.texture);
-    glBindTexture(GL_TEXTURE_2D, win->gl.texture);
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	win->upload_time = gbcc_time_diff(&end, &start);
+	win->upload_time_total += win->upload_time;
+}
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+/*
+ * Copy the frame into the next buffer of the ring, which the GPU has
+ * finished with, so the driver can upload from it whenever it likes rather
+ * than copying it straight away. Returns false if the buffer couldn't be
+ * used, after which frames are uploaded directly.
+ */
+bool stream_frame(struct gbcc_window *win, bool palette)
+{
+	int slot = win->gl.pbo_next;
+	win->gl.pbo_next = (slot + 1) % (int)N_ELEM(win->gl.pbo);
+
+	GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+	if (win->gl.pbo_fence[slot]) {
+		GLenum res = glClientWaitSync(win->gl.pbo_fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, PBO_FENCE_TIMEOUT);
+		if (res == GL_TIMEOUT_EXPIRED || res == GL_WAIT_FAILED) {
+			/* Leave it to the driver to keep the buffer safe instead */
+			access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+		}
+		glDeleteSync(win->gl.pbo_fence[slot]);
+		win->gl.pbo_fence[slot] = 0;
+	}
 
+	GLsizeiptr size = win->gl.frame_size + (palette ? (GLsizeiptr)PALETTE_SIZE : 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, win->gl.pbo[slot]);
+	uint8_t *data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, access);
+	if (data) {
+		memcpy(data, win->frame->pixels, (size_t)win->gl.frame_size);
+		if (palette) {
+			memcpy(data + win->gl.frame_size, win->frame->palette, PALETTE_SIZE);
+		}
+	}
+	/* Contents can be lost while mapped, e.g. on a mode switch */
+	if (!data || !glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		gbcc_log_warning("Couldn't stream frame through a pixel buffer, uploading directly.\n");
+		destroy_pixel_buffers(win);
+		return false;
+	}
 
-    init_banner(gbc);
-    init_fadeout(gbc);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT,
+			win->gl.texture_format, win->gl.texture_type, (void *)0);
+	if (palette) {
+		glActiveTexture(GL_TEXTURE2);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GBCC_PIXEL_PALETTE_SIZE, GBC_SCREEN_HEIGHT,
+				GL_RGBA, GL_UNSIGNED_BYTE, (void *)(uintptr_t)win->gl.frame_size);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	win->gl.pbo_unfenced = slot + 1;
+	return true;
+}
 
-    win->fps.dt = 0;
-    win->initialised = true;
+void init_shaders(struct gbcc_window *win)
+{
+	/* Counted the same, so cycling through them never finds a gap */
+	_Static_assert(N_ELEM(shader_files) == N_ELEM(win->gl.shaders), "Shader table size mismatch");
+	for (size_t i = 0; i < N_ELEM(shader_files); i++) {
+		struct shader *shader = &win->gl.shaders[i];
+		shader->name = shader_files[i].name;
+		if (shader_files[i].pre) {
+			GLuint program = gbcc_shader_program("vert.vert", shader_files[i].pre);
+			pass_initialise(win, &shader->pre, program, pre_pass_vertices, sizeof(pre_pass_vertices), 4, 0);
+			/* The texture unit holding the colour lookup table, if used */
+			GLint lut = glGetUniformLocation(program, "lut");
+			if (lut >= 0) {
+				glUseProgram(program);
+				glUniform1i(lut, 1);
+			}
+		}
+		if (shader_files[i].frag) {
+			GLuint program = gbcc_shader_program("vert.vert", shader_files[i].frag);
+			pass_initialise(win, &shader->pass, program, vertices, sizeof(vertices), 4, win->gl.ebo);
+		}
+	}
 }
 
-void update_simple_rendering(struct gbcc *gbc, int w, int h) {
-	glUseProgram(simple_program);
+/*
+ * Pixel buffers, mapping & fences are all core in GLES 3. Each buffer holds
+ * a frame and its palette, if it has one.
+ */
+void init_pixel_buffers(struct gbcc *gbc)
+{
 	struct gbcc_window *win = &gbc->window;
-	glBindBuffer(GL_ARRAY_BUFFER, win->gl.vbo);
+	win->gl.frame_size = (GLsizeiptr)(GBC_SCREEN_SIZE * gbcc_pixel_size(gbc->core.ppu.format));
+#ifndef __ANDROID__
+	if (epoxy_gl_version() < 30) {
+		return;
+	}
+#endif
+	GLsizeiptr size = win->gl.frame_size;
+	if (gbc->core.ppu.format == GBCC_PIXEL_INDEXED8) {
+		size += (GLsizeiptr)PALETTE_SIZE;
+	}
+	glGenBuffers(N_ELEM(win->gl.pbo), win->gl.pbo);
+	for (size_t i = 0; i < N_ELEM(win->gl.pbo); i++) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, win->gl.pbo[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	win->gl.pbo_next = 0;
+}
 
-	GLuint posLoc = glGetAttribLocation(simple_program, "aPos");
-	GLuint texLoc = glGetAttribLocation(simple_program, "aTex");
-	glEnableVertexAttribArray(posLoc);
-	glEnableVertexAttribArray(texLoc);
-	glVertexAttribPointer(posLoc, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
-	glVertexAttribPointer(texLoc, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
+void destroy_pixel_buffers(struct gbcc_window *win)
+{
+	for (size_t i = 0; i < N_ELEM(win->gl.pbo); i++) {
+		if (win->gl.pbo_fence[i]) {
+			glDeleteSync(win->gl.pbo_fence[i]);
+			win->gl.pbo_fence[i] = 0;
+		}
+	}
+	if (win->gl.pbo[0]) {
+		glDeleteBuffers(N_ELEM(win->gl.pbo), win->gl.pbo);
+	}
+	memset(win->gl.pbo, 0, sizeof(win->gl.pbo));
+	win->gl.pbo_unfenced = 0;
+}
 
+/* For frames as they come from the core, see get_texture_format() */
+void create_frame_texture(struct gbcc_window *win, GLuint *texture)
+{
+	glGenTextures(1, texture);
+	glBindTexture(GL_TEXTURE_2D, *texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	/* Some shaders sample neighbouring pixels, which mustn't wrap */
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, (GLint)win->gl.texture_format, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT, 0,
+			win->gl.texture_format, win->gl.texture_type, NULL);
+}
 
-	glViewport(win->x, win->y, w, h);
-	glClearColor(0, 0, 0, 1);
-	glClear(GL_COLOR_BUFFER_BIT);
+/* Screen-sized target for the pre passes */
+void init_pre_pass(struct gbcc_window *win)
+{
+	if (!create_render_target(&win->gl.fbo, &win->gl.fbo_texture)) {
+		gbcc_log_warning("Can't render to texture, shaders with a pre pass will draw as-is.\n");
+	}
+	win->gl.fbo_frame = UINT64_MAX;
+}
 
-	glBindTexture(GL_TEXTURE_2D, win->gl.texture);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT, GL_RGBA,
-			GL_UNSIGNED_BYTE, (GLvoid *)win->buffer);
+/* Sets fbo & texture to 0 if it's not supported */
+bool create_render_target(GLuint *fbo, GLuint *texture)
+{
+	glGenTextures(1, texture);
+	glBindTexture(GL_TEXTURE_2D, *texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	glGenFramebuffers(1, fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texture, 0);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!complete) {
+		glDeleteFramebuffers(1, fbo);
+		*fbo = 0;
+		glDeleteTextures(1, texture);
+		*texture = 0;
+	}
+	return complete;
+}
 
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+/*
+ * Indexed frames are coloured in from their palettes by a pass of their own,
+ * at screen size, so that shaders see them as any other frame. The palette
+ * stays bound to texture unit 2.
+ */
+void init_palette(struct gbcc_window *win)
+{
+	GLuint program = gbcc_shader_program("vert.vert", "palette.frag");
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "palette"), 2);
+	if (create_render_target(&win->gl.resolve_fbo, &win->gl.resolve_texture)) {
+		pass_initialise(win, &win->gl.resolve, program, pre_pass_vertices, sizeof(pre_pass_vertices), 4, 0);
+		/* For the last frame, which the frame effects do without if it fails */
+		create_render_target(&win->gl.last_resolve_fbo, &win->gl.last_resolve_texture);
+	} else {
+		gbcc_log_warning("Can't render to texture, shaders are disabled.\n");
+		pass_initialise(win, &win->gl.resolve, program, vertices, sizeof(vertices), 4, win->gl.ebo);
+	}
 
-	render_banner(gbc);
-	render_fadeout(gbc);
+	glActiveTexture(GL_TEXTURE2);
+	glGenTextures(1, &win->gl.palette_texture);
+	glBindTexture(GL_TEXTURE_2D, win->gl.palette_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GBCC_PIXEL_PALETTE_SIZE, GBC_SCREEN_HEIGHT, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glActiveTexture(GL_TEXTURE0);
+	win->gl.palette_version = UINT64_MAX;
+}
+
+/*
+ * Frame blending & interlacing mix each frame with the last, at screen size
+ * into a framebuffer object of their own, before any shader sees it.
+ */
+void init_blend(struct gbcc_window *win, bool indexed)
+{
+	win->gl.blend_frame = UINT64_MAX;
+	if ((indexed && !win->gl.last_resolve_fbo)
+			|| !create_render_target(&win->gl.blend_fbo, &win->gl.blend_texture)) {
+		gbcc_log_warning("Can't render to texture, frame blending & interlacing are disabled.\n");
+		return;
+	}
+	GLuint program = gbcc_shader_program("vert.vert", "frameblend.frag");
+	pass_initialise(win, &win->gl.blend, program, pre_pass_vertices, sizeof(pre_pass_vertices), 4, 0);
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "last_tex"), 3);
+	win->gl.blend_odd_frame = glGetUniformLocation(program, "odd_frame");
+	win->gl.blend_interlacing = glGetUniformLocation(program, "interlacing");
+	win->gl.blend_frameblending = glGetUniformLocation(program, "frameblending");
+}
+
+/*
+ * The colour correction table, as an atlas of 8 slices by blue level, see
+ * shaders/gles2/colour-correct.frag. It stays bound to texture unit 1.
+ */
+void init_lut(struct gbcc_window *win)
+{
+	uint8_t lut[8][8][8][4];
+	gbcc_fill_lut(lut);
+	uint8_t atlas[8][64][4];
+	for (int b = 0; b < 8; b++) {
+		for (int g = 0; g < 8; g++) {
+			for (int r = 0; r < 8; r++) {
+				memcpy(atlas[g][b * 8 + r], lut[b][g][r], sizeof(atlas[g][b * 8 + r]));
+			}
+		}
+	}
+	glActiveTexture(GL_TEXTURE1);
+	glGenTextures(1, &win->gl.lut_texture);
+	glBindTexture(GL_TEXTURE_2D, win->gl.lut_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 64, 8, 0, GL_RGBA, GL_UNSIGNED_BYTE, atlas);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+/*
+ * Vertex array objects let a whole pass be bound at once. They're core in
+ * GLES 3, and a common extension to GLES 2.
+ */
+bool vertex_arrays_supported(void)
+{
+#ifdef __ANDROID__
+	return true;
+#else
+	return epoxy_gl_version() >= 30 || epoxy_has_gl_extension("GL_OES_vertex_array_object");
+#endif
+}
+
+void pass_initialise(struct gbcc_window *win, struct gbcc_gl_pass *pass, GLuint program,
+		const GLfloat *data, GLsizeiptr size, GLsizei components, GLuint ebo)
+{
+	*pass = (struct gbcc_gl_pass){
+		.program = program,
+		.ebo = ebo,
+		.stride = components * (GLsizei)sizeof(GLfloat),
+		.pos = glGetAttribLocation(program, "aPos"),
+		.tex = glGetAttribLocation(program, "aTex"),
+		.time = glGetUniformLocation(program, "time")
+	};
+	glGenBuffers(1, &pass->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, pass->vbo);
+	glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+	if (win->gl.vertex_arrays) {
+		glGenVertexArrays(1, &pass->vao);
+		glBindVertexArray(pass->vao);
+		pass_set_attributes(pass);
+		glBindVertexArray(0);
+	}
+}
+
+void pass_bind(const struct gbcc_gl_pass *pass)
+{
+	glUseProgram(pass->program);
+	if (pass->vao) {
+		glBindVertexArray(pass->vao);
+	} else {
+		pass_set_attributes(pass);
+	}
+}
+
+/* Vertices are positions, followed by texture coordinates if there are any */
+void pass_set_attributes(const struct gbcc_gl_pass *pass)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, pass->vbo);
+	if (pass->pos >= 0) {
+		glEnableVertexAttribArray((GLuint)pass->pos);
+		glVertexAttribPointer((GLuint)pass->pos, 2, GL_FLOAT, GL_FALSE, pass->stride, (void *)0);
+	}
+	if (pass->tex >= 0) {
+		glEnableVertexAttribArray((GLuint)pass->tex);
+		glVertexAttribPointer((GLuint)pass->tex, 2, GL_FLOAT, GL_FALSE, pass->stride, (void *)(2 * sizeof(GLfloat)));
+	}
+	if (pass->ebo) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pass->ebo);
+	}
+}
+
+void pass_destroy(struct gbcc_gl_pass *pass)
+{
+	glDeleteBuffers(1, &pass->vbo);
+	if (pass->vao) {
+		glDeleteVertexArrays(1, &pass->vao);
+	}
+	*pass = (struct gbcc_gl_pass){0};
 }
 
 void gbcc_window_initialise(struct gbcc *gbc)
@@ -360,15 +709,13 @@ void gbcc_window_initialise(struct gbcc *gbc)
 	struct gbcc_window *win = &gbc->window;
 	*win = (struct gbcc_window){0};
 
-	GLint read_framebuffer = 0;
-	GLint draw_framebuffer = 0;
-	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
-	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
-
 	clock_gettime(CLOCK_REALTIME, &win->fps.last_time);
 	gbcc_fontmap_load(&win->font);
 
-	return init_simple_rendering(gbc);
+	init_simple_rendering(gbc);
+	if (gbc->default_shader[0] != '\0') {
+		gbcc_window_use_shader(gbc, gbc->default_shader);
+	}
 }
 
 void gbcc_window_deinitialise(struct gbcc *gbc)
@@ -381,72 +728,130 @@ void gbcc_window_deinitialise(struct gbcc *gbc)
 	win->initialised = false;
 
 	gbcc_fontmap_destroy(&win->font);
-	glDeleteBuffers(1, &win->gl.vbo);
-	glDeleteVertexArrays(1, &win->gl.vao);
+	glDeleteProgram(win->gl.fadeout.program);
+	pass_destroy(&win->gl.banner);
+	pass_destroy(&win->gl.fadeout);
+	for (size_t i = 0; i < N_ELEM(win->gl.shaders); i++) {
+		glDeleteProgram(win->gl.shaders[i].pre.program);
+		glDeleteProgram(win->gl.shaders[i].pass.program);
+		pass_destroy(&win->gl.shaders[i].pre);
+		pass_destroy(&win->gl.shaders[i].pass);
+	}
+	glDeleteTextures(1, &win->gl.banner_texture);
 	glDeleteBuffers(1, &win->gl.ebo);
 	glDeleteFramebuffers(1, &win->gl.fbo);
 	glDeleteTextures(1, &win->gl.fbo_texture);
 	glDeleteRenderbuffers(1, &win->gl.rbo);
 	glDeleteTextures(1, &win->gl.texture);
-#ifdef GL_LUT
+	glDeleteTextures(1, &win->gl.last_frame_texture);
+	glDeleteProgram(win->gl.blend.program);
+	pass_destroy(&win->gl.blend);
+	glDeleteFramebuffers(1, &win->gl.blend_fbo);
+	glDeleteTextures(1, &win->gl.blend_texture);
 	glDeleteTextures(1, &win->gl.lut_texture);
-#endif
-	for (size_t i = 0; i < N_ELEM(win->gl.shaders); i++) {
-		glDeleteProgram(win->gl.shaders[i].program);
-	}
-	glDeleteProgram(win->gl.base_shader);
+	glDeleteProgram(win->gl.resolve.program);
+	pass_destroy(&win->gl.resolve);
+	glDeleteFramebuffers(1, &win->gl.resolve_fbo);
+	glDeleteTextures(1, &win->gl.resolve_texture);
+	glDeleteFramebuffers(1, &win->gl.last_resolve_fbo);
+	glDeleteTextures(1, &win->gl.last_resolve_texture);
+	glDeleteTextures(1, &win->gl.palette_texture);
+	destroy_pixel_buffers(win);
 }
 
+void gbcc_window_prepare(struct gbcc *gbc, struct gbcc_window_surface *surface, const struct gbcc_frame *frame)
+{
+	struct gbcc_window *win = &gbc->window;
+	update_timers(gbc);
 
-float rand_float() {
-    return (float)rand() / (float)RAND_MAX;
+	win->frame = frame;
+
+	struct gbcc_window_rect viewport = gbcc_window_layout(surface->width, surface->height, gbc->fractional_scaling);
+	/*
+	 * The banner & fade out are drawn inside the viewport, so only a
+	 * change of layout touches the borders.
+	 */
+	if (surface->width != surface->drawn_width || surface->height != surface->drawn_height
+			|| memcmp(&viewport, &surface->viewport, sizeof(viewport)) != 0) {
+		surface->damage = (struct gbcc_window_rect){
+			.width = surface->width,
+			.height = surface->height
+		};
+	} else if (win->frame->number != surface->drawn_frame || win->gl.cur_shader != surface->drawn_shader
+			|| frame_effects(gbc) != surface->drawn_effects || gbc->animating) {
+		surface->damage = viewport;
+	} else {
+		surface->damage = (struct gbcc_window_rect){0};
+	}
+	surface->viewport = viewport;
+}
+
+struct gbcc_window_rect gbcc_window_layout(int32_t width, int32_t height, bool fractional)
+{
+	float scale = min((float)width / GBC_SCREEN_WIDTH, (float)height / GBC_SCREEN_HEIGHT);
+	if (!fractional && scale >= 1) {
+		/* Fall back to fractional scaling if the screen won't fit at all */
+		scale = floorf(scale);
+	}
+	int32_t w = (int32_t)(scale * GBC_SCREEN_WIDTH);
+	int32_t h = (int32_t)(scale * GBC_SCREEN_HEIGHT);
+	return (struct gbcc_window_rect){
+		.x = (width - w) / 2,
+		.y = (height - h) / 2,
+		.width = w,
+		.height = h
+	};
 }
 
-void gbcc_window_update(struct gbcc *gbc)
+void gbcc_window_draw(struct gbcc *gbc, struct gbcc_window_surface *surface)
 {
+	struct gbcc_window *win = &gbc->window;
+	win->scale = (float)surface->viewport.width / GBC_SCREEN_WIDTH;
+	win->x = (uint32_t)surface->viewport.x;
+	win->y = (uint32_t)surface->viewport.y;
+	update_simple_rendering(gbc, surface->viewport.width, surface->viewport.height,
+			win->frame->number != win->gl.texture_frame);
+	surface->drawn_width = surface->width;
+	surface->drawn_height = surface->height;
+	surface->drawn_frame = win->frame->number;
+	surface->drawn_shader = win->gl.cur_shader;
+	surface->drawn_effects = frame_effects(gbc);
+}
 
+void gbcc_window_update(struct gbcc *gbc, struct gbcc_window_surface *surface, const struct gbcc_frame *frame)
+{
 	struct gbcc_window *win = &gbc->window;
 	if (!win->initialised) {
 		gbcc_log_error("Can't update window: Window not initialised!\n");
 		return;
 	}
-	update_timers(gbc);
-	GLint read_framebuffer = 0;
-	GLint draw_framebuffer = 0;
-	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
-	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
-
-	memcpy(win->buffer, gbc->core.ppu.screen.sdl, GBC_SCREEN_SIZE * sizeof(win->buffer[0]));
-	{
-		int val = 0;
-		sem_getvalue(&gbc->core.ppu.vsync_semaphore, &val);
-		if (!val) {
-			sem_post(&gbc->core.ppu.vsync_semaphore);
-		}
-	}
-
-
-	for (size_t i = 0; i < N_ELEM(win->buffer); i++) {
-		uint32_t tmp = win->buffer[i];
-		win->buffer[i] = (tmp & 0xFFu) << 24u
-				| (tmp & 0xFF00u) << 8u
-				| (tmp & 0xFF0000u) >> 8u
-				| (tmp & 0xFF000000u) >> 24u;
-	}
+	gbcc_window_prepare(gbc, surface, frame);
+	gbcc_window_draw(gbc, surface);
+}
 
-	/* Setup - resize our screen textures if needed */
-	if (gbc->fractional_scaling) {
-		win->scale = min((float)win->width / GBC_SCREEN_WIDTH, (float)win->height / GBC_SCREEN_HEIGHT);
-	} else {
-		win->scale = min((float)(win->width / GBC_SCREEN_WIDTH), (float)(win->height / GBC_SCREEN_HEIGHT));
+/* Texture format & type matching the core's framebuffer, for uploading as-is */
+void get_texture_format(enum gbcc_pixel_format format, GLenum *gl_format, GLenum *gl_type)
+{
+	switch (format) {
+		case GBCC_PIXEL_RGBA8888:
+			*gl_format = GL_RGBA;
+			*gl_type = GL_UNSIGNED_BYTE;
+			return;
+		case GBCC_PIXEL_XRGB8888:
+			/* Requires EXT_texture_format_BGRA8888 */
+			*gl_format = GL_BGRA_EXT;
+			*gl_type = GL_UNSIGNED_BYTE;
+			return;
+		case GBCC_PIXEL_RGB565:
+			*gl_format = GL_RGB;
+			*gl_type = GL_UNSIGNED_SHORT_5_6_5;
+			return;
+		case GBCC_PIXEL_INDEXED8:
+			/* Only sampled by the palette pass, as a number */
+			*gl_format = GL_LUMINANCE;
+			*gl_type = GL_UNSIGNED_BYTE;
+			return;
 	}
-	unsigned int width = (unsigned int)(win->scale * GBC_SCREEN_WIDTH);
-	unsigned int height = (unsigned int)(win->scale * GBC_SCREEN_HEIGHT);
-	win->x = ((unsigned int)win->width - width) / 2;
-	win->y = ((unsigned int)win->height - height) / 2;
-
-
-	return update_simple_rendering(gbc,width,height);
 }
 
 void gbcc_load_shader(GLuint shader, const char *filename)
@@ -525,7 +930,7 @@ void gbcc_window_use_shader(struct gbcc *gbc, const char *name)
 	int num_shaders = N_ELEM(win->gl.shaders);
 	int s;
 	for (s = 0; s < num_shaders; s++) {
-		if (strcasecmp(name, win->gl.shaders[s].name) == 0) {
+		if (shader_name_matches(win->gl.shaders[s].name, name)) {
 			break;
 		}
 	}
@@ -536,6 +941,27 @@ void gbcc_window_use_shader(struct gbcc *gbc, const char *name)
 	}
 }
 
+/* Ignoring case, spaces & hyphens, so "dotmatrix" finds "Dot Matrix" */
+bool shader_name_matches(const char *name, const char *query)
+{
+	while (true) {
+		while (*name == ' ' || *name == '-') {
+			name++;
+		}
+		while (*query == ' ' || *query == '-') {
+			query++;
+		}
+		if (tolower((unsigned char)*name) != tolower((unsigned char)*query)) {
+			return false;
+		}
+		if (*name == '\0') {
+			return true;
+		}
+		name++;
+		query++;
+	}
+}
+
 void gbcc_window_show_message(struct gbcc *gbc, const char *msg, unsigned seconds, bool pad)
 {
 	struct gbcc_window *win = &gbc->window;
@@ -563,14 +989,8 @@ void update_timers(struct gbcc *gbc)
 	clock_gettime(CLOCK_REALTIME, &cur_time);
 	float dt = (float)gbcc_time_diff(&cur_time, &fps->last_time);
 	float seconds = dt / 1e9f;
-	dt /= GBC_FRAME_PERIOD;
 	fps->dt = seconds;
 
-	const float alpha = 0.001f;
-	if (dt < 1.1f && dt > 0.9f) {
-		gbc->audio.scale = alpha * dt + (1 - alpha) * gbc->audio.scale;
-	}
-
 	/* Update FPS counter */
 	fps->last_time = cur_time;
 	float df = (float)(gbc->core.ppu.frame - fps->last_frame);
@@ -585,7 +1005,7 @@ void update_timers(struct gbcc *gbc)
 	df += ly / 154.0f;
 	fps->last_frame = gbc->core.ppu.frame;
 	fps->last_ly = tmp;
-	fps->previous[fps->idx] = df / (dt * GBC_FRAME_PERIOD / 1e9f);
+	fps->previous[fps->idx] = df / seconds;
 	fps->idx++;
 	fps->idx %= N_ELEM(fps->previous);
 	float avg = 0;
@@ -594,8 +1014,19 @@ void update_timers(struct gbcc *gbc)
 	}
 	fps->fps = avg / N_ELEM(fps->previous);
 
+	/*
+	 * Timed here rather than as the fade out is drawn, so that it runs at
+	 * the same speed however many surfaces draw it.
+	 */
+	if (gbc->animating) {
+		currentTime += seconds;
+		if (currentTime > 5) {
+			gbc->animating = false;
+		}
+	}
+
 	/* Update message timer */
 	if (win->msg.time_left > 0) {
-		win->msg.time_left -= (int64_t)(dt * GBC_FRAME_PERIOD);
+		win->msg.time_left -= (int64_t)dt;
 	}
 }
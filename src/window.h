@@ -34,10 +34,57 @@
 #define MSG_BUF_SIZE 128
 
 struct gbcc;
+struct gbcc_frame;
 
+/*
+ * One draw, with everything it needs looked up and uploaded once, so that
+ * drawing is just binding and issuing the call.
+ */
+struct gbcc_gl_pass {
+	GLuint program;
+	GLuint vbo;
+	GLuint ebo;		/* 0 if drawn without indices */
+	GLuint vao;		/* 0 without vertex array object support */
+	GLsizei stride;
+	GLint pos;		/* Attribute & uniform locations, -1 if unused */
+	GLint tex;
+	GLint time;
+};
+
+/*
+ * A built-in shader, as up to two passes. Work that only depends on the
+ * frame is done once by the pre pass, at screen size into the framebuffer
+ * object, however many surfaces then draw it.
+ */
 struct shader {
 	const char *name;
-	GLuint program;
+	struct gbcc_gl_pass pre;	/* Program 0 if there's no pre pass */
+	struct gbcc_gl_pass pass;	/* Program 0 to draw as-is */
+};
+
+/* In pixels, from the bottom left as for glViewport and EGL damage */
+struct gbcc_window_rect {
+	int32_t x;
+	int32_t y;
+	int32_t width;
+	int32_t height;
+};
+
+/*
+ * A surface the window draws on. Several can share the window's GL context,
+ * e.g. one per output, each with its own size & damage but all showing the
+ * same frame, which is only uploaded once.
+ */
+struct gbcc_window_surface {
+	int32_t width;
+	int32_t height;
+	struct gbcc_window_rect viewport;	/* Where the screen is drawn */
+	struct gbcc_window_rect damage;	/* What the next draw changes, empty if nothing */
+	int32_t drawn_width;		/* Size when last drawn, 0 if never */
+	int32_t drawn_height;
+	uint64_t drawn_frame;		/* Number of the frame last drawn */
+	int drawn_shader;		/* Shader it was drawn with */
+	unsigned drawn_effects;		/* & frame blending or interlacing */
 };
 
 struct fps_counter {
@@ -52,25 +99,56 @@ struct fps_counter {
 
 struct gbcc_window {
 	struct gbcc_fontmap font;
-	uint32_t x;
+	uint32_t x;			/* Layout of the surface last drawn */
 	uint32_t y;
-	int32_t width;
-	int32_t height;
 	float scale;
-	uint32_t buffer[GBC_SCREEN_SIZE];
-	uint32_t last_buffer[GBC_SCREEN_SIZE];
+	const struct gbcc_frame *frame;	/* Being drawn, from gbcc_window_prepare */
+	uint64_t uploads;		/* Frames uploaded, for comparing with draws */
+	uint64_t palette_uploads;	/* Of indexed frames, those whose palette was too */
+	uint64_t upload_time;		/* Nanoseconds the last upload took the CPU */
+	uint64_t upload_time_total;
 	struct {
-		GLuint vbo_banner;
-		GLuint vbo;
-		GLuint vao;
+		struct gbcc_gl_pass banner;
+		struct gbcc_gl_pass fadeout;
+		bool vertex_arrays;
+		GLenum texture_format;	/* Matching the core's framebuffer */
+		GLenum texture_type;
+		GLuint banner_texture;
 		GLuint ebo;
-		GLuint fbo;
+		GLuint fbo;		/* 0 if pre passes aren't supported */
 		GLuint fbo_texture;
-		GLuint last_frame_texture;
+		uint64_t fbo_frame;	/* Number of the frame pre-processed */
+		int fbo_shader;		/* & the shader that did it */
+		unsigned fbo_effects;	/* & the frame effects it was given */
 		GLuint rbo;
+		/* Uploads alternate between these, so the last frame's always kept */
 		GLuint texture;
+		GLuint last_frame_texture;
+		uint64_t texture_frame;	/* Number of the frame in texture */
+		/* Frame blending & interlacing, which mix in the last frame */
+		struct gbcc_gl_pass blend;
+		GLint blend_odd_frame;		/* Uniform locations */
+		GLint blend_interlacing;
+		GLint blend_frameblending;
+		GLuint blend_fbo;		/* 0 if they're not supported */
+		GLuint blend_texture;
+		uint64_t blend_frame;		/* Number of the frame blended */
+		unsigned blend_effects;		/* & the effects applied */
 		GLuint lut_texture;
-		GLuint base_shader;
+		/* Indexed frames only, see pixel.h */
+		GLuint palette_texture;		/* A row of colours per line */
+		uint64_t palette_version;	/* Of the frame whose palette it holds */
+		struct gbcc_gl_pass resolve;	/* Colours the frame in, into resolve_fbo if there is one */
+		GLuint resolve_fbo;
+		GLuint resolve_texture;
+		GLuint last_resolve_fbo;	/* Alternating with resolve_fbo, like the textures */
+		GLuint last_resolve_texture;
+		/* Ring of buffers that frames are streamed through, all 0 without GLES 3 */
+		GLuint pbo[3];
+		GLsync pbo_fence[3];		/* Set once the GPU has read the buffer */
+		int pbo_next;
+		int pbo_unfenced;		/* Buffer + 1 to fence once the frame's drawn */
+		GLsizeiptr frame_size;		/* Bytes of pixels in a frame */
 		int cur_shader;
 		struct shader shaders[4];
 	} gl;
@@ -87,7 +165,19 @@ struct gbcc_window {
 
 void gbcc_window_initialise(struct gbcc *gbc);
 void gbcc_window_deinitialise(struct gbcc *gbc);
-void gbcc_window_update(struct gbcc *gbc);
+/*
+ * Works out the layout and damage for drawing frame on surface, so the
+ * caller can restrict rendering or presentation to what changed. The caller
+ * acquires frame from the core's mailbox, once for all the surfaces it draws
+ * on, and keeps it until they're drawn.
+ */
+void gbcc_window_prepare(struct gbcc *gbc, struct gbcc_window_surface *surface, const struct gbcc_frame *frame);
+/* Draw on surface, which must be current */
+void gbcc_window_draw(struct gbcc *gbc, struct gbcc_window_surface *surface);
+/* Where the screen goes on a surface of the given size, centred */
+struct gbcc_window_rect gbcc_window_layout(int32_t width, int32_t height, bool fractional);
+/* Prepare and draw in one go */
+void gbcc_window_update(struct gbcc *gbc, struct gbcc_window_surface *surface, const struct gbcc_frame *frame);
 void gbcc_window_clear(void);
 void gbcc_window_show_message(struct gbcc *gbc, const char *msg, unsigned seconds, bool pad);
 void gbcc_window_use_shader(struct gbcc *gbc, const char *name);